@@ -20,13 +20,16 @@
 
 #define BCK2835_LIBRARY_BUILD
 #include "bcm2835.h"
+#include "probes.h"
 
-/* This define enables a little test program (by default a blinking output on pin RPI_GPIO_PIN_11)
-// You can do some safe, non-destructive testing on any platform with:
-// gcc bcm2835.c -D BCM2835_TEST
-// ./a.out
+#ifdef BCM2835_TRACE
+#include <stdatomic.h>
+#endif
+
+/* The little blink test program that used to live here is now bench/bench_hal.c,
+// which measures the library on the hardware or, built with -DBCM2835_REGISTER_MODEL,
+// against an in-memory register model on any platform.
 */
-/*#define BCM2835_TEST*/
 
 /* Uncommenting this define compiles alternative I2C code for the version 1 RPi
 // The P1 header I2C pins are connected to SDA0 and SCL0 on V1.
@@ -66,6 +69,226 @@ static uint8_t debug = 0;
  */
 static int i2c_byte_wait_us = 0;
 
+/* Called with the reason of every I2C transfer that does not end with
+// BCM2835_I2C_REASON_OK, NULL for none (see bcm2835_i2c_set_error_hook)
+*/
+static void (*i2c_error_hook)(uint8_t reason, uint32_t len) = NULL;
+
+#ifdef BCM2835_TRACE
+/* Register access tracing (see BCM2835_TRACE in bcm2835.h)
+// Each access takes a slot of the ring with one atomic add and publishes it with a
+// sequence number, seqlock style, so the dump can skip slots that are being rewritten.
+// The per register counters live in a small open addressed table keyed by the word
+// offset of the register in the peripherals block.
+*/
+struct bcm2835_trace_entry
+{
+    _Atomic uint32_t seq;   /* index of the access + 1, 0 while being written */
+    char     op;            /* 'R' read, 'r' read_nb, 'W' write, 'w' write_nb */
+    uint32_t addr;          /* physical address */
+    uint32_t value;
+    uint64_t ns;            /* CLOCK_MONOTONIC */
+};
+
+static struct bcm2835_trace_entry trace_ring[BCM2835_TRACE_RING_SIZE];
+static _Atomic uint32_t trace_head;
+static _Atomic uint32_t trace_keys[BCM2835_TRACE_REGS];       /* word offset + 1, 0 = free */
+static _Atomic uint32_t trace_reads[BCM2835_TRACE_REGS + 1];  /* last one: everything else */
+static _Atomic uint32_t trace_writes[BCM2835_TRACE_REGS + 1];
+
+/* Returns the counter index of a register, BCM2835_TRACE_REGS if it has none */
+static unsigned int bcm2835_trace_slot(uint32_t key)
+{
+    unsigned int i, n;
+    uint32_t     k;
+
+    if (key == 0)
+	return BCM2835_TRACE_REGS;
+    i = (key * 2654435761u) & (BCM2835_TRACE_REGS - 1);
+    for (n = 0; n < BCM2835_TRACE_REGS; n++, i = (i + 1) & (BCM2835_TRACE_REGS - 1))
+    {
+	k = atomic_load_explicit(&trace_keys[i], memory_order_relaxed);
+	if (k == 0)
+	{
+	    /* claim it, unless another thread just did (possibly for the same register) */
+	    if (atomic_compare_exchange_strong_explicit(&trace_keys[i], &k, key,
+							memory_order_relaxed, memory_order_relaxed))
+		return i;
+	}
+	if (k == key)
+	    return i;
+    }
+    return BCM2835_TRACE_REGS;
+}
+
+/* Word offset + 1 of paddr in the peripherals block, 0 if it lies outside; the
+// physical address in *addr
+*/
+static uint32_t bcm2835_trace_key(volatile uint32_t* paddr, uint32_t* addr)
+{
+    uintptr_t offset = (uintptr_t)paddr - (uintptr_t)bcm2835_peripherals;
+
+    if (bcm2835_peripherals == MAP_FAILED || offset >= bcm2835_peripherals_size)
+    {
+	*addr = (uint32_t)(uintptr_t)paddr;
+	return 0;
+    }
+    *addr = (uint32_t)((uintptr_t)bcm2835_peripherals_base + offset);
+    return (uint32_t)(offset / 4 + 1);
+}
+
+static void bcm2835_trace(volatile uint32_t* paddr, uint32_t value, char op)
+{
+    struct bcm2835_trace_entry *e;
+    struct timespec t;
+    unsigned int    slot;
+    uint32_t        seq, addr;
+
+    slot = bcm2835_trace_slot(bcm2835_trace_key(paddr, &addr));
+    if (op == 'R' || op == 'r')
+	atomic_fetch_add_explicit(&trace_reads[slot], 1, memory_order_relaxed);
+    else
+	atomic_fetch_add_explicit(&trace_writes[slot], 1, memory_order_relaxed);
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    seq = atomic_fetch_add_explicit(&trace_head, 1, memory_order_relaxed);
+    e = &trace_ring[seq & (BCM2835_TRACE_RING_SIZE - 1)];
+    atomic_store_explicit(&e->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    e->op    = op;
+    e->addr  = addr;
+    e->value = value;
+    e->ns    = (uint64_t)t.tv_sec * 1000000000u + t.tv_nsec;
+    atomic_store_explicit(&e->seq, seq + 1, memory_order_release);
+}
+
+void bcm2835_trace_count(volatile uint32_t* paddr, uint32_t* reads, uint32_t* writes)
+{
+    uint32_t     key, addr;
+    unsigned int i, n;
+
+    /* look the register up without claiming a counter for it */
+    key = bcm2835_trace_key(paddr, &addr);
+    i = (key * 2654435761u) & (BCM2835_TRACE_REGS - 1);
+    for (n = 0; key && n < BCM2835_TRACE_REGS; n++, i = (i + 1) & (BCM2835_TRACE_REGS - 1))
+	if (atomic_load_explicit(&trace_keys[i], memory_order_relaxed) == key)
+	    break;
+    if (key == 0 || n == BCM2835_TRACE_REGS)
+	i = BCM2835_TRACE_REGS;
+    if (reads)
+	*reads = atomic_load_explicit(&trace_reads[i], memory_order_relaxed);
+    if (writes)
+	*writes = atomic_load_explicit(&trace_writes[i], memory_order_relaxed);
+}
+
+/* Formatting for bcm2835_trace_dump(), which must not use stdio */
+static char *bcm2835_trace_hex(char *p, uint32_t v)
+{
+    int i;
+
+    *p++ = '0';
+    *p++ = 'x';
+    for (i = 28; i >= 0; i -= 4)
+	*p++ = "0123456789abcdef"[(v >> i) & 0xf];
+    return p;
+}
+
+static char *bcm2835_trace_dec(char *p, uint64_t v)
+{
+    char buf[20];
+    int  n = 0;
+
+    do
+	buf[n++] = '0' + v % 10;
+    while ((v /= 10) != 0);
+    while (n)
+	*p++ = buf[--n];
+    return p;
+}
+
+static void bcm2835_trace_puts(int fd, const char *s, size_t len)
+{
+    ssize_t ret;
+
+    while (len)
+    {
+	ret = write(fd, s, len);
+	if (ret < 0 && errno == EINTR)
+	    continue;
+	if (ret <= 0)
+	    return;
+	s += ret;
+	len -= ret;
+    }
+}
+
+void bcm2835_trace_dump(int fd)
+{
+    static const char counts_hdr[]   = "# register,reads,writes\n";
+    static const char accesses_hdr[] = "# time_ns,op,register,value\n";
+    struct bcm2835_trace_entry e;
+    char         line[64], *p;
+    uint32_t     head, i, key, seq;
+    unsigned int slot;
+    int          saved_errno = errno;
+
+    bcm2835_trace_puts(fd, counts_hdr, sizeof(counts_hdr) - 1);
+    for (slot = 0; slot <= BCM2835_TRACE_REGS; slot++)
+    {
+	key = slot < BCM2835_TRACE_REGS ? atomic_load_explicit(&trace_keys[slot], memory_order_relaxed) : 0;
+	if (slot < BCM2835_TRACE_REGS && key == 0)
+	    continue;
+	p = line;
+	if (key)
+	    p = bcm2835_trace_hex(p, (uint32_t)(uintptr_t)bcm2835_peripherals_base + (key - 1) * 4);
+	else
+	{
+	    *p++ = 'o'; *p++ = 't'; *p++ = 'h'; *p++ = 'e'; *p++ = 'r';
+	}
+	*p++ = ',';
+	p = bcm2835_trace_dec(p, atomic_load_explicit(&trace_reads[slot], memory_order_relaxed));
+	*p++ = ',';
+	p = bcm2835_trace_dec(p, atomic_load_explicit(&trace_writes[slot], memory_order_relaxed));
+	*p++ = '\n';
+	bcm2835_trace_puts(fd, line, p - line);
+    }
+
+    bcm2835_trace_puts(fd, accesses_hdr, sizeof(accesses_hdr) - 1);
+    head = atomic_load_explicit(&trace_head, memory_order_acquire);
+    i = head > BCM2835_TRACE_RING_SIZE ? head - BCM2835_TRACE_RING_SIZE : 0;
+    for (; i != head; i++)
+    {
+	struct bcm2835_trace_entry *slot_e = &trace_ring[i & (BCM2835_TRACE_RING_SIZE - 1)];
+
+	seq = atomic_load_explicit(&slot_e->seq, memory_order_acquire);
+	if (seq != i + 1)
+	    continue;
+	e.op    = slot_e->op;
+	e.addr  = slot_e->addr;
+	e.value = slot_e->value;
+	e.ns    = slot_e->ns;
+	atomic_thread_fence(memory_order_acquire);
+	if (atomic_load_explicit(&slot_e->seq, memory_order_relaxed) != seq)
+	    continue;   /* overwritten while we copied it */
+
+	p = bcm2835_trace_dec(line, e.ns);
+	*p++ = ',';
+	*p++ = e.op;
+	*p++ = ',';
+	p = bcm2835_trace_hex(p, e.addr);
+	*p++ = ',';
+	p = bcm2835_trace_hex(p, e.value);
+	*p++ = '\n';
+	bcm2835_trace_puts(fd, line, p - line);
+    }
+    errno = saved_errno;
+}
+
+#define BCM2835_TRACE_ACCESS(paddr, value, op) bcm2835_trace((paddr), (value), (op))
+#else
+#define BCM2835_TRACE_ACCESS(paddr, value, op)
+#endif
+
 /*
 // Low level register access functions
 */
@@ -113,13 +336,16 @@ uint32_t bcm2835_peri_read(volatile uint32_t* paddr)
     if (debug)
     {
         printf("bcm2835_peri_read  paddr %08X\n", (unsigned) paddr);
+	BCM2835_TRACE_ACCESS(paddr, 0, 'R');
 	return 0;
     }
     else
     {
-#ifdef __arm__
-	/* Following code provides memory barriers before and after the read */
        uint32_t ret;
+#if defined(BCM2835_REGISTER_MODEL)
+       ret = bcm2835_model_read(paddr);
+#elif defined(__arm__)
+	/* Following code provides memory barriers before and after the read */
 #ifdef BCM2835_HAVE_DMB
        __asm__(        "\
   dmb                    \n\
@@ -134,10 +360,11 @@ uint32_t bcm2835_peri_read(volatile uint32_t* paddr)
   mcr p15,0,r10, c7, c10, 5 \n\
 " : [ret] "=r" (ret) : [paddr] "r" (paddr) : "r10", "memory" );
 #endif
-       return ret;
 #else
-       return *paddr; /* Not used on bcm2835 */
+       ret = *paddr; /* Not used on bcm2835 */
 #endif
+       BCM2835_TRACE_ACCESS(paddr, ret, 'R');
+       return ret;
 
     }
 }
@@ -153,11 +380,18 @@ uint32_t bcm2835_peri_read_nb(volatile uint32_t* paddr)
     if (debug)
     {
 	printf("bcm2835_peri_read_nb  paddr %08X\n", (unsigned) paddr);
+	BCM2835_TRACE_ACCESS(paddr, 0, 'r');
 	return 0;
     }
     else
     {
-	return *paddr;
+#ifdef BCM2835_REGISTER_MODEL
+	uint32_t ret = bcm2835_model_read(paddr);
+#else
+	uint32_t ret = *paddr;
+#endif
+	BCM2835_TRACE_ACCESS(paddr, ret, 'r');
+	return ret;
     }
 }
 
@@ -166,13 +400,16 @@ uint32_t bcm2835_peri_read_nb(volatile uint32_t* paddr)
 
 void bcm2835_peri_write(volatile uint32_t* paddr, uint32_t value)
 {
+    BCM2835_TRACE_ACCESS(paddr, value, 'W');
     if (debug)
     {
 	printf("bcm2835_peri_write paddr %08X, value %08X\n", (unsigned) paddr, value);
     }
     else
     {
-#ifdef __arm__
+#if defined(BCM2835_REGISTER_MODEL)
+	bcm2835_model_write(paddr, value);
+#elif defined(__arm__)
 	/* Following code provides memory barriers before and after the write */
 #ifdef BCM2835_HAVE_DMB
        __asm__(        "\
@@ -196,6 +433,7 @@ void bcm2835_peri_write(volatile uint32_t* paddr, uint32_t value)
 /* write to peripheral without the write barrier */
 void bcm2835_peri_write_nb(volatile uint32_t* paddr, uint32_t value)
 {
+    BCM2835_TRACE_ACCESS(paddr, value, 'w');
     if (debug)
     {
 	printf("bcm2835_peri_write_nb paddr %08X, value %08X\n",
@@ -203,12 +441,17 @@ void bcm2835_peri_write_nb(volatile uint32_t* paddr, uint32_t value)
     }
     else
     {
+#ifdef BCM2835_REGISTER_MODEL
+	bcm2835_model_write(paddr, value);
+#else
 	*paddr = value;
+#endif
     }
 }
 
 /* Set/clear only the bits in value covered by the mask
  * This is not atomic - can be interrupted.
+ * With BCM2835_TRACE it shows up as its read and its write.
  */
 void bcm2835_peri_set_bits(volatile uint32_t* paddr, uint32_t value, uint32_t mask)
 {
@@ -594,6 +837,7 @@ uint8_t bcm2835_spi_transfer(uint8_t value)
     volatile uint32_t* fifo = bcm2835_spi0 + BCM2835_SPI0_FIFO/4;
     uint32_t ret;
 
+    VG_PROBE1(spi_start, 1);
     /* This is Polled transfer as per section 10.6.1
     // BUG ALERT: what happens if we get interupted in this section, and someone else
     // accesses a different peripheral? 
@@ -621,6 +865,7 @@ uint8_t bcm2835_spi_transfer(uint8_t value)
     /* Set TA = 0, and also set the barrier */
     bcm2835_peri_set_bits(paddr, 0, BCM2835_SPI0_CS_TA);
 
+    VG_PROBE1(spi_end, 1);
     return ret;
 }
 
@@ -632,6 +877,7 @@ void bcm2835_spi_transfernb(char* tbuf, char* rbuf, uint32_t len)
     uint32_t TXCnt=0;
     uint32_t RXCnt=0;
 
+    VG_PROBE1(spi_start, len);
     /* This is Polled transfer as per section 10.6.1
     // BUG ALERT: what happens if we get interupted in this section, and someone else
     // accesses a different peripheral? 
@@ -665,6 +911,7 @@ void bcm2835_spi_transfernb(char* tbuf, char* rbuf, uint32_t len)
 
     /* Set TA = 0, and also set the barrier */
     bcm2835_peri_set_bits(paddr, 0, BCM2835_SPI0_CS_TA);
+    VG_PROBE1(spi_end, len);
 }
 
 /* Writes an number of bytes to SPI */
@@ -674,6 +921,7 @@ void bcm2835_spi_writenb(char* tbuf, uint32_t len)
     volatile uint32_t* fifo = bcm2835_spi0 + BCM2835_SPI0_FIFO/4;
     uint32_t i;
 
+    VG_PROBE1(spi_start, len);
     /* This is Polled transfer as per section 10.6.1
     // BUG ALERT: what happens if we get interupted in this section, and someone else
     // accesses a different peripheral?
@@ -708,6 +956,7 @@ void bcm2835_spi_writenb(char* tbuf, uint32_t len)
 
     /* Set TA = 0, and also set the barrier */
     bcm2835_peri_set_bits(paddr, 0, BCM2835_SPI0_CS_TA);
+    VG_PROBE1(spi_end, len);
 }
 
 /* Writes (and reads) an number of bytes to SPI
@@ -801,6 +1050,12 @@ void bcm2835_i2c_setClockDivider(uint16_t divider)
     i2c_byte_wait_us = ((float)divider / BCM2835_CORE_CLK_HZ) * 1000000 * 9;
 }
 
+/* Sets the function told about failed I2C transfers */
+void bcm2835_i2c_set_error_hook(void (*hook)(uint8_t reason, uint32_t len))
+{
+    i2c_error_hook = hook;
+}
+
 /* set I2C clock divider by means of a baudrate number */
 void bcm2835_i2c_set_baudrate(uint32_t baudrate)
 {
@@ -829,6 +1084,8 @@ uint8_t bcm2835_i2c_write(const char * buf, uint32_t len)
     uint32_t i = 0;
     uint8_t reason = BCM2835_I2C_REASON_OK;
 
+    VG_PROBE1(i2c_start, len);
+
     /* Clear FIFO */
     bcm2835_peri_set_bits(control, BCM2835_BSC_C_CLEAR_1 , BCM2835_BSC_C_CLEAR_1 );
     /* Clear Status */
@@ -878,6 +1135,9 @@ uint8_t bcm2835_i2c_write(const char * buf, uint32_t len)
 
     bcm2835_peri_set_bits(control, BCM2835_BSC_S_DONE , BCM2835_BSC_S_DONE);
 
+    VG_PROBE2(i2c_end, len, reason);
+    if (reason != BCM2835_I2C_REASON_OK && i2c_error_hook)
+	i2c_error_hook(reason, len);
     return reason;
 }
 
@@ -900,6 +1160,8 @@ uint8_t bcm2835_i2c_read(char* buf, uint32_t len)
     uint32_t i = 0;
     uint8_t reason = BCM2835_I2C_REASON_OK;
 
+    VG_PROBE1(i2c_start, len);
+
     /* Clear FIFO */
     bcm2835_peri_set_bits(control, BCM2835_BSC_C_CLEAR_1 , BCM2835_BSC_C_CLEAR_1 );
     /* Clear Status */
@@ -951,6 +1213,9 @@ uint8_t bcm2835_i2c_read(char* buf, uint32_t len)
 
     bcm2835_peri_set_bits(control, BCM2835_BSC_S_DONE , BCM2835_BSC_S_DONE);
 
+    VG_PROBE2(i2c_end, len, reason);
+    if (reason != BCM2835_I2C_REASON_OK && i2c_error_hook)
+	i2c_error_hook(reason, len);
     return reason;
 }
 
@@ -973,6 +1238,8 @@ uint8_t bcm2835_i2c_read_register_rs(char* regaddr, char* buf, uint32_t len)
 	uint32_t remaining = len;
     uint32_t i = 0;
     uint8_t reason = BCM2835_I2C_REASON_OK;
+
+    VG_PROBE1(i2c_start, len);
     
     /* Clear FIFO */
     bcm2835_peri_set_bits(control, BCM2835_BSC_C_CLEAR_1 , BCM2835_BSC_C_CLEAR_1 );
@@ -1042,6 +1309,9 @@ uint8_t bcm2835_i2c_read_register_rs(char* regaddr, char* buf, uint32_t len)
 
     bcm2835_peri_set_bits(control, BCM2835_BSC_S_DONE , BCM2835_BSC_S_DONE);
 
+    VG_PROBE2(i2c_end, len, reason);
+    if (reason != BCM2835_I2C_REASON_OK && i2c_error_hook)
+	i2c_error_hook(reason, len);
     return reason;
 }
 
@@ -1065,6 +1335,8 @@ uint8_t bcm2835_i2c_write_read_rs(char* cmds, uint32_t cmds_len, char* buf, uint
     uint32_t remaining = cmds_len;
     uint32_t i = 0;
     uint8_t reason = BCM2835_I2C_REASON_OK;
+
+    VG_PROBE1(i2c_start, cmds_len + buf_len);
     
     /* Clear FIFO */
     bcm2835_peri_set_bits(control, BCM2835_BSC_C_CLEAR_1 , BCM2835_BSC_C_CLEAR_1 );
@@ -1146,6 +1418,9 @@ uint8_t bcm2835_i2c_write_read_rs(char* cmds, uint32_t cmds_len, char* buf, uint
 
     bcm2835_peri_set_bits(control, BCM2835_BSC_S_DONE , BCM2835_BSC_S_DONE);
 
+    VG_PROBE2(i2c_end, cmds_len + buf_len, reason);
+    if (reason != BCM2835_I2C_REASON_OK && i2c_error_hook)
+	i2c_error_hook(reason, cmds_len + buf_len);
     return reason;
 }
 
@@ -1262,6 +1537,7 @@ void *malloc_aligned(size_t size)
     return (errno ? NULL : mem);
 }
 
+#ifndef BCM2835_REGISTER_MODEL
 /* Map 'size' bytes starting at 'off' in file 'fd' to memory.
 // Return mapped address on success, MAP_FAILED otherwise.
 // On error print message.
@@ -1280,6 +1556,7 @@ static void unmapmem(void **pmem, size_t size)
     munmap(*pmem, size);
     *pmem = MAP_FAILED;
 }
+#endif
 
 /* Initialise this library. */
 int bcm2835_init(void)
@@ -1319,9 +1596,20 @@ int bcm2835_init(void)
     }
     /* else we are prob on RPi 1 with BCM2835, and use the hardwired defaults */
 
-    /* Now get ready to map the peripherals block */
     memfd = -1;
     ok = 0;
+#ifdef BCM2835_REGISTER_MODEL
+    /* No hardware: the registers are plain memory, their behaviour comes from
+    // bcm2835_model_read() and bcm2835_model_write()
+    */
+    bcm2835_peripherals = calloc(1, bcm2835_peripherals_size);
+    if (bcm2835_peripherals == NULL)
+    {
+	bcm2835_peripherals = MAP_FAILED;
+	goto exit;
+    }
+#else
+    /* Now get ready to map the peripherals block */
     /* Open the master /dev/memory device */
     if ((memfd = open("/dev/mem", O_RDWR | O_SYNC) ) < 0) 
     {
@@ -1333,6 +1621,7 @@ int bcm2835_init(void)
     /* Base of the peripherals block is mapped to VM */
     bcm2835_peripherals = mapmem("gpio", bcm2835_peripherals_size, memfd, (uint32_t)bcm2835_peripherals_base);
     if (bcm2835_peripherals == MAP_FAILED) goto exit;
+#endif
 
     /* Now compute the base addresses of various peripherals, 
     // which are at fixed offsets within the mapped peripherals block
@@ -1364,7 +1653,12 @@ int bcm2835_close(void)
 {
     if (debug) return 1; /* Success */
 
+#ifdef BCM2835_REGISTER_MODEL
+    if (bcm2835_peripherals != MAP_FAILED)
+	free(bcm2835_peripherals);
+#else
     unmapmem((void**) &bcm2835_peripherals, bcm2835_peripherals_size);
+#endif
     bcm2835_peripherals = MAP_FAILED;
     bcm2835_gpio = MAP_FAILED;
     bcm2835_pwm  = MAP_FAILED;
@@ -1376,87 +1670,3 @@ int bcm2835_close(void)
     bcm2835_st   = MAP_FAILED;
     return 1; /* Success */
 }    
-
-#ifdef BCM2835_TEST
-/* this is a simple test program that prints out what it will do rather than 
-// actually doing it
-*/
-int main(int argc, char **argv)
-{
-    /* Be non-destructive */
-    bcm2835_set_debug(1);
-
-    if (!bcm2835_init())
-	return 1;
-
-    /* Configure some GPIO pins fo some testing
-    // Set RPI pin P1-11 to be an output
-    */
-    bcm2835_gpio_fsel(RPI_GPIO_P1_11, BCM2835_GPIO_FSEL_OUTP);
-    /* Set RPI pin P1-15 to be an input */
-    bcm2835_gpio_fsel(RPI_GPIO_P1_15, BCM2835_GPIO_FSEL_INPT);
-    /*  with a pullup */
-    bcm2835_gpio_set_pud(RPI_GPIO_P1_15, BCM2835_GPIO_PUD_UP);
-    /* And a low detect enable */
-    bcm2835_gpio_len(RPI_GPIO_P1_15);
-    /* and input hysteresis disabled on GPIOs 0 to 27 */
-    bcm2835_gpio_set_pad(BCM2835_PAD_GROUP_GPIO_0_27, BCM2835_PAD_SLEW_RATE_UNLIMITED|BCM2835_PAD_DRIVE_8mA);
-
-#if 1
-    /* Blink */
-    while (1)
-    {
-	/* Turn it on */
-	bcm2835_gpio_write(RPI_GPIO_P1_11, HIGH);
-	
-	/* wait a bit */
-	bcm2835_delay(500);
-	
-	/* turn it off */
-	bcm2835_gpio_write(RPI_GPIO_P1_11, LOW);
-	
-	/* wait a bit */
-	bcm2835_delay(500);
-    }
-#endif
-
-#if 0
-    /* Read input */
-    while (1)
-    {
-	/* Read some data */
-	uint8_t value = bcm2835_gpio_lev(RPI_GPIO_P1_15);
-	printf("read from pin 15: %d\n", value);
-	
-	/* wait a bit */
-	bcm2835_delay(500);
-    }
-#endif
-
-#if 0
-    /* Look for a low event detection
-    // eds will be set whenever pin 15 goes low
-    */
-    while (1)
-    {
-	if (bcm2835_gpio_eds(RPI_GPIO_P1_15))
-	{
-	    /* Now clear the eds flag by setting it to 1 */
-	    bcm2835_gpio_set_eds(RPI_GPIO_P1_15);
-	    printf("low event detect for pin 15\n");
-	}
-
-	/* wait a bit */
-	bcm2835_delay(500);
-    }
-#endif
-
-    if (!bcm2835_close())
-	return 1;
-
-    return 0;
-}
-#endif
-
-
-
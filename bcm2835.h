@@ -432,6 +432,14 @@
 #define BCM2835_HAVE_DMB
 #endif
 
+/* Register access tracing, compiled in with -DBCM2835_TRACE.
+   bcm2835_peri_read(), bcm2835_peri_write(), their _nb variants and, through them,
+   bcm2835_peri_set_bits() then count the accesses per register and record each one
+   in an in-memory ring. Without BCM2835_TRACE none of it is compiled.
+*/
+#define BCM2835_TRACE_RING_SIZE 4096 /* accesses kept, power of 2 */
+#define BCM2835_TRACE_REGS      256  /* registers counted, power of 2; the rest share one counter */
+
 /*! \defgroup constants Constants for passing to and from library functions
   The values here are designed to be passed to various functions in the bcm2835 library.
   @{
@@ -1089,6 +1097,57 @@ extern "C" {
     extern void bcm2835_peri_set_bits(volatile uint32_t* paddr, uint32_t value, uint32_t mask);
     /*! @}    end of lowlevel */
 
+#ifdef BCM2835_TRACE
+    /*! \defgroup trace Register access tracing
+      Only available when the library is compiled with -DBCM2835_TRACE.
+      Every access made through the low level register access functions is counted per
+      register and recorded (time, physical address, value) in a ring of the last
+      BCM2835_TRACE_RING_SIZE accesses. Recording is lock-free and safe from any thread.
+      @{
+    */
+
+    /*! Returns the number of accesses to a register since the start of the program.
+      The counts wrap at 2^32. Registers beyond the first BCM2835_TRACE_REGS touched,
+      and addresses outside the peripherals block, are all counted together.
+      \param[in] paddr Address of the register, as passed to bcm2835_peri_read() etc.
+      \param[out] reads Number of reads, may be NULL
+      \param[out] writes Number of writes, may be NULL
+    */
+    extern void bcm2835_trace_count(volatile uint32_t* paddr, uint32_t* reads, uint32_t* writes);
+
+    /*! Writes the access counts and the recorded accesses, oldest first, as text to a file
+      descriptor. Only write() is used, so this may be called from a signal handler.
+      Accesses recorded while the dump runs may be missing from it.
+      \param[in] fd File descriptor to write to
+    */
+    extern void bcm2835_trace_dump(int fd);
+    /*! @}    end of trace */
+#endif
+
+#ifdef BCM2835_REGISTER_MODEL
+    /*! \defgroup model In-memory register model
+      Built with -DBCM2835_REGISTER_MODEL, bcm2835_init() allocates the peripherals block
+      from plain memory instead of mapping /dev/mem, and every access made by the low
+      level register access functions goes to these two functions instead of the
+      hardware. The program linked with the library provides them and decides how the
+      registers behave (see bench/bench_hal.c).
+      @{
+    */
+
+    /*! Returns the value a register read gives.
+      \param[in] paddr Address of the register inside the allocated peripherals block
+      \return the 32 bit value read
+    */
+    extern uint32_t bcm2835_model_read(volatile uint32_t* paddr);
+
+    /*! Applies a register write.
+      \param[in] paddr Address of the register inside the allocated peripherals block
+      \param[in] value The 32 bit value written
+    */
+    extern void bcm2835_model_write(volatile uint32_t* paddr, uint32_t value);
+    /*! @}    end of model */
+#endif
+
     /*! \defgroup gpio GPIO register access
       These functions allow you to control the GPIO interface. You can set the 
       function of each GPIO pin, read the input state and set the output state.
@@ -1506,6 +1565,14 @@ extern "C" {
     */
     extern uint8_t bcm2835_i2c_write_read_rs(char* cmds, uint32_t cmds_len, char* buf, uint32_t buf_len);
 
+    /*! Sets a function to be called after every I2C transfer that fails: a NACK, a clock
+      stretch timeout or data not all sent / received. It is called by the thread which
+      made the transfer, right before the transfer function returns, and must not block.
+      \param[in] hook Called with the reason (see \ref bcm2835I2CReasonCodes) and the
+      number of bytes of the transfer; NULL for none
+    */
+    extern void bcm2835_i2c_set_error_hook(void (*hook)(uint8_t reason, uint32_t len));
+
     /*! @} */
 
     /*! \defgroup st System Timer access
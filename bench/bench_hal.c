@@ -0,0 +1,345 @@
+/******************************************
+ * bench_hal
+ * Throughput and latency of the bcm2835 library: GPIO writes, register reads with and
+ * without barriers, the system timer, delay accuracy, SPI and I2C transfers.
+ *
+ * usage: bench_hal [iterations]   (default 1000000)
+ *
+ * On a Raspberry Pi (as root) it measures the hardware. CAUTION: it toggles BENCH_PIN and
+ * the BENCH_MULTI_MASK pins and takes over the SPI0 and I2C pins, so run it with nothing
+ * wired to them (the valve GPIOs of the app are left alone). The I2C transfers need no
+ * device: without one they end in a NACK, which shows in the result column.
+ * Built with -DBCM2835_REGISTER_MODEL it runs on any host against the in-memory register
+ * model below, which is the baseline for comparing changes to the library itself.
+ * Output is one CSV line per measurement:
+ *     test,size,iterations,value,unit
+ *******************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "../bcm2835.h"
+
+/******************************************
+ *                Defines
+ *******************************************/
+#define BENCH_PIN        RPI_GPIO_P1_11 // GPIO 17
+#define BENCH_MULTI_MASK ((1 << 17) | (1 << 18) | (1 << 22) | (1 << 23) | (1 << 24) | (1 << 25) | (1 << 27))
+#define DELAY_SAMPLES    20
+#define BUS_BYTES_TOTAL  (256 * 1024) // moved per SPI/I2C measurement (model; 1/64 of it on hardware)
+
+/******************************************
+ *             Global Variables
+ *******************************************/
+static unsigned long iterations = 1000000;
+static volatile uint32_t sink; // keeps the results of the timed calls alive
+
+/******************************************
+ * now_nsec()
+ *******************************************/
+static int64_t now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#ifdef BCM2835_REGISTER_MODEL
+/******************************************
+ * Register model
+ * Just enough behaviour for the library's polling loops to finish like on the chip:
+ * GPIO set/clear registers drive the level register, the SPI FIFO loops back and
+ * always has room and data, an I2C transfer is done once DLEN bytes went through the
+ * FIFO, and the system timer counts microseconds of CLOCK_MONOTONIC. Every other
+ * register is plain memory.
+ *******************************************/
+static uint32_t model_levels[2];
+static uint32_t model_spi_fifo;
+static uint32_t model_bsc_dlen[2];
+static uint32_t model_bsc_count[2];
+
+/******************************************
+ * model_offset()
+ * return: byte offset of a register in the peripherals block
+ *******************************************/
+static uint32_t model_offset(volatile uint32_t *paddr)
+{
+	return (uint32_t)((uintptr_t)paddr - (uintptr_t)bcm2835_peripherals);
+}
+
+/******************************************
+ * model_bsc()
+ * return: 0 or 1 for a register of BSC0 or BSC1, -1 otherwise; its offset in 'reg'
+ *******************************************/
+static int model_bsc(uint32_t off, uint32_t *reg)
+{
+	if(off >= BCM2835_BSC0_BASE && off < BCM2835_BSC0_BASE + 0x20) {
+		*reg = off - BCM2835_BSC0_BASE;
+		return 0;
+	}
+	if(off >= BCM2835_BSC1_BASE && off < BCM2835_BSC1_BASE + 0x20) {
+		*reg = off - BCM2835_BSC1_BASE;
+		return 1;
+	}
+	return -1;
+}
+
+/******************************************
+ * bcm2835_model_read()
+ *******************************************/
+uint32_t bcm2835_model_read(volatile uint32_t *paddr)
+{
+	uint32_t off = model_offset(paddr);
+	uint32_t reg, s;
+	int64_t us;
+	int b;
+
+	switch(off) {
+	case BCM2835_ST_BASE + BCM2835_ST_CLO:
+		return (uint32_t)(now_nsec() / 1000);
+	case BCM2835_ST_BASE + BCM2835_ST_CHI:
+		us = now_nsec() / 1000;
+		return (uint32_t)(us >> 32);
+	case BCM2835_GPIO_BASE + BCM2835_GPLEV0:
+		return model_levels[0];
+	case BCM2835_GPIO_BASE + BCM2835_GPLEV0 + 4:
+		return model_levels[1];
+	case BCM2835_SPI0_BASE + BCM2835_SPI0_CS:
+		return *paddr | BCM2835_SPI0_CS_TXD | BCM2835_SPI0_CS_RXD | BCM2835_SPI0_CS_DONE;
+	case BCM2835_SPI0_BASE + BCM2835_SPI0_FIFO:
+		return model_spi_fifo;
+	}
+
+	b = model_bsc(off, &reg);
+	if(b >= 0 && reg == BCM2835_BSC_S) {
+		s = BCM2835_BSC_S_TXD;
+		if(model_bsc_count[b] < model_bsc_dlen[b])
+			s |= BCM2835_BSC_S_RXD | BCM2835_BSC_S_TA;
+		else
+			s |= BCM2835_BSC_S_DONE;
+		return s;
+	}
+	if(b >= 0 && reg == BCM2835_BSC_FIFO) {
+		model_bsc_count[b]++;
+		return 0xa5;
+	}
+	return *paddr;
+}
+
+/******************************************
+ * bcm2835_model_write()
+ *******************************************/
+void bcm2835_model_write(volatile uint32_t *paddr, uint32_t value)
+{
+	uint32_t off = model_offset(paddr);
+	uint32_t reg;
+	int b;
+
+	switch(off) {
+	case BCM2835_GPIO_BASE + BCM2835_GPSET0:
+		model_levels[0] |= value;
+		return;
+	case BCM2835_GPIO_BASE + BCM2835_GPSET0 + 4:
+		model_levels[1] |= value;
+		return;
+	case BCM2835_GPIO_BASE + BCM2835_GPCLR0:
+		model_levels[0] &= ~value;
+		return;
+	case BCM2835_GPIO_BASE + BCM2835_GPCLR0 + 4:
+		model_levels[1] &= ~value;
+		return;
+	case BCM2835_SPI0_BASE + BCM2835_SPI0_FIFO:
+		model_spi_fifo = value;
+		return;
+	}
+
+	b = model_bsc(off, &reg);
+	if(b >= 0 && reg == BCM2835_BSC_S)
+		return; // write 1 to clear: the status is computed
+	if(b >= 0 && reg == BCM2835_BSC_DLEN) {
+		model_bsc_dlen[b]  = value;
+		model_bsc_count[b] = 0;
+	} else if(b >= 0 && reg == BCM2835_BSC_FIFO) {
+		model_bsc_count[b]++;
+		return;
+	}
+	*paddr = value;
+}
+#endif
+
+/******************************************
+ * report()
+ *******************************************/
+static void report(const char *test, unsigned long size, unsigned long n, double value, const char *unit)
+{
+	printf("%s,%lu,%lu,%.3f,%s\n", test, size, n, value, unit);
+	fflush(stdout);
+}
+
+/******************************************
+ * bench_gpio()
+ * Toggles one pin with bcm2835_gpio_write() and a group of pins with
+ * bcm2835_gpio_set_multi()/clr_multi(): register writes per second.
+ *******************************************/
+static void bench_gpio(void)
+{
+	unsigned long i;
+	unsigned int pin;
+	int64_t t0, t1;
+
+	bcm2835_gpio_fsel(BENCH_PIN, BCM2835_GPIO_FSEL_OUTP);
+	t0 = now_nsec();
+	for(i=0; i<iterations; i++)
+		bcm2835_gpio_write(BENCH_PIN, i & 1);
+	t1 = now_nsec();
+	report("gpio_write", 1, iterations, iterations / ((t1 - t0) / 1e9), "writes_per_sec");
+
+	for(pin=0; pin<32; pin++)
+		if(BENCH_MULTI_MASK & (1u << pin))
+			bcm2835_gpio_fsel(pin, BCM2835_GPIO_FSEL_OUTP);
+	t0 = now_nsec();
+	for(i=0; i<iterations; i++) {
+		if(i & 1)
+			bcm2835_gpio_set_multi(BENCH_MULTI_MASK);
+		else
+			bcm2835_gpio_clr_multi(BENCH_MULTI_MASK);
+	}
+	t1 = now_nsec();
+	report("gpio_set_multi", __builtin_popcount(BENCH_MULTI_MASK), iterations, iterations / ((t1 - t0) / 1e9), "writes_per_sec");
+	bcm2835_gpio_clr_multi(BENCH_MULTI_MASK);
+}
+
+/******************************************
+ * bench_reads()
+ * Register read cost with and without the memory barriers, and of the system timer.
+ *******************************************/
+static void bench_reads(void)
+{
+	volatile uint32_t *lev = bcm2835_gpio + BCM2835_GPLEV0/4;
+	uint32_t acc = 0;
+	unsigned long i;
+	int64_t t0, t1;
+
+	t0 = now_nsec();
+	for(i=0; i<iterations; i++)
+		acc += bcm2835_peri_read(lev);
+	t1 = now_nsec();
+	report("peri_read", 4, iterations, (double)(t1 - t0) / iterations, "ns_per_op");
+
+	t0 = now_nsec();
+	for(i=0; i<iterations; i++)
+		acc += bcm2835_peri_read_nb(lev);
+	t1 = now_nsec();
+	report("peri_read_nb", 4, iterations, (double)(t1 - t0) / iterations, "ns_per_op");
+
+	t0 = now_nsec();
+	for(i=0; i<iterations; i++)
+		acc += (uint32_t)bcm2835_st_read();
+	t1 = now_nsec();
+	report("st_read", 8, iterations, (double)(t1 - t0) / iterations, "ns_per_op");
+	sink = acc;
+}
+
+/******************************************
+ * bench_delay()
+ * How far bcm2835_delayMicroseconds() overshoots, measured on CLOCK_MONOTONIC.
+ *******************************************/
+static void bench_delay(void)
+{
+	static const uint64_t delays[] = {1, 10, 100, 1000, 10000};
+	double err, sum, max;
+	unsigned int d, i;
+	int64_t t0, t1;
+
+	for(d=0; d<sizeof(delays)/sizeof(delays[0]); d++) {
+		sum = 0;
+		max = 0;
+		for(i=0; i<DELAY_SAMPLES; i++) {
+			t0 = now_nsec();
+			bcm2835_delayMicroseconds(delays[d]);
+			t1 = now_nsec();
+			err = (t1 - t0) / 1e3 - delays[d];
+			sum += err;
+			if(err > max)
+				max = err;
+		}
+		report("delay_error_mean", delays[d], DELAY_SAMPLES, sum / DELAY_SAMPLES, "us");
+		report("delay_error_max", delays[d], DELAY_SAMPLES, max, "us");
+	}
+}
+
+/******************************************
+ * bench_bus()
+ * SPI transfernb() and I2C write()/read() throughput for a few transfer sizes.
+ *******************************************/
+static void bench_bus(void)
+{
+	static const uint32_t sizes[] = {1, 16, 256, 4096};
+	static char tbuf[4096], rbuf[4096];
+	unsigned long total = BUS_BYTES_TOTAL, n, i;
+	unsigned int s;
+	uint8_t reason = BCM2835_I2C_REASON_OK;
+	int64_t t0, t1;
+
+#ifndef BCM2835_REGISTER_MODEL
+	total /= 64;
+#endif
+	memset(tbuf, 0x5a, sizeof(tbuf));
+
+	bcm2835_spi_begin();
+	bcm2835_spi_setClockDivider(BCM2835_SPI_CLOCK_DIVIDER_16);
+	for(s=0; s<sizeof(sizes)/sizeof(sizes[0]); s++) {
+		n = total / sizes[s] ? total / sizes[s] : 1;
+		t0 = now_nsec();
+		for(i=0; i<n; i++)
+			bcm2835_spi_transfernb(tbuf, rbuf, sizes[s]);
+		t1 = now_nsec();
+		report("spi_transfernb", sizes[s], n, n * sizes[s] / ((t1 - t0) / 1e9), "bytes_per_sec");
+	}
+	bcm2835_spi_end();
+
+	bcm2835_i2c_begin();
+	bcm2835_i2c_setSlaveAddress(0x50);
+	for(s=0; s<sizeof(sizes)/sizeof(sizes[0]); s++) {
+		n = total / sizes[s] / 16 ? total / sizes[s] / 16 : 1;
+		t0 = now_nsec();
+		for(i=0; i<n; i++)
+			reason |= bcm2835_i2c_write(tbuf, sizes[s]);
+		t1 = now_nsec();
+		report(reason ? "i2c_write_failed" : "i2c_write", sizes[s], n, n * sizes[s] / ((t1 - t0) / 1e9), "bytes_per_sec");
+
+		reason = BCM2835_I2C_REASON_OK;
+		t0 = now_nsec();
+		for(i=0; i<n; i++)
+			reason |= bcm2835_i2c_read(rbuf, sizes[s]);
+		t1 = now_nsec();
+		report(reason ? "i2c_read_failed" : "i2c_read", sizes[s], n, n * sizes[s] / ((t1 - t0) / 1e9), "bytes_per_sec");
+		reason = BCM2835_I2C_REASON_OK;
+	}
+	bcm2835_i2c_end();
+}
+
+/******************************************
+ * main()
+ *******************************************/
+int main(int argc, char **argv)
+{
+	if(argc > 1)
+		iterations = strtoul(argv[1], NULL, 10);
+	if(iterations == 0)
+		iterations = 1;
+
+	if(!bcm2835_init())
+		return 1;
+
+	printf("test,size,iterations,value,unit\n");
+	bench_gpio();
+	bench_reads();
+	bench_delay();
+	bench_bus();
+
+	bcm2835_close();
+	return 0;
+}
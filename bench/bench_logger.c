@@ -0,0 +1,396 @@
+/******************************************
+ * bench_logger
+ * Logging throughput and caller latency with many concurrent producers.
+ *
+ * usage: bench_logger [-n messages_per_producer] [-s stall_us] [-e every] [-f log_file] [backend ...]
+ *
+ * backends (default: all of them):
+ *   log         the LOG_INFO() macros: typed arguments into the lock-free ring
+ *   print_safe  print_safe(): varargs into the same ring
+ *   stdio       the old print_safe() of the app, kept here as the baseline: mutex,
+ *               fopen(), fprintf() of the formatted line, fclose() per message
+ * For 1, 2, 4, ... 32 producer threads, every producer logs the same wake-up messages
+ * the task threads log; the run ends when everything accepted is in the file. Next to
+ * the producers a task thread wakes up every TASK_PERIOD_US on an absolute deadline and
+ * logs one message per wake-up, like a task thread of the app; how late after its
+ * deadline it is done shows how logging stalls carry over into task timing.
+ *
+ * -s simulates slow storage (an SD card busy erasing): every 'every'-th write to the
+ * log file sleeps stall_us first. The ring's writer thread hits it once per batch, the
+ * stdio baseline once per message, inside its mutex. The logger's writes are
+ * intercepted with the linker's --wrap=pwrite (see the build line in readme.txt).
+ *
+ * Output is one CSV line per backend and producer count:
+ *     backend,producers,stall_us,messages,seconds,msgs_per_sec,dropped,bytes,
+ *     call_p50_ns,call_p99_ns,call_p999_ns,call_max_ns,task_late_p99_us,task_late_max_us
+ *******************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "../logger.h"
+
+/******************************************
+ *                Defines
+ *******************************************/
+#define MAX_PRODUCERS    32
+#define TASK_PERIOD_US   1000
+#define TASK_SAMPLES_MAX (600 * 1000000 / TASK_PERIOD_US) // ten minutes of wake-ups
+#define STDIO_LOG_FILE   "bench_log_file.csv"
+
+/******************************************
+ *              Data Types
+ *******************************************/
+enum bench_backend {
+	BACKEND_LOG,
+	BACKEND_PRINT_SAFE,
+	BACKEND_STDIO,
+	BACKEND_COUNT
+};
+
+struct producer_arg {
+	unsigned int task_id;
+	uint32_t    *latency_ns; // one entry per message
+};
+
+/******************************************
+ *             Global Variables
+ *******************************************/
+static const char *backend_names[BACKEND_COUNT] = {"log", "print_safe", "stdio"};
+
+static unsigned int messages_per_producer = 20000;
+static unsigned int stall_us;
+static unsigned int stall_every = 1;
+static atomic_uint  stall_writes;
+
+static enum bench_backend backend;
+static pthread_barrier_t start_barrier;
+static atomic_int producers_done;
+
+static uint32_t    *task_late_us;
+static unsigned int task_samples;
+
+/******************************************
+ * now_nsec()
+ *******************************************/
+static int64_t now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/******************************************
+ * storage_stall()
+ * Slow storage: every 'stall_every'-th write waits 'stall_us'.
+ *******************************************/
+static void storage_stall(void)
+{
+	struct timespec ts;
+
+	if(stall_us == 0 || atomic_fetch_add(&stall_writes, 1) % stall_every)
+		return;
+	ts.tv_sec  = stall_us / 1000000;
+	ts.tv_nsec = (stall_us % 1000000) * 1000L;
+	nanosleep(&ts, NULL);
+}
+
+/******************************************
+ * __wrap_pwrite()
+ * Linked in place of pwrite() for the logger (-Wl,--wrap=pwrite).
+ *******************************************/
+ssize_t __real_pwrite(int fd, const void *buf, size_t count, off_t offset);
+ssize_t __wrap_pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+	storage_stall();
+	return __real_pwrite(fd, buf, count, offset);
+}
+
+/******************************************
+ * stdio_print()
+ * The print_safe() of the app before the binary log, as the baseline.
+ *******************************************/
+static void stdio_print(unsigned int task_id, pthread_mutex_t* mutex, char* msg, int argn, ...)
+{
+	time_t timestamp_sec;
+	struct tm timestamp;
+	va_list args;
+	FILE* fp;
+
+	pthread_mutex_lock(mutex);
+	fp = fopen(STDIO_LOG_FILE, "a+");
+	if(fp == NULL) {
+		printf("ERROR: task #%d: could not open log file\n", task_id);
+		exit(1);
+	}
+	timestamp_sec = time(NULL);
+	localtime_r(&timestamp_sec, &timestamp);
+
+	va_start(args, argn);
+	fprintf(fp, "%lu,-,%d:%d:%d:%d:%d:%d:, ", (unsigned long)timestamp_sec,
+			timestamp.tm_year + 1900, timestamp.tm_mon + 1, timestamp.tm_mday,
+			timestamp.tm_hour, timestamp.tm_min, timestamp.tm_sec);
+	vfprintf(fp, msg, args);
+	va_end(args);
+
+	fclose(fp);
+	storage_stall();
+	pthread_mutex_unlock(mutex);
+}
+
+/******************************************
+ * log_message()
+ * Logs message 'i' of a producer through the backend under test.
+ *******************************************/
+static void log_message(unsigned int task_id, unsigned int i)
+{
+	switch(backend) {
+	case BACKEND_LOG:
+		if(i & 1)
+			LOG_INFO(task_id, "task #,%d, woke up\n", task_id);
+		else
+			LOG_INFO(task_id, "task #,%d, going to sleep for ,%d, sec (,%d, min)\n", task_id, i, i/60);
+		break;
+	case BACKEND_PRINT_SAFE:
+		if(i & 1)
+			print_safe(task_id, &logfile_mutex, "task #,%d, woke up\n", 1, task_id);
+		else
+			print_safe(task_id, &logfile_mutex, "task #,%d, going to sleep for ,%d, sec (,%d, min)\n", 3, task_id, i, i/60);
+		break;
+	default:
+		if(i & 1)
+			stdio_print(task_id, &logfile_mutex, "task #,%d, woke up\n", 1, task_id);
+		else
+			stdio_print(task_id, &logfile_mutex, "task #,%d, going to sleep for ,%d, sec (,%d, min)\n", 3, task_id, i, i/60);
+		break;
+	}
+}
+
+/******************************************
+ * producer()
+ *******************************************/
+static void *producer(void *arg)
+{
+	struct producer_arg *p = arg;
+	unsigned int i;
+	int64_t t0, t1;
+
+	pthread_barrier_wait(&start_barrier);
+	for(i=0; i<messages_per_producer; i++) {
+		t0 = now_nsec();
+		log_message(p->task_id, i);
+		t1 = now_nsec();
+		p->latency_ns[i] = (uint32_t)(t1 - t0 < UINT32_MAX ? t1 - t0 : UINT32_MAX);
+	}
+	return NULL;
+}
+
+/******************************************
+ * task()
+ * A periodic task thread: sleeps to an absolute deadline and logs; records how long
+ * after the deadline it was done.
+ *******************************************/
+static void *task(void *arg)
+{
+	struct timespec deadline;
+	int64_t due, late;
+	unsigned int i = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	pthread_barrier_wait(&start_barrier);
+	while(!atomic_load(&producers_done) && task_samples < TASK_SAMPLES_MAX) {
+		deadline.tv_nsec += TASK_PERIOD_US * 1000L;
+		if(deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+		log_message(MAX_PRODUCERS + 1, i++);
+		due  = (int64_t)deadline.tv_sec * 1000000000 + deadline.tv_nsec;
+		late = (now_nsec() - due) / 1000;
+		task_late_us[task_samples++] = (uint32_t)(late > 0 ? late : 0);
+
+		// fell behind by more than a period: skip the missed wake-ups like the app does
+		if(late > TASK_PERIOD_US)
+			clock_gettime(CLOCK_MONOTONIC, &deadline);
+	}
+	return arg;
+}
+
+/******************************************
+ * cmp_u32()
+ *******************************************/
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+
+	return (x > y) - (x < y);
+}
+
+/******************************************
+ * percentile()
+ * params: - uint32_t* v: values, sorted
+ * 		   - size_t n: number of values
+ * 		   - double p: percentile, 0..100
+ *******************************************/
+static uint32_t percentile(const uint32_t *v, size_t n, double p)
+{
+	size_t i;
+
+	if(n == 0)
+		return 0;
+	i = (size_t)(n * p / 100.0);
+	return v[i < n ? i : n - 1];
+}
+
+/******************************************
+ * file_size()
+ *******************************************/
+static unsigned long file_size(const char *path)
+{
+	struct stat st;
+
+	return stat(path, &st) ? 0 : (unsigned long)st.st_size;
+}
+
+/******************************************
+ * bench_backend()
+ * Runs every producer count through the current backend and prints its lines.
+ *******************************************/
+static void bench_backend(uint32_t *latency_ns)
+{
+	pthread_t threads[MAX_PRODUCERS], task_thread;
+	struct producer_arg args[MAX_PRODUCERS];
+	struct logger_stats before, after;
+	unsigned long messages, dropped, bytes;
+	unsigned int producers, i;
+	size_t total;
+	int64_t t0, t1;
+
+	for(producers=1; producers<=MAX_PRODUCERS; producers*=2) {
+		logger_get_stats(&before);
+		if(backend == BACKEND_STDIO)
+			unlink(STDIO_LOG_FILE);
+		atomic_store(&producers_done, 0);
+		task_samples = 0;
+
+		pthread_barrier_init(&start_barrier, NULL, producers + 2);
+		for(i=0; i<producers; i++) {
+			args[i].task_id    = i + 1;
+			args[i].latency_ns = latency_ns + (size_t)i * messages_per_producer;
+			pthread_create(&threads[i], NULL, &producer, &args[i]);
+		}
+		pthread_create(&task_thread, NULL, &task, NULL);
+
+		pthread_barrier_wait(&start_barrier);
+		t0 = now_nsec();
+		for(i=0; i<producers; i++)
+			pthread_join(threads[i], NULL);
+		atomic_store(&producers_done, 1);
+		pthread_join(task_thread, NULL);
+		// wait for the writer to catch up with everything accepted
+		do {
+			logger_get_stats(&after);
+		} while(after.written < after.enqueued && !usleep(100));
+		t1 = now_nsec();
+		pthread_barrier_destroy(&start_barrier);
+
+		if(backend == BACKEND_STDIO) {
+			messages = (unsigned long)producers * messages_per_producer + task_samples;
+			dropped  = 0;
+			bytes    = file_size(STDIO_LOG_FILE);
+		} else {
+			messages = after.enqueued - before.enqueued;
+			dropped  = after.dropped - before.dropped;
+			bytes    = after.bytes - before.bytes;
+		}
+
+		total = (size_t)producers * messages_per_producer;
+		qsort(latency_ns, total, sizeof(latency_ns[0]), cmp_u32);
+		qsort(task_late_us, task_samples, sizeof(task_late_us[0]), cmp_u32);
+		printf("%s,%u,%u,%lu,%.3f,%.0f,%lu,%lu,%u,%u,%u,%u,%u,%u\n", backend_names[backend],
+			   producers, stall_us, messages, (t1 - t0) / 1e9, messages / ((t1 - t0) / 1e9), dropped, bytes,
+			   percentile(latency_ns, total, 50), percentile(latency_ns, total, 99),
+			   percentile(latency_ns, total, 99.9), percentile(latency_ns, total, 100),
+			   percentile(task_late_us, task_samples, 99), percentile(task_late_us, task_samples, 100));
+		fflush(stdout);
+	}
+	if(backend == BACKEND_STDIO)
+		unlink(STDIO_LOG_FILE);
+}
+
+/******************************************
+ * main()
+ *******************************************/
+int main(int argc, char **argv)
+{
+	const char *path = "bench_log_file.bin";
+	int selected[BACKEND_COUNT] = {0};
+	uint32_t *latency_ns;
+	int opt, any = 0, b;
+
+	while((opt = getopt(argc, argv, "n:s:e:f:")) != -1) {
+		switch(opt) {
+		case 'n':
+			messages_per_producer = (unsigned int)atoi(optarg);
+			break;
+		case 's':
+			stall_us = (unsigned int)atoi(optarg);
+			break;
+		case 'e':
+			stall_every = (unsigned int)atoi(optarg);
+			break;
+		case 'f':
+			path = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n messages_per_producer] [-s stall_us] [-e every] [-f log_file] [log|print_safe|stdio ...]\n", argv[0]);
+			return 1;
+		}
+	}
+	for(; optind < argc; optind++) {
+		for(b=0; b<BACKEND_COUNT && strcmp(argv[optind], backend_names[b]); b++)
+			;
+		if(b == BACKEND_COUNT) {
+			fprintf(stderr, "unknown backend %s\n", argv[optind]);
+			return 1;
+		}
+		selected[b] = any = 1;
+	}
+	if(messages_per_producer == 0)
+		messages_per_producer = 1;
+	if(stall_every == 0)
+		stall_every = 1;
+
+	latency_ns   = malloc((size_t)MAX_PRODUCERS * messages_per_producer * sizeof(*latency_ns));
+	task_late_us = malloc((size_t)TASK_SAMPLES_MAX * sizeof(*task_late_us));
+	if(latency_ns == NULL || task_late_us == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	if(logger_start(path, LOG_SEGMENT_COUNT, LOG_SEGMENT_BYTES)) {
+		fprintf(stderr, "could not open %s\n", path);
+		return 1;
+	}
+
+	printf("backend,producers,stall_us,messages,seconds,msgs_per_sec,dropped,bytes,"
+		   "call_p50_ns,call_p99_ns,call_p999_ns,call_max_ns,task_late_p99_us,task_late_max_us\n");
+	for(b=0; b<BACKEND_COUNT; b++) {
+		if(any && !selected[b])
+			continue;
+		backend = b;
+		bench_backend(latency_ns);
+	}
+
+	logger_stop();
+	free(latency_ns);
+	free(task_late_us);
+	return 0;
+}
@@ -0,0 +1,286 @@
+/******************************************
+ * bench_scheduler
+ * Scheduler cost for growing task counts, from PERIODIC_TASKS_NO up to max_tasks.
+ *
+ * usage: bench_scheduler [max_tasks]   (default 100000, at least PERIODIC_TASKS_NO)
+ *
+ * The counts are PERIODIC_TASKS_NO, 100, 1000, ... below max_tasks, then max_tasks.
+ *
+ * The tasks get pseudo random windows, frequencies and durations (fixed seed, so
+ * every run uses the same schedule). For each task count:
+ *   next_action_ns    cost of one schedule_next_action() call
+ *   dispatch_per_sec  wake-ups handled per second by a single dispatcher on a virtual
+ *                     clock (earliest wake-up first, the valve is a stub that only
+ *                     counts), up to DISPATCH_EVENTS wake-ups or one simulated day
+ *   fires             runs started during that dispatch
+ *   task_bytes        memory per task: the task, its wake-up entry and its action
+ *   thread_stack      stack reserved per task by the thread-per-task model of the app
+ *   wake_*_us         how late a dispatcher sleeping on the real clock wakes up when the
+ *                     wake-ups of all tasks fall into a WAKE_WINDOW_MS window
+ * Output is one CSV line per task count:
+ *     tasks,next_action_ns,dispatch_per_sec,fires,task_bytes,thread_stack,wake_p50_us,wake_p99_us,wake_max_us
+ *******************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include "../jitter_hist.h"
+#include "../scheduler.h"
+
+/******************************************
+ *                Defines
+ *******************************************/
+#define NEXT_ACTION_CALLS 200000
+#define DISPATCH_EVENTS   2000000
+#define WAKE_WINDOW_MS    500
+
+/******************************************
+ *              Data Types
+ *******************************************/
+// dispatcher queue entry: a binary min-heap ordered by wake-up time
+struct wakeup {
+	int64_t      wake;   // seconds (virtual clock) or nanoseconds (real clock)
+	unsigned int task;
+};
+
+/******************************************
+ *             Global Variables
+ *******************************************/
+static uint32_t rand_state = 12345;
+static unsigned long valve_runs;
+static volatile unsigned long sink; // keeps the results of the timed calls alive
+
+/******************************************
+ * next_rand()
+ *******************************************/
+static uint32_t next_rand(void)
+{
+	rand_state = rand_state * 1103515245u + 12345u;
+	return rand_state >> 8;
+}
+
+/******************************************
+ * now_nsec()
+ *******************************************/
+static int64_t now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/******************************************
+ * heap_push()
+ *******************************************/
+static void heap_push(struct wakeup *heap, unsigned int *n, struct wakeup w)
+{
+	unsigned int i = (*n)++;
+
+	while(i > 0 && heap[(i - 1) / 2].wake > w.wake) {
+		heap[i] = heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	heap[i] = w;
+}
+
+/******************************************
+ * heap_pop()
+ *******************************************/
+static struct wakeup heap_pop(struct wakeup *heap, unsigned int *n)
+{
+	struct wakeup top = heap[0];
+	struct wakeup last = heap[--(*n)];
+	unsigned int i = 0, c;
+
+	while((c = 2 * i + 1) < *n) {
+		if(c + 1 < *n && heap[c + 1].wake < heap[c].wake)
+			c++;
+		if(last.wake <= heap[c].wake)
+			break;
+		heap[i] = heap[c];
+		i = c;
+	}
+	heap[i] = last;
+	return top;
+}
+
+/******************************************
+ * make_tasks()
+ *******************************************/
+static void make_tasks(struct periodic_task *tasks, unsigned int count)
+{
+	static const unsigned int freqs[] = {1, 5, 15, 30, 60, 120, 240};
+	unsigned int i;
+
+	rand_state = 12345;
+	for(i=0; i<count; i++) {
+		tasks[i].id         = i + 1;
+		tasks[i].start_hour = next_rand() % 24;
+		tasks[i].start_min  = next_rand() % 60;
+		tasks[i].end_hour   = next_rand() % 24;
+		tasks[i].end_min    = next_rand() % 60;
+		tasks[i].freq       = freqs[next_rand() % (sizeof(freqs)/sizeof(freqs[0]))];
+		tasks[i].duration   = 1 + next_rand() % 60;
+	}
+}
+
+/******************************************
+ * valve_stub()
+ * Stands in for execute_task(): no HAL, no sleeping.
+ *******************************************/
+static void valve_stub(const struct periodic_task *task)
+{
+	valve_runs += task->duration != 0;
+}
+
+/******************************************
+ * bench_next_action()
+ * return: nanoseconds per schedule_next_action() call
+ *******************************************/
+static double bench_next_action(const struct periodic_task *tasks, unsigned int count, time_t day_start)
+{
+	struct schedule_action action;
+	unsigned long fired = 0;
+	unsigned int i;
+	int64_t t0, t1;
+
+	t0 = now_nsec();
+	for(i=0; i<NEXT_ACTION_CALLS; i++) {
+		schedule_next_action(&tasks[i % count], day_start + next_rand() % 86400, &action);
+		fired += action.fire;
+	}
+	t1 = now_nsec();
+	sink = fired;
+	return (double)(t1 - t0) / NEXT_ACTION_CALLS;
+}
+
+/******************************************
+ * bench_dispatch()
+ * Runs the schedule on a virtual clock, earliest wake-up first.
+ * return: wake-ups handled per second of wall time
+ *******************************************/
+static double bench_dispatch(const struct periodic_task *tasks, unsigned int count, time_t day_start,
+							 struct wakeup *heap, unsigned long *fires)
+{
+	struct schedule_action action;
+	struct wakeup w;
+	unsigned long events = 0;
+	unsigned int n = 0, i;
+	int64_t t0, t1;
+
+	for(i=0; i<count; i++)
+		heap_push(heap, &n, (struct wakeup){ day_start, i });
+
+	valve_runs = 0;
+	t0 = now_nsec();
+	while(events < DISPATCH_EVENTS) {
+		w = heap_pop(heap, &n);
+		if(w.wake >= day_start + 86400)
+			break;
+		schedule_next_action(&tasks[w.task], (time_t)w.wake, &action);
+		if(action.fire)
+			valve_stub(&tasks[w.task]);
+		w.wake = action.wake_sec;
+		heap_push(heap, &n, w);
+		events++;
+	}
+	t1 = now_nsec();
+	*fires = valve_runs;
+	return events / ((t1 - t0) / 1e9);
+}
+
+/******************************************
+ * bench_wake_latency()
+ * Sleeps until each of 'count' wake-ups spread over WAKE_WINDOW_MS and records how
+ * late it woke up (shared with the app's jitter histograms, task id 0).
+ *******************************************/
+static void bench_wake_latency(unsigned int count, struct wakeup *heap, struct jitter_snapshot *snap)
+{
+	struct timespec ts;
+	struct wakeup w;
+	unsigned int n = 0, i;
+	int64_t start, late_ns;
+
+	jitter_snapshot(0, snap); // clears the histogram
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	start = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec + 10000000;
+	for(i=0; i<count; i++)
+		heap_push(heap, &n, (struct wakeup){ start + (int64_t)(next_rand() % (WAKE_WINDOW_MS * 1000)) * 1000, i });
+
+	while(n) {
+		w = heap_pop(heap, &n);
+		ts.tv_sec  = w.wake / 1000000000;
+		ts.tv_nsec = w.wake % 1000000000;
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+			;
+		late_ns = now_nsec() - w.wake;
+		jitter_record(0, late_ns / 1000);
+	}
+	jitter_snapshot(0, snap);
+}
+
+/******************************************
+ * main()
+ *******************************************/
+int main(int argc, char **argv)
+{
+	static const unsigned int counts[] = {PERIODIC_TASKS_NO, 100, 1000, 10000, 100000, 1000000};
+	struct periodic_task *tasks;
+	struct jitter_snapshot snap;
+	struct wakeup *heap;
+	pthread_attr_t attr;
+	size_t stack;
+	unsigned long fires;
+	unsigned int max_tasks = 100000;
+	unsigned int c, count;
+	time_t day_start;
+	struct tm tm;
+	double next_ns, dispatch;
+
+	if(argc > 1)
+		max_tasks = (unsigned int)atoi(argv[1]);
+	if(argc > 2 || max_tasks < PERIODIC_TASKS_NO) {
+		fprintf(stderr, "usage: %s [max_tasks]   (at least %u)\n", argv[0], PERIODIC_TASKS_NO);
+		return 1;
+	}
+
+	tasks = malloc(max_tasks * sizeof(*tasks));
+	heap  = malloc(max_tasks * sizeof(*heap));
+	if(tasks == NULL || heap == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	// simulate from the last local midnight
+	day_start = time(NULL);
+	localtime_r(&day_start, &tm);
+	tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+	day_start = mktime(&tm);
+
+	pthread_attr_init(&attr);
+	pthread_attr_getstacksize(&attr, &stack);
+	pthread_attr_destroy(&attr);
+
+	printf("tasks,next_action_ns,dispatch_per_sec,fires,task_bytes,thread_stack,wake_p50_us,wake_p99_us,wake_max_us\n");
+	for(c=0; ; c++) {
+		// the steps below max_tasks, then max_tasks itself
+		count = c < sizeof(counts)/sizeof(counts[0]) && counts[c] < max_tasks ? counts[c] : max_tasks;
+		make_tasks(tasks, count);
+		next_ns  = bench_next_action(tasks, count, day_start);
+		dispatch = bench_dispatch(tasks, count, day_start, heap, &fires);
+		bench_wake_latency(count, heap, &snap);
+		printf("%u,%.1f,%.0f,%lu,%zu,%zu,%u,%u,%u\n", count, next_ns, dispatch, fires,
+			   sizeof(struct periodic_task) + sizeof(struct wakeup) + sizeof(struct schedule_action),
+			   stack, snap.p50_us, snap.p99_us, snap.max_us);
+		fflush(stdout);
+		if(count == max_tasks)
+			break;
+	}
+
+	free(tasks);
+	free(heap);
+	return 0;
+}
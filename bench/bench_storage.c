@@ -0,0 +1,159 @@
+/******************************************
+ * bench_storage
+ * Compares the schedule load and history write cost of the storage backends.
+ *
+ * usage: bench_storage [backend ...]   (default: every backend built in)
+ *
+ * Run it from a directory holding the backends' files (irrigation_table.csv,
+ * vertical_garden.db) or with the MySQL server reachable. The files are copied to a
+ * scratch directory the benchmark runs in and removes at the end, so the flat-file and
+ * SQLite history writes never reach the real ones. The MySQL server has no such copy:
+ * its history rows carry task_id BENCH_TASK_ID (no task of the app has it) and are
+ * deleted again when the backend is done.
+ * Output is one CSV line per (backend, operation):
+ *     backend,operation,batch,iterations,usec_per_op
+ *******************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../storage_backend.h"
+
+/******************************************
+ *                Defines
+ *******************************************/
+#define LOAD_ITERATIONS  200
+#define WRITE_ITERATIONS 50
+#define BENCH_TASK_ID    0  // task ids of the app start at 1 (task_gpios[id - 1])
+
+/******************************************
+ * now_usec()
+ *******************************************/
+static double now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/******************************************
+ * bench_backend()
+ *******************************************/
+static void bench_backend(const struct storage_backend *backend)
+{
+	static const unsigned int batches[] = {1, 16, 256};
+	struct run_history_event events[256];
+	struct periodic_task tasks[PERIODIC_TASKS_NO];
+	unsigned int count;
+	unsigned int b, i;
+	double t0;
+
+	// first call includes opening the connection; keep it out of the figures
+	if(storage_load_schedule(backend, tasks, PERIODIC_TASKS_NO, &count)) {
+		fprintf(stderr, "%s: schedule load failed, skipped\n", backend->name);
+		return;
+	}
+
+	t0 = now_usec();
+	for(i=0; i<LOAD_ITERATIONS; i++)
+		storage_load_schedule(backend, tasks, PERIODIC_TASKS_NO, &count);
+	printf("%s,load_schedule,%u,%d,%.1f\n", backend->name, count, LOAD_ITERATIONS,
+		   (now_usec() - t0) / LOAD_ITERATIONS);
+
+	memset(events, 0, sizeof(events));
+	for(i=0; i<sizeof(events)/sizeof(events[0]); i++) {
+		events[i].task_id     = BENCH_TASK_ID;
+		events[i].planned_sec = time(NULL);
+		events[i].start_sec   = events[i].planned_sec;
+		events[i].open_sec    = 60;
+	}
+
+	for(b=0; b<sizeof(batches)/sizeof(batches[0]); b++) {
+		t0 = now_usec();
+		for(i=0; i<WRITE_ITERATIONS; i++) {
+			if(storage_write_history(backend, events, batches[b])) {
+				fprintf(stderr, "%s: history write failed\n", backend->name);
+				break;
+			}
+		}
+		printf("%s,write_history,%u,%d,%.1f\n", backend->name, batches[b], WRITE_ITERATIONS,
+			   (now_usec() - t0) / WRITE_ITERATIONS);
+	}
+	// the scratch copies go away with the directory; a server keeps what it got
+	if(backend->delete_history && storage_delete_history(backend, BENCH_TASK_ID))
+		fprintf(stderr, "%s: could not delete the benchmark's history rows (task_id %u)\n",
+				backend->name, BENCH_TASK_ID);
+	storage_close(backend);
+}
+
+/******************************************
+ * copy_file()
+ * Copies 'name' from the directory 'from' to the current one, if it exists there.
+ *******************************************/
+static void copy_file(const char *from, const char *name)
+{
+	char path[4096], buf[65536];
+	ssize_t n;
+	int in, out;
+
+	snprintf(path, sizeof(path), "%s/%s", from, name);
+	in = open(path, O_RDONLY);
+	if(in < 0)
+		return;
+	out = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(out >= 0) {
+		while((n = read(in, buf, sizeof(buf))) > 0)
+			if(write(out, buf, n) != n)
+				break;
+		close(out);
+	}
+	close(in);
+}
+
+/******************************************
+ * main()
+ *******************************************/
+int main(int argc, char **argv)
+{
+	static const char *all[] = {"mysql", "sqlite", "flatfile"};
+	static const char *files[] = {STORAGE_SQLITE_FILE, STORAGE_FLATFILE_SCHEDULE, STORAGE_FLATFILE_HISTORY};
+	const struct storage_backend *backend;
+	const char **names = all;
+	char scratch[] = "/tmp/bench_storage.XXXXXX";
+	char cwd[4096];
+	int n = sizeof(all)/sizeof(all[0]);
+	unsigned int f;
+	int i;
+
+	if(argc > 1) {
+		names = (const char **)&argv[1];
+		n = argc - 1;
+	}
+
+	// work on copies of the backends' files
+	if(getcwd(cwd, sizeof(cwd)) == NULL || mkdtemp(scratch) == NULL || chdir(scratch)) {
+		perror("scratch directory");
+		return 1;
+	}
+	for(f=0; f<sizeof(files)/sizeof(files[0]); f++)
+		copy_file(cwd, files[f]);
+
+	printf("backend,operation,batch,iterations,usec_per_op\n");
+	for(i=0; i<n; i++) {
+		backend = storage_backend_find(names[i]);
+		if(backend == NULL) {
+			fprintf(stderr, "%s: not built in\n", names[i]);
+			continue;
+		}
+		bench_backend(backend);
+	}
+
+	for(f=0; f<sizeof(files)/sizeof(files[0]); f++)
+		unlink(files[f]);
+	if(chdir(cwd) == 0)
+		rmdir(scratch);
+	return 0;
+}
@@ -0,0 +1,756 @@
+/******************************************
+ * sim_greenhouse
+ * Load test of a greenhouse configuration before the hardware exists: thousands of
+ * zones, their valves behind a fake GPIO bank, a hydraulic model of the supply and a
+ * soil moisture sensor per zone, driven by the scheduler and the bcm2835 library.
+ *
+ * usage: sim_greenhouse [-z zones] [-d days] [-p pump_l_per_min] [-s seed] [-a]
+ *
+ * Zones: pseudo random windows (some crossing midnight), frequencies, durations, valve
+ * flows and soil capacities (fixed seed, so every run is the same greenhouse). Every zone
+ * is scheduled like a task thread of the app, with schedule_next_action(), by a single
+ * dispatcher on a virtual clock (thousands of threads are no option on the Pi; see
+ * bench_scheduler for that cost). A run opens and closes the zone's valve through
+ * bcm2835_gpio_fsel()/bcm2835_gpio_write().
+ * Only the scheduler and the bcm2835 library are the controller's: the dispatcher is a
+ * model of run_periodic_task()/execute_task(), whose locking, logging and run history are
+ * not exercised. The dispatch_delay figures are the model's, reported as model_dispatch_*.
+ *
+ * Fake GPIO bank: built with -DBCM2835_REGISTER_MODEL, the library's register accesses
+ * land in the model below. The valves are SIM_ZONES_PER_BANK to a bank, every bank is a
+ * copy of the GPIO register block; bcm2835_gpio is pointed at the zone's bank for the
+ * write, like a board of expanders. The set/clear registers of the banks are the only
+ * source of which valves are open.
+ *
+ * Hydraulics: one pump (pressure SIM_PUMP_BAR at zero flow, falling linearly to 0 at
+ * pump_l_per_min), a main line losing SIM_LINE_BAR at that flow (quadratic in the flow),
+ * and valves passing their rated flow at SIM_P_NOMINAL_BAR, proportional to the square
+ * root of the pressure. Below SIM_P_MIN_BAR the drippers do not work. By default the
+ * valves open as scheduled, whatever the pressure, as the app does; the low pressure
+ * figures show what that costs. -a is a what-if the controller does not have: a run
+ * only starts if the pressure stays above SIM_P_MIN_BAR with its valve open, otherwise
+ * it queues (first come, first served) up to the task's next interval (then it is missed).
+ *
+ * Sensors: each zone has an MCP3008-style ADC channel read with bcm2835_spi_transfernb()
+ * every SIM_SENSOR_SEC; the model answers with the zone's soil moisture, which falls with
+ * the daylight evaporation and rises with the water delivered.
+ *
+ * Output is one CSV line per figure:
+ *     metric,value,unit
+ *******************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "../bcm2835.h"
+#include "../scheduler.h"
+
+/******************************************
+ *                Defines
+ *******************************************/
+#define SIM_ZONES_PER_BANK 32
+#define SIM_BANK_WORDS     64      // a GPIO register block (0xb4 bytes), rounded up
+#define SIM_SENSOR_SEC     600
+#define SIM_RUNS_PER_DAY   (24 * 60 / 30 + 1) // most runs a zone can have in a day (freq >= 30)
+#define SIM_PUMP_BAR       4.0     // pump pressure at zero flow
+#define SIM_LINE_BAR       1.0     // main line pressure drop at the pump's maximum flow
+#define SIM_P_NOMINAL_BAR  1.5     // pressure the valve flows are rated at
+#define SIM_P_MIN_BAR      1.0     // drippers need at least this much
+#define SIM_DRY            0.30    // soil moisture (fraction of field capacity) below which a zone is dry
+#define SIM_WET            0.95    // and above which it is waterlogged
+#define SIM_ET_PER_DAY     0.35    // moisture lost over a sunny day
+#define SIM_DAYLIGHT_HOURS (24.0 / M_PI) // integral of the daylight curve over a day
+
+// event types, in the order they are handled within the same second
+#define EV_CLOSE    0
+#define EV_DEADLINE 1
+#define EV_WAKE     2
+#define EV_SENSOR   3
+
+// zone states
+#define ZONE_IDLE    0
+#define ZONE_WAITING 1 // due, waiting for pressure
+#define ZONE_OPEN    2
+
+/******************************************
+ *              Data Types
+ *******************************************/
+struct zone {
+	struct periodic_task task;
+	double       flow_lpm;     // rated flow of the valve
+	double       capacity_l;   // water from dry soil to field capacity
+	double       moisture;
+	int64_t      moisture_sec; // time 'moisture' is up to date for
+	double       open_g;       // hyd_g when the valve opened
+	int64_t      planned_sec;  // run waiting or in progress
+	int64_t      wake_sec;     // next wake-up after that run
+	int64_t      deadline_sec; // a waiting run is missed at this time
+	unsigned int wait_pos;     // its entry in 'waiting'
+	unsigned int state;
+};
+
+// dispatcher queue entry: a binary min-heap ordered by (time << 2 | event type)
+struct event {
+	int64_t      key;
+	unsigned int zone;
+};
+
+/******************************************
+ *             Global Variables
+ *******************************************/
+static struct zone *zones;
+static unsigned int zone_count = 2000;
+static unsigned int bank_count;
+static struct event *heap;
+static unsigned int heap_n;
+static unsigned int *waiting;       // zones waiting for pressure, oldest first; entries of
+static unsigned int waiting_head;   // missed runs are left in place and skipped
+static unsigned int waiting_tail;
+static uint32_t rand_state;
+static int admission; // -a: pressure admission (not in the app)
+
+static int64_t sim_now;
+static volatile uint32_t *gpio_base;
+
+// fake GPIO bank and sensor ADC
+static uint32_t *bank_regs;
+static uint32_t *bank_levels;
+static uint32_t sensor_value;
+static unsigned int spi_rx_index;
+
+// hydraulics: every valve sees the same pressure, so the state is the sum of the rated flows
+static double  pump_lpm = 1500;
+static double  line_k;
+static double  hyd_rated;           // sum of the rated flows of the open valves
+static double  hyd_p = SIM_PUMP_BAR;
+static double  hyd_q;
+static double  hyd_g;               // integral of sqrt(p / SIM_P_NOMINAL_BAR) dt, seconds
+static int64_t hyd_sec;
+static unsigned int hyd_open;
+
+// results
+static unsigned long wakeups, runs_due, runs_started, runs_deferred, runs_missed;
+static unsigned long gpio_writes, sensor_reads, dry_reads, wet_reads, events;
+static unsigned int  max_open;
+static double peak_flow, min_pressure = SIM_PUMP_BAR;
+static double low_pressure_valve_sec, water_l, water_rated_l;
+static int64_t sched_ns, actuate_ns, sensor_ns;
+static uint32_t *delays;
+static unsigned long delay_n;
+static unsigned long event_ns_hist[64];
+
+/******************************************
+ * now_nsec()
+ *******************************************/
+static int64_t now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/******************************************
+ * next_rand()
+ *******************************************/
+static uint32_t next_rand(void)
+{
+	rand_state = rand_state * 1103515245u + 12345u;
+	return rand_state >> 8;
+}
+
+/******************************************
+ * heap_push()
+ *******************************************/
+static void heap_push(int64_t sec, unsigned int type, unsigned int zone)
+{
+	struct event e = { sec << 2 | type, zone };
+	unsigned int i = heap_n++;
+
+	while(i > 0 && heap[(i - 1) / 2].key > e.key) {
+		heap[i] = heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	heap[i] = e;
+}
+
+/******************************************
+ * heap_pop()
+ *******************************************/
+static struct event heap_pop(void)
+{
+	struct event top = heap[0];
+	struct event last = heap[--heap_n];
+	unsigned int i = 0, c;
+
+	while((c = 2 * i + 1) < heap_n) {
+		if(c + 1 < heap_n && heap[c + 1].key < heap[c].key)
+			c++;
+		if(last.key <= heap[c].key)
+			break;
+		heap[i] = heap[c];
+		i = c;
+	}
+	heap[i] = last;
+	return top;
+}
+
+/******************************************
+ * hyd_solve()
+ * Operating point of the pump with valves of 'rated' l/min in total open.
+ * params: - double* p: pressure at the valves, bar
+ * 		   - double* q: total flow, l/min
+ *******************************************/
+static void hyd_solve(double rated, double *p, double *q)
+{
+	double lo = 0, hi = pump_lpm, mid, pv;
+	int i;
+
+	if(rated <= 0) {
+		*p = SIM_PUMP_BAR;
+		*q = 0;
+		return;
+	}
+	// the valves take rated * sqrt(pv / nominal); find the flow where that meets the supply
+	for(i=0; i<50; i++) {
+		mid = (lo + hi) / 2;
+		pv  = SIM_PUMP_BAR * (1 - mid / pump_lpm) - line_k * mid * mid;
+		if(mid < rated * sqrt((pv > 0 ? pv : 0) / SIM_P_NOMINAL_BAR))
+			lo = mid;
+		else
+			hi = mid;
+	}
+	*q = lo;
+	pv = SIM_PUMP_BAR * (1 - lo / pump_lpm) - line_k * lo * lo;
+	*p = pv > 0 ? pv : 0;
+}
+
+/******************************************
+ * hyd_advance()
+ * Integrates the flow and the pressure violations up to sim_now.
+ *******************************************/
+static void hyd_advance(void)
+{
+	double dt = (double)(sim_now - hyd_sec);
+
+	hyd_g += sqrt(hyd_p / SIM_P_NOMINAL_BAR) * dt;
+	if(hyd_open && hyd_p < SIM_P_MIN_BAR)
+		low_pressure_valve_sec += hyd_open * dt;
+	hyd_sec = sim_now;
+}
+
+/******************************************
+ * valve_changed()
+ * Called by the register model when a valve output of the bank changes.
+ *******************************************/
+static void valve_changed(unsigned int z, int open)
+{
+	struct zone *zone = &zones[z];
+	double litres;
+
+	if(z >= zone_count)
+		return;
+	hyd_advance();
+	if(open) {
+		zone->open_g = hyd_g;
+		hyd_rated += zone->flow_lpm;
+		hyd_open++;
+	} else {
+		litres = zone->flow_lpm * (hyd_g - zone->open_g) / 60;
+		water_l += litres;
+		zone->moisture += litres / zone->capacity_l;
+		hyd_rated -= zone->flow_lpm;
+		hyd_open--;
+		if(hyd_open == 0)
+			hyd_rated = 0; // no drift from the float sums
+	}
+	hyd_solve(hyd_rated, &hyd_p, &hyd_q);
+	if(hyd_open > max_open)
+		max_open = hyd_open;
+	if(hyd_q > peak_flow)
+		peak_flow = hyd_q;
+	if(hyd_open && hyd_p < min_pressure)
+		min_pressure = hyd_p;
+}
+
+/******************************************
+ * bcm2835_model_read()
+ *******************************************/
+uint32_t bcm2835_model_read(volatile uint32_t *paddr)
+{
+	uintptr_t a = (uintptr_t)paddr;
+	uint32_t word, off;
+
+	if(a >= (uintptr_t)bank_regs && a < (uintptr_t)(bank_regs + bank_count * SIM_BANK_WORDS)) {
+		word = (uint32_t)(paddr - bank_regs);
+		if(word % SIM_BANK_WORDS == BCM2835_GPLEV0/4)
+			return bank_levels[word / SIM_BANK_WORDS];
+		return *paddr;
+	}
+
+	off = (uint32_t)(a - (uintptr_t)bcm2835_peripherals);
+	if(off == BCM2835_SPI0_BASE + BCM2835_SPI0_CS)
+		return *paddr | BCM2835_SPI0_CS_TXD | BCM2835_SPI0_CS_RXD | BCM2835_SPI0_CS_DONE;
+	if(off == BCM2835_SPI0_BASE + BCM2835_SPI0_FIFO) {
+		// MCP3008 answer: null bit, then the 10 bit sample in the low bits of bytes 1 and 2
+		switch(spi_rx_index++) {
+		case 1:  return (sensor_value >> 8) & 3;
+		case 2:  return sensor_value & 0xff;
+		default: return 0;
+		}
+	}
+	return *paddr;
+}
+
+/******************************************
+ * bcm2835_model_write()
+ *******************************************/
+void bcm2835_model_write(volatile uint32_t *paddr, uint32_t value)
+{
+	uintptr_t a = (uintptr_t)paddr;
+	uint32_t word, bank, changed, bit;
+	int open;
+
+	if(a >= (uintptr_t)bank_regs && a < (uintptr_t)(bank_regs + bank_count * SIM_BANK_WORDS)) {
+		word = (uint32_t)(paddr - bank_regs);
+		bank = word / SIM_BANK_WORDS;
+		open = word % SIM_BANK_WORDS == BCM2835_GPSET0/4;
+		if(open) {
+			changed = value & ~bank_levels[bank];
+			bank_levels[bank] |= value;
+		} else if(word % SIM_BANK_WORDS == BCM2835_GPCLR0/4) {
+			changed = value & bank_levels[bank];
+			bank_levels[bank] &= ~value;
+		} else {
+			*paddr = value;
+			return;
+		}
+		for(bit=0; bit<32; bit++)
+			if(changed & (1u << bit))
+				valve_changed(bank * SIM_ZONES_PER_BANK + bit, open);
+		return;
+	}
+
+	if((uint32_t)(a - (uintptr_t)bcm2835_peripherals) == BCM2835_SPI0_BASE + BCM2835_SPI0_CS &&
+	   (value & BCM2835_SPI0_CS_CLEAR))
+		spi_rx_index = 0;
+	*paddr = value;
+}
+
+/******************************************
+ * set_valve()
+ * The actuation of execute_task(), on the zone's bank.
+ *******************************************/
+static void set_valve(unsigned int z, int on)
+{
+	uint8_t pin = z % SIM_ZONES_PER_BANK;
+
+	bcm2835_gpio = bank_regs + (z / SIM_ZONES_PER_BANK) * SIM_BANK_WORDS;
+	if(on)
+		bcm2835_gpio_fsel(pin, BCM2835_GPIO_FSEL_OUTP);
+	bcm2835_gpio_write(pin, on ? HIGH : LOW);
+	bcm2835_gpio = gpio_base;
+	gpio_writes++;
+}
+
+/******************************************
+ * sun_factor()
+ * return: evaporation weight at 'sec', 0 at night, 1 at noon
+ *******************************************/
+static double sun_factor(int64_t sec)
+{
+	time_t t = (time_t)sec;
+	struct tm tm;
+	double h;
+
+	localtime_r(&t, &tm);
+	h = tm.tm_hour + tm.tm_min / 60.0;
+	return h > 6 && h < 18 ? sin(M_PI * (h - 6) / 12) : 0;
+}
+
+/******************************************
+ * dry_out()
+ * Takes the evaporation since the zone's last update off its moisture.
+ *******************************************/
+static void dry_out(struct zone *zone)
+{
+	double hours = (sim_now - zone->moisture_sec) / 3600.0;
+
+	if(hours <= 0)
+		return;
+	zone->moisture -= SIM_ET_PER_DAY * hours * sun_factor((sim_now + zone->moisture_sec) / 2) / SIM_DAYLIGHT_HOURS;
+	if(zone->moisture < 0)
+		zone->moisture = 0;
+	zone->moisture_sec = sim_now;
+}
+
+/******************************************
+ * admit()
+ * return: 1 if the zone's valve can open without the pressure dropping below SIM_P_MIN_BAR
+ *******************************************/
+static int admit(const struct zone *zone)
+{
+	double p, q;
+
+	if(!admission)
+		return 1;
+	hyd_solve(hyd_rated + zone->flow_lpm, &p, &q);
+	return p >= SIM_P_MIN_BAR;
+}
+
+/******************************************
+ * start_run()
+ *******************************************/
+static void start_run(unsigned int z)
+{
+	struct zone *zone = &zones[z];
+	int64_t t0 = now_nsec();
+
+	dry_out(zone);
+	set_valve(z, 1);
+	zone->state = ZONE_OPEN;
+	delays[delay_n++] = (uint32_t)(sim_now - zone->planned_sec);
+	runs_started++;
+	water_rated_l += zone->flow_lpm * zone->task.duration / 60;
+	heap_push(sim_now + zone->task.duration, EV_CLOSE, z);
+	actuate_ns += now_nsec() - t0;
+}
+
+/******************************************
+ * wait_live()
+ * return: 1 if queue entry 'i' is a run still waiting (not missed, not queued again later)
+ *******************************************/
+static int wait_live(unsigned int i)
+{
+	const struct zone *zone = &zones[waiting[i]];
+
+	return zone->state == ZONE_WAITING && zone->wait_pos == i;
+}
+
+/******************************************
+ * wait_trim()
+ * Drops the entries of missed runs from the head of the queue.
+ *******************************************/
+static void wait_trim(void)
+{
+	while(waiting_head < waiting_tail && !wait_live(waiting_head))
+		waiting_head++;
+}
+
+/******************************************
+ * wait_push()
+ * Queues a zone for pressure. When the array is full the entries of missed runs are
+ * dropped; at most zone_count entries are live, so that frees at least half of it.
+ *******************************************/
+static void wait_push(unsigned int z)
+{
+	unsigned int i, n = 0;
+
+	if(waiting_tail == 2 * zone_count) {
+		for(i=waiting_head; i<waiting_tail; i++) {
+			if(wait_live(i)) {
+				zones[waiting[i]].wait_pos = n;
+				waiting[n++] = waiting[i];
+			}
+		}
+		waiting_head = 0;
+		waiting_tail = n;
+	}
+	zones[z].wait_pos = waiting_tail;
+	waiting[waiting_tail++] = z;
+}
+
+/******************************************
+ * on_wake()
+ * A task thread waking up: what run_periodic_task() does with the schedule.
+ *******************************************/
+static void on_wake(unsigned int z)
+{
+	struct zone *zone = &zones[z];
+	struct schedule_action action;
+	int64_t t0 = now_nsec();
+
+	wakeups++;
+	schedule_next_action(&zone->task, (time_t)sim_now, &action);
+	sched_ns += now_nsec() - t0;
+
+	if(!action.fire) {
+		heap_push(action.wake_sec, EV_WAKE, z);
+		return;
+	}
+	runs_due++;
+	zone->planned_sec = action.planned_sec;
+	zone->wake_sec    = action.wake_sec;
+	if(waiting_head == waiting_tail && admit(zone)) {
+		start_run(z);
+		return;
+	}
+	// wait for pressure, at the latest until the next interval would start
+	runs_deferred++;
+	zone->state        = ZONE_WAITING;
+	zone->deadline_sec = action.planned_sec + (int64_t)zone->task.freq * 60;
+	wait_push(z);
+	heap_push(zone->deadline_sec, EV_DEADLINE, z);
+}
+
+/******************************************
+ * on_close()
+ * End of a run; the freed capacity goes to the zones waiting, oldest first.
+ *******************************************/
+static void on_close(unsigned int z)
+{
+	struct zone *zone = &zones[z];
+	int64_t t0 = now_nsec();
+	unsigned int next;
+
+	set_valve(z, 0);
+	zone->state = ZONE_IDLE;
+	// the thread sleeps from the end of the run to the wake-up it got before the run
+	heap_push(zone->wake_sec > sim_now ? zone->wake_sec : sim_now, EV_WAKE, z);
+	actuate_ns += now_nsec() - t0;
+
+	// strictly in order: a large valve at the head is not starved by smaller ones behind it
+	while(waiting_head < waiting_tail && admit(&zones[waiting[waiting_head]])) {
+		next = waiting[waiting_head++];
+		start_run(next);
+		wait_trim();
+	}
+}
+
+/******************************************
+ * on_deadline()
+ * A waiting run whose next interval starts now is missed.
+ *******************************************/
+static void on_deadline(unsigned int z)
+{
+	struct zone *zone = &zones[z];
+
+	if(zone->state != ZONE_WAITING || zone->deadline_sec != sim_now)
+		return;
+	zone->state = ZONE_IDLE; // its queue entry is skipped from now on
+	wait_trim();
+	runs_missed++;
+	heap_push(sim_now, EV_WAKE, z);
+}
+
+/******************************************
+ * on_sensor()
+ * Reads the zone's moisture sensor over SPI.
+ *******************************************/
+static void on_sensor(unsigned int z)
+{
+	struct zone *zone = &zones[z];
+	char tx[3] = { 0x01, (char)0x80, 0x00 }; // start bit, single ended channel 0
+	char rx[3];
+	unsigned int sample;
+	double m;
+	int64_t t0 = now_nsec();
+
+	dry_out(zone);
+	m = zone->moisture > 1 ? 1 : zone->moisture;
+	sensor_value = (uint32_t)(m * 1023);
+	bcm2835_spi_transfernb(tx, rx, sizeof(tx));
+	sample = ((rx[1] & 3) << 8) | (uint8_t)rx[2];
+	sensor_reads++;
+	if(sample < SIM_DRY * 1023)
+		dry_reads++;
+	else if(sample > SIM_WET * 1023)
+		wet_reads++;
+	heap_push(sim_now + SIM_SENSOR_SEC, EV_SENSOR, z);
+	sensor_ns += now_nsec() - t0;
+}
+
+/******************************************
+ * make_zones()
+ *******************************************/
+static void make_zones(int64_t start)
+{
+	static const unsigned int freqs[] = {30, 60, 90, 120, 180, 240};
+	struct zone *zone;
+	unsigned int i, len;
+
+	for(i=0; i<zone_count; i++) {
+		zone = &zones[i];
+		memset(zone, 0, sizeof(*zone));
+		zone->task.id = i + 1;
+		// most windows are daytime; one in five runs into the night, across midnight
+		if(next_rand() % 5)
+			zone->task.start_hour = 5 + next_rand() % 4;
+		else
+			zone->task.start_hour = 18 + next_rand() % 5;
+		zone->task.start_min = next_rand() % 60;
+		len = 120 + next_rand() % (12 * 60);
+		zone->task.end_hour  = (zone->task.start_hour + (zone->task.start_min + len) / 60) % 24;
+		zone->task.end_min   = (zone->task.start_min + len) % 60;
+		zone->task.freq      = freqs[next_rand() % (sizeof(freqs)/sizeof(freqs[0]))];
+		zone->task.duration  = 60 + next_rand() % 540;
+		zone->flow_lpm       = 4 + next_rand() % 17;
+		zone->capacity_l     = 30 + next_rand() % 61;
+		zone->moisture       = 0.6;
+		zone->moisture_sec   = start;
+
+		heap_push(start, EV_WAKE, i);
+		heap_push(start + i % SIM_SENSOR_SEC, EV_SENSOR, i);
+	}
+}
+
+/******************************************
+ * cmp_u32()
+ *******************************************/
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+
+	return (x > y) - (x < y);
+}
+
+/******************************************
+ * hist_percentile()
+ * return: upper bound of the log2 bucket holding percentile 'p' of event_ns_hist
+ *******************************************/
+static double hist_percentile(double p)
+{
+	unsigned long seen = 0;
+	unsigned int b;
+
+	for(b=0; b<64; b++) {
+		seen += event_ns_hist[b];
+		if(seen >= events * p / 100)
+			return (double)(1ull << b);
+	}
+	return 0;
+}
+
+/******************************************
+ * main()
+ *******************************************/
+int main(int argc, char **argv)
+{
+	struct timespec cpu;
+	struct event ev;
+	unsigned int days = 1, seed = 12345, b;
+	int64_t start, end, t0, ns;
+	double wall;
+	time_t now;
+	struct tm tm;
+	int opt;
+
+	while((opt = getopt(argc, argv, "z:d:p:s:a")) != -1) {
+		switch(opt) {
+		case 'z':
+			zone_count = (unsigned int)atoi(optarg);
+			break;
+		case 'd':
+			days = (unsigned int)atoi(optarg);
+			break;
+		case 'p':
+			pump_lpm = atof(optarg);
+			break;
+		case 's':
+			seed = (unsigned int)atoi(optarg);
+			break;
+		case 'a':
+			admission = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-z zones] [-d days] [-p pump_l_per_min] [-s seed] [-a]\n", argv[0]);
+			return 1;
+		}
+	}
+	if(zone_count == 0 || days == 0 || pump_lpm <= 0) {
+		fprintf(stderr, "zones, days and pump flow must be positive\n");
+		return 1;
+	}
+	line_k     = SIM_LINE_BAR / (pump_lpm * pump_lpm);
+	rand_state = seed;
+	bank_count = (zone_count + SIM_ZONES_PER_BANK - 1) / SIM_ZONES_PER_BANK;
+
+	zones       = calloc(zone_count, sizeof(*zones));
+	heap        = malloc(4 * (size_t)zone_count * sizeof(*heap)); // sensor, wake or close, stale deadlines
+	waiting     = malloc(2 * (size_t)zone_count * sizeof(*waiting));
+	bank_regs   = calloc((size_t)bank_count * SIM_BANK_WORDS, sizeof(*bank_regs));
+	bank_levels = calloc(bank_count, sizeof(*bank_levels));
+	delays      = malloc((size_t)zone_count * days * SIM_RUNS_PER_DAY * sizeof(*delays));
+	if(!zones || !heap || !waiting || !bank_regs || !bank_levels || !delays) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	if(!bcm2835_init())
+		return 1;
+	gpio_base = bcm2835_gpio;
+	bcm2835_spi_begin();
+
+	// simulate from the last local midnight
+	now = time(NULL);
+	localtime_r(&now, &tm);
+	tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+	tm.tm_isdst = -1;
+	start   = mktime(&tm);
+	end     = start + (int64_t)days * 86400;
+	sim_now = hyd_sec = start;
+	make_zones(start);
+
+	t0 = now_nsec();
+	while(heap_n && (heap[0].key >> 2) < end) {
+		ns = now_nsec();
+		ev = heap_pop();
+		sim_now = ev.key >> 2;
+		switch(ev.key & 3) {
+		case EV_CLOSE:    on_close(ev.zone);    break;
+		case EV_DEADLINE: on_deadline(ev.zone); break;
+		case EV_WAKE:     on_wake(ev.zone);     break;
+		default:          on_sensor(ev.zone);   break;
+		}
+		ns = now_nsec() - ns;
+		for(b=0; b<63 && (1ll << b) < ns; b++)
+			;
+		event_ns_hist[b]++;
+		events++;
+	}
+	sim_now = end;
+	hyd_advance();
+	wall = (now_nsec() - t0) / 1e9;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+	bcm2835_spi_end();
+	bcm2835_close();
+
+	qsort(delays, delay_n, sizeof(delays[0]), cmp_u32);
+	printf("metric,value,unit\n");
+	printf("zones,%u,count\n", zone_count);
+	printf("valve_banks,%u,count\n", bank_count);
+	printf("simulated,%u,days\n", days);
+	printf("pump_max_flow,%.0f,l_per_min\n", pump_lpm);
+	printf("admission,%s,mode\n", admission ? "pressure" : "none");
+	printf("wakeups,%lu,count\n", wakeups);
+	printf("scheduler_cpu,%.1f,ns_per_wakeup\n", wakeups ? (double)sched_ns / wakeups : 0);
+	printf("scheduler_cpu,%.6f,percent_of_a_core\n", sched_ns / (days * 86400e9) * 100);
+	printf("actuation_cpu,%.1f,ns_per_valve_write\n", gpio_writes ? (double)actuate_ns / gpio_writes : 0);
+	printf("sensor_cpu,%.1f,ns_per_read\n", sensor_reads ? (double)sensor_ns / sensor_reads : 0);
+	printf("events,%lu,count\n", events);
+	printf("event_handling,%.0f,events_per_sec\n", events / wall);
+	printf("event_handling_p50,%.0f,ns\n", hist_percentile(50));
+	printf("event_handling_p99,%.0f,ns\n", hist_percentile(99));
+	printf("event_handling_max,%.0f,ns\n", hist_percentile(100));
+	printf("process_cpu,%.3f,sec\n", cpu.tv_sec + cpu.tv_nsec / 1e9);
+	printf("runs_due,%lu,count\n", runs_due);
+	printf("runs_started,%lu,count\n", runs_started);
+	printf("runs_deferred,%lu,count\n", runs_deferred);
+	printf("runs_missed,%lu,count\n", runs_missed);
+	printf("model_dispatch_delay_p50,%u,sec\n", delay_n ? delays[delay_n / 2] : 0);
+	printf("model_dispatch_delay_p99,%u,sec\n", delay_n ? delays[(size_t)(delay_n * 0.99)] : 0);
+	printf("model_dispatch_delay_max,%u,sec\n", delay_n ? delays[delay_n - 1] : 0);
+	printf("valves_open_max,%u,count\n", max_open);
+	printf("flow_peak,%.1f,l_per_min\n", peak_flow);
+	printf("pressure_min,%.2f,bar\n", min_pressure);
+	printf("low_pressure,%.0f,valve_sec\n", low_pressure_valve_sec);
+	printf("water_delivered,%.0f,l\n", water_l);
+	printf("water_rated,%.0f,l\n", water_rated_l);
+	printf("sensor_reads,%lu,count\n", sensor_reads);
+	printf("sensor_dry,%lu,count\n", dry_reads);
+	printf("sensor_waterlogged,%lu,count\n", wet_reads);
+	return 0;
+}
@@ -0,0 +1,39 @@
+#include <pthread.h>
+#include "crc32.h"
+
+/******************************************
+ *             Global Variables
+ *******************************************/
+static uint32_t crc32_table[256];
+static pthread_once_t crc32_table_once = PTHREAD_ONCE_INIT;
+
+/******************************************
+ * crc32_init_table()
+ *******************************************/
+static void crc32_init_table(void)
+{
+	uint32_t c;
+	unsigned int i, k;
+
+	for(i=0; i<256; i++) {
+		c = i;
+		for(k=0; k<8; k++)
+			c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+		crc32_table[i] = c;
+	}
+}
+
+/******************************************
+ * crc32()
+ *******************************************/
+uint32_t crc32(uint32_t crc, const void *buf, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+
+	pthread_once(&crc32_table_once, crc32_init_table);
+
+	crc = ~crc;
+	while(len--)
+		crc = crc32_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
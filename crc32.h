@@ -0,0 +1,16 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/******************************************
+ * crc32()
+ * params: - uint32_t crc: running crc; pass 0 for the first block
+ * 		   - const void* buf: data to be checksummed
+ * 		   - size_t len: number of bytes in 'buf'
+ * return: updated crc (IEEE 802.3 polynomial, same as zlib's crc32())
+ *******************************************/
+uint32_t crc32(uint32_t crc, const void *buf, size_t len);
+
+#endif /* CRC32_H */
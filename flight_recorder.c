@@ -0,0 +1,270 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include "flight_recorder.h"
+
+/******************************************
+ *              Data Types
+ *******************************************/
+struct flight_entry {
+	_Atomic uint32_t seq;   // index of the event + 1, 0 while it is being written
+	uint16_t event;
+	uint16_t task_id;
+	int32_t  a;
+	int32_t  b;
+	int64_t  time_ms;       // CLOCK_REALTIME_COARSE
+};
+
+/******************************************
+ *            Global Variables
+ *******************************************/
+static struct flight_entry flight_ring[FLIGHT_RECORDER_EVENTS];
+static atomic_uint         flight_head;
+static atomic_flag         flight_dumped = ATOMIC_FLAG_INIT;
+
+// the handler must still run when a thread crashed by overflowing its stack; the
+// alternate signal stack is per thread, every thread registers its own
+static _Thread_local char flight_stack[FLIGHT_ALTSTACK_BYTES];
+
+// SIGTERM is not in here: it is an orderly stop, which ends in exit() and its dump
+static const int flight_signals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+
+static const char *const flight_names[FLIGHT_EVENTS] = {
+	[FLIGHT_START]         = "start",
+	[FLIGHT_WAKEUP]        = "wakeup",
+	[FLIGHT_MISSED]        = "missed",
+	[FLIGHT_VALVE_OPEN]    = "valve_open",
+	[FLIGHT_VALVE_CLOSE]   = "valve_close",
+	[FLIGHT_HAL_ERROR]     = "hal_error",
+	[FLIGHT_STORAGE_LOAD]  = "storage_load",
+	[FLIGHT_STORAGE_WRITE] = "storage_write",
+};
+
+/******************************************
+ * flight_record()
+ * params: - enum flight_event event: what happened
+ * 		   - unsigned int task_id: task concerned, 0 for none
+ * 		   - int32_t a, b: details, see enum flight_event
+ * NOTE: lock-free, one atomic add and a coarse clock read (no system call); the oldest
+ *       event is overwritten once FLIGHT_RECORDER_EVENTS are recorded
+ *******************************************/
+void flight_record(enum flight_event event, unsigned int task_id, int32_t a, int32_t b)
+{
+	struct flight_entry *e;
+	struct timespec now;
+	uint32_t seq;
+
+	clock_gettime(CLOCK_REALTIME_COARSE, &now);
+	seq = atomic_fetch_add_explicit(&flight_head, 1, memory_order_relaxed);
+	e = &flight_ring[seq & (FLIGHT_RECORDER_EVENTS - 1)];
+	atomic_store_explicit(&e->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	e->event   = (uint16_t)event;
+	e->task_id = (uint16_t)task_id;
+	e->a       = a;
+	e->b       = b;
+	e->time_ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+	atomic_store_explicit(&e->seq, seq + 1, memory_order_release);
+}
+
+/******************************************
+ * flight_put_dec()
+ * return: end of the decimal representation of 'v' written to 'p'
+ *******************************************/
+static char *flight_put_dec(char *p, int64_t v)
+{
+	char buf[20];
+	uint64_t u = v < 0 ? -(uint64_t)v : (uint64_t)v;
+	int n = 0;
+
+	if(v < 0)
+		*p++ = '-';
+	do
+		buf[n++] = '0' + u % 10;
+	while((u /= 10) != 0);
+	while(n)
+		*p++ = buf[--n];
+	return p;
+}
+
+/******************************************
+ * flight_put_str()
+ *******************************************/
+static char *flight_put_str(char *p, const char *s)
+{
+	while(*s)
+		*p++ = *s++;
+	return p;
+}
+
+/******************************************
+ * flight_write()
+ * write() all of 'len' bytes, giving up on an error
+ *******************************************/
+static void flight_write(int fd, const char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while(len) {
+		ret = write(fd, buf, len);
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret <= 0)
+			return;
+		buf += ret;
+		len -= ret;
+	}
+}
+
+/******************************************
+ * flight_recorder_dump()
+ * params: - int fd: file to write to
+ * 		   - int sig: signal that triggered the dump, 0 for a normal exit
+ * Writes the recorded events, oldest first, as "seq,time_ms,event,task_id,a,b" lines.
+ * NOTE: async-signal-safe; events being written while it runs are left out
+ *******************************************/
+void flight_recorder_dump(int fd, int sig)
+{
+	struct flight_entry *slot;
+	struct flight_entry e;
+	char line[128], *p;
+	uint32_t head, i, seq;
+
+	p = flight_put_str(line, "# flight recorder, signal ");
+	p = flight_put_dec(p, sig);
+	p = flight_put_str(p, "\nseq,time_ms,event,task_id,a,b\n");
+	flight_write(fd, line, p - line);
+
+	head = atomic_load_explicit(&flight_head, memory_order_acquire);
+	i = head > FLIGHT_RECORDER_EVENTS ? head - FLIGHT_RECORDER_EVENTS : 0;
+	for(; i != head; i++) {
+		slot = &flight_ring[i & (FLIGHT_RECORDER_EVENTS - 1)];
+		seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		if(seq != i + 1)
+			continue;
+		e.event   = slot->event;
+		e.task_id = slot->task_id;
+		e.a       = slot->a;
+		e.b       = slot->b;
+		e.time_ms = slot->time_ms;
+		atomic_thread_fence(memory_order_acquire);
+		if(atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq)
+			continue;
+
+		p = flight_put_dec(line, seq);
+		*p++ = ',';
+		p = flight_put_dec(p, e.time_ms);
+		*p++ = ',';
+		p = flight_put_str(p, e.event < FLIGHT_EVENTS ? flight_names[e.event] : "?");
+		*p++ = ',';
+		p = flight_put_dec(p, e.task_id);
+		*p++ = ',';
+		p = flight_put_dec(p, e.a);
+		*p++ = ',';
+		p = flight_put_dec(p, e.b);
+		*p++ = '\n';
+		flight_write(fd, line, p - line);
+	}
+}
+
+/******************************************
+ * flight_recorder_save()
+ * Dumps the ring, once per process: after a fatal signal to a file of its own
+ * (FLIGHT_CRASH_PREFIX<epoch sec>.csv), which the exit of the restarted controller
+ * does not overwrite, otherwise to FLIGHT_RECORDER_FILE.
+ *******************************************/
+static void flight_recorder_save(int sig)
+{
+	int saved_errno = errno;
+	char path[64], *p;
+	int fd;
+
+	if(atomic_flag_test_and_set(&flight_dumped))
+		return;
+	if(sig) {
+		p = flight_put_str(path, FLIGHT_CRASH_PREFIX);
+		p = flight_put_dec(p, (int64_t)time(NULL));
+		p = flight_put_str(p, ".csv");
+	} else {
+		p = flight_put_str(path, FLIGHT_RECORDER_FILE);
+	}
+	*p = '\0';
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd >= 0) {
+		flight_recorder_dump(fd, sig);
+		fsync(fd);
+		close(fd);
+	}
+	errno = saved_errno;
+}
+
+/******************************************
+ * flight_recorder_signal()
+ * Fatal signal handler: dump, then die of the signal as if there were no handler.
+ *******************************************/
+static void flight_recorder_signal(int sig)
+{
+	flight_recorder_save(sig);
+	// SA_RESETHAND restored the default action
+	raise(sig);
+}
+
+/******************************************
+ * flight_recorder_exit()
+ *******************************************/
+static void flight_recorder_exit(void)
+{
+	flight_recorder_save(0);
+}
+
+/******************************************
+ * flight_recorder_thread_init()
+ * Gives the calling thread its alternate signal stack, so the dump still happens when
+ * the thread dies of a stack overflow. Every thread calls it when it starts.
+ * return: 0 on success, -1 on error
+ *******************************************/
+int flight_recorder_thread_init(void)
+{
+	stack_t ss;
+
+	ss.ss_sp    = flight_stack;
+	ss.ss_size  = sizeof(flight_stack);
+	ss.ss_flags = 0;
+	return sigaltstack(&ss, NULL) ? -1 : 0;
+}
+
+/******************************************
+ * flight_recorder_install()
+ * Dumps the ring when the process dies of SIGSEGV, SIGBUS, SIGFPE, SIGILL or SIGABRT,
+ * or calls exit() (see flight_recorder_save()). SIGTERM is left to the application.
+ * return: 0 on success, -1 if a handler could not be installed
+ * NOTE: call from the main thread, before the other threads are started; it sets up
+ *       the main thread's alternate signal stack, the others call
+ *       flight_recorder_thread_init()
+ *******************************************/
+int flight_recorder_install(void)
+{
+	struct sigaction sa;
+	unsigned int i;
+
+	if(flight_recorder_thread_init())
+		return -1;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = flight_recorder_signal;
+	sa.sa_flags   = SA_RESETHAND | SA_ONSTACK;
+	sigemptyset(&sa.sa_mask);
+	for(i=0; i<sizeof(flight_signals)/sizeof(flight_signals[0]); i++)
+		if(sigaction(flight_signals[i], &sa, NULL))
+			return -1;
+
+	if(atexit(flight_recorder_exit))
+		return -1;
+	flight_record(FLIGHT_START, 0, (int32_t)getpid(), 0);
+	return 0;
+}
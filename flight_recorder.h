@@ -0,0 +1,35 @@
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <stdint.h>
+
+/******************************************
+ *                Defines
+ *******************************************/
+#define FLIGHT_RECORDER_FILE   "flight_recorder.csv" // written on exit(), replaced by the next one
+#define FLIGHT_CRASH_PREFIX    "flight_recorder-"    // + <epoch sec>.csv: written on a fatal signal, kept
+#define FLIGHT_RECORDER_EVENTS 1024                  // events kept, power of 2
+#define FLIGHT_ALTSTACK_BYTES  (16 * 1024)           // signal stack of every thread
+
+// what happened; 'a' and 'b' of flight_record() depend on it
+enum flight_event {
+	FLIGHT_START,           // a: pid
+	FLIGHT_WAKEUP,          // a: seconds late against the planned wake-up, b: 1 if the task fires
+	FLIGHT_MISSED,          // a: planned interval start of the missed run
+	FLIGHT_VALVE_OPEN,      // a: gpio
+	FLIGHT_VALVE_CLOSE,     // a: gpio, b: seconds open
+	FLIGHT_HAL_ERROR,       // a: gpio (0: bcm2835_init failed, -1: I2C transfer, b: BCM2835_I2C_REASON_*)
+	FLIGHT_STORAGE_LOAD,    // a: result, b: milliseconds
+	FLIGHT_STORAGE_WRITE,   // a: result, b: events written
+	FLIGHT_EVENTS
+};
+
+/******************************************
+ *            Function Prototypes
+ *******************************************/
+void flight_record(enum flight_event event, unsigned int task_id, int32_t a, int32_t b);
+void flight_recorder_dump(int fd, int sig);
+int  flight_recorder_install(void);
+int  flight_recorder_thread_init(void);
+
+#endif /* FLIGHT_RECORDER_H */
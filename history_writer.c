@@ -0,0 +1,191 @@
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+#include "flight_recorder.h"
+#include "history_writer.h"
+#include "logger.h"
+#include "spool.h"
+#include "water_ledger.h"
+
+/******************************************
+ *             Global Variables
+ *******************************************/
+static const struct storage_backend *history_backend;
+
+// ring of queued events, protected by history_mutex; the lock is only ever held
+// for a copy, never across a storage write
+static struct run_history_event history_queue[HISTORY_QUEUE_LEN];
+static unsigned int history_head;
+static unsigned int history_count;
+static unsigned int history_dropped;
+static unsigned char history_stopping;
+
+static pthread_mutex_t history_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  history_cond;
+static pthread_t       history_thread;
+
+/******************************************
+ * history_deliver()
+ * Hands one batch of spooled runs to the storage backend.
+ *******************************************/
+static int history_deliver(const struct spool_entry *entries, unsigned int count, void *ctx)
+{
+	struct run_history_event events[SPOOL_REPLAY_BATCH];
+	unsigned int i, n = 0;
+
+	(void)ctx;
+	for(i=0; i<count; i++) {
+		if(entries[i].type == SPOOL_RECORD_RUN_HISTORY && entries[i].len == sizeof(events[0]))
+			memcpy(&events[n++], entries[i].payload, sizeof(events[0]));
+	}
+	return storage_write_history(history_backend, events, n);
+}
+
+/******************************************
+ * history_spool()
+ * params: - const struct run_history_event* batch: runs the storage could not take
+ * 		   - unsigned int n: number of elements in 'batch'
+ * return: number of runs moved to the on-disk spool (group committed); the others are
+ *         left to the caller, none of them stays behind in the spool's buffer
+ *******************************************/
+static unsigned int history_spool(const struct run_history_event *batch, unsigned int n)
+{
+	unsigned int i;
+
+	for(i=0; i<n; i++)
+		if(spool_append(SPOOL_RECORD_RUN_HISTORY, &batch[i], sizeof(batch[i])))
+			break;
+	// runs appended before the buffer last filled up are on disk already; the rest
+	// would only be in RAM, so the batch keeps them and they are spooled again
+	if(spool_commit())
+		i -= spool_discard();
+	return i;
+}
+
+/******************************************
+ * history_writer_run()
+ * Writer thread: waits for the size or the time trigger, then writes everything
+ * queued so far as one batch. While the storage is unreachable batches go to the
+ * on-disk spool, which is replayed ahead of any newer run once the storage is back.
+ * A batch which cannot even be spooled is kept in memory and retried on the next trigger.
+ *******************************************/
+static void *history_writer_run(void *arg)
+{
+	struct run_history_event batch[HISTORY_QUEUE_LEN];
+	struct timespec deadline;
+	unsigned int n = 0;
+	unsigned int spooled;
+	unsigned int dropped;
+	unsigned char stopping;
+	unsigned char stalled = 0;
+
+	(void)arg;
+	flight_recorder_thread_init();
+	while(1) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += HISTORY_FLUSH_SEC;
+
+		pthread_mutex_lock(&history_mutex);
+		// after an attempt which moved nothing only the time trigger counts, however much
+		// is queued: the storage and the spool get one attempt per HISTORY_FLUSH_SEC; runs
+		// beyond the full queue are dropped and counted by history_writer_push()
+		while(!history_stopping && (stalled || history_count < HISTORY_BATCH_SIZE)) {
+			if(pthread_cond_timedwait(&history_cond, &history_mutex, &deadline) == ETIMEDOUT)
+				break;
+		}
+		// append to what is left of a failed batch
+		while(n < HISTORY_QUEUE_LEN && history_count) {
+			batch[n++] = history_queue[history_head];
+			history_head = (history_head + 1) % HISTORY_QUEUE_LEN;
+			history_count--;
+		}
+		dropped = history_dropped;
+		history_dropped = 0;
+		stopping = history_stopping;
+		pthread_mutex_unlock(&history_mutex);
+
+		if(dropped)
+			LOG_WARN(0, "history queue overflow: ,%u, runs dropped\n", dropped);
+
+		if(spool_pending() && spool_replay(history_deliver, NULL) < 0) {
+			// storage still unreachable: keep the order, spool behind the older runs
+			spooled = history_spool(batch, n);
+		} else if(n && storage_write_history(history_backend, batch, n)) {
+			spooled = history_spool(batch, n);
+		} else {
+			spooled = n;
+		}
+		stalled = n && !spooled;
+		n -= spooled;
+		memmove(batch, batch + spooled, n * sizeof(batch[0]));
+
+		// the water ledger file is kept up to date from here, off the actuation path
+		water_ledger_sync();
+
+		if(stopping)
+			break;
+	}
+	return NULL;
+}
+
+/******************************************
+ * history_writer_start()
+ * params: - const struct storage_backend* backend: where the history is written to
+ * return: 0 on success, -1 if the writer thread could not be created
+ *******************************************/
+int history_writer_start(const struct storage_backend *backend)
+{
+	pthread_condattr_t attr;
+
+	history_backend = backend;
+
+	// runs spooled before a restart are replayed on the first trigger
+	if(spool_open(SPOOL_FILE))
+		LOG_ERROR(0, "ERROR: could not open spool %s, runs are kept in memory only\n", SPOOL_FILE);
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&history_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	return pthread_create(&history_thread, NULL, &history_writer_run, NULL) ? -1 : 0;
+}
+
+/******************************************
+ * history_writer_push()
+ * params: - const struct run_history_event* event: run to be recorded
+ * return: 0 if queued, -1 if the queue is full and the event was dropped
+ * NOTE: never waits for storage; safe to call from the actuation path
+ *******************************************/
+int history_writer_push(const struct run_history_event *event)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&history_mutex);
+	if(history_count < HISTORY_QUEUE_LEN) {
+		history_queue[(history_head + history_count) % HISTORY_QUEUE_LEN] = *event;
+		history_count++;
+		if(history_count == HISTORY_BATCH_SIZE)
+			pthread_cond_signal(&history_cond);
+	} else {
+		history_dropped++;
+		ret = -1;
+	}
+	pthread_mutex_unlock(&history_mutex);
+	return ret;
+}
+
+/******************************************
+ * history_writer_stop()
+ * Flushes the queued events (one last attempt) and stops the writer thread.
+ *******************************************/
+void history_writer_stop(void)
+{
+	pthread_mutex_lock(&history_mutex);
+	history_stopping = 1;
+	pthread_cond_signal(&history_cond);
+	pthread_mutex_unlock(&history_mutex);
+	pthread_join(history_thread, NULL);
+	spool_close();
+}
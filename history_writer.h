@@ -0,0 +1,20 @@
+#ifndef HISTORY_WRITER_H
+#define HISTORY_WRITER_H
+
+#include "storage_backend.h"
+
+/******************************************
+ *                Defines
+ *******************************************/
+#define HISTORY_QUEUE_LEN   256 // events buffered in memory before new ones are dropped
+#define HISTORY_BATCH_SIZE  32  // size trigger: flush as soon as this many events are queued
+#define HISTORY_FLUSH_SEC   300 // time trigger: flush whatever is queued at least this often
+
+/******************************************
+ *            Function Prototypes
+ *******************************************/
+int  history_writer_start(const struct storage_backend *backend);
+int  history_writer_push(const struct run_history_event *event);
+void history_writer_stop(void);
+
+#endif /* HISTORY_WRITER_H */
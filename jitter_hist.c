@@ -0,0 +1,183 @@
+#include <string.h>
+#include <stdatomic.h>
+#include "jitter_hist.h"
+
+/******************************************
+ *              Data Types
+ *******************************************/
+struct jitter_hist {
+	atomic_uint   buckets[JITTER_BUCKETS];
+	atomic_uint   max_us;
+	atomic_ullong sum_us;
+};
+
+/******************************************
+ *            Global Variables
+ *******************************************/
+// two per task, written by its task thread: one cleared by jitter_snapshot() (the task's
+// periodic log summary), one never cleared (jitter_totals(), for the metrics endpoint)
+static struct jitter_hist jitter_hists[JITTER_TASKS];
+static struct jitter_hist jitter_cumulative[JITTER_TASKS];
+
+/******************************************
+ * jitter_bucket()
+ * return: bucket of value 'v'
+ *******************************************/
+static unsigned int jitter_bucket(uint32_t v)
+{
+	unsigned int shift;
+
+	if(v < JITTER_SUB_COUNT)
+		return v;
+	// keep the JITTER_SUB_BITS top bits of the value
+	shift = (31 - __builtin_clz(v)) - (JITTER_SUB_BITS - 1);
+	return shift * (JITTER_SUB_COUNT / 2) + (v >> shift);
+}
+
+/******************************************
+ * jitter_bucket_high()
+ * return: highest value that falls in bucket 'b'
+ *******************************************/
+static uint32_t jitter_bucket_high(unsigned int b)
+{
+	unsigned int shift;
+	uint64_t low;
+
+	if(b < JITTER_SUB_COUNT)
+		return b;
+	shift = b / (JITTER_SUB_COUNT / 2) - 1;
+	low = (uint64_t)(b - shift * (JITTER_SUB_COUNT / 2)) << shift;
+	return (uint32_t)(low + ((uint64_t)1 << shift) - 1);
+}
+
+/******************************************
+ * jitter_add()
+ *******************************************/
+static void jitter_add(struct jitter_hist *h, uint32_t v)
+{
+	uint32_t max;
+
+	atomic_fetch_add_explicit(&h->buckets[jitter_bucket(v)], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->sum_us, v, memory_order_relaxed);
+	max = atomic_load_explicit(&h->max_us, memory_order_relaxed);
+	while(v > max && !atomic_compare_exchange_weak_explicit(&h->max_us, &max, v,
+														  memory_order_relaxed, memory_order_relaxed))
+		;
+}
+
+/******************************************
+ * jitter_record()
+ * params: - unsigned int task_id: task that woke up
+ * 		   - int64_t late_us: actual wake-up time minus the planned one, in microseconds
+ * NOTE: lock-free and wait-free; early wake-ups count as 0.
+ *******************************************/
+void jitter_record(unsigned int task_id, int64_t late_us)
+{
+	uint32_t v;
+
+	if(task_id >= JITTER_TASKS)
+		return;
+	v = late_us < 0 ? 0 : late_us > UINT32_MAX ? UINT32_MAX : (uint32_t)late_us;
+	jitter_add(&jitter_hists[task_id], v);
+	jitter_add(&jitter_cumulative[task_id], v);
+}
+
+/******************************************
+ * jitter_snapshot()
+ * Reads the histogram of a task and clears it (reset-on-read): every wake-up recorded
+ * concurrently ends up in exactly one snapshot.
+ * params: - unsigned int task_id: task to be read
+ * 		   - struct jitter_snapshot* snap: receives the counts and p50/p99/max
+ * return: 0 on success, -1 if the task id is not tracked
+ *******************************************/
+int jitter_snapshot(unsigned int task_id, struct jitter_snapshot *snap)
+{
+	struct jitter_hist *h;
+	unsigned int b;
+
+	if(task_id >= JITTER_TASKS)
+		return -1;
+	h = &jitter_hists[task_id];
+
+	snap->count = 0;
+	for(b=0; b<JITTER_BUCKETS; b++) {
+		snap->buckets[b] = atomic_exchange_explicit(&h->buckets[b], 0, memory_order_relaxed);
+		snap->count += snap->buckets[b];
+	}
+	snap->sum_us = atomic_exchange_explicit(&h->sum_us, 0, memory_order_relaxed);
+	snap->max_us = atomic_exchange_explicit(&h->max_us, 0, memory_order_relaxed);
+	snap->p50_us = jitter_percentile(snap, 50.0);
+	snap->p99_us = jitter_percentile(snap, 99.0);
+	return 0;
+}
+
+/******************************************
+ * jitter_totals()
+ * Reads the histogram of a task since the start, without clearing anything, so any
+ * number of readers see the same monotonic counts.
+ * params: - unsigned int task_id: task to be read
+ * 		   - struct jitter_snapshot* snap: receives the counts and p50/p99/max
+ * return: 0 on success, -1 if the task id is not tracked
+ *******************************************/
+int jitter_totals(unsigned int task_id, struct jitter_snapshot *snap)
+{
+	struct jitter_hist *h;
+	unsigned int b;
+
+	if(task_id >= JITTER_TASKS)
+		return -1;
+	h = &jitter_cumulative[task_id];
+
+	snap->count = 0;
+	for(b=0; b<JITTER_BUCKETS; b++) {
+		snap->buckets[b] = atomic_load_explicit(&h->buckets[b], memory_order_relaxed);
+		snap->count += snap->buckets[b];
+	}
+	snap->sum_us = atomic_load_explicit(&h->sum_us, memory_order_relaxed);
+	snap->max_us = atomic_load_explicit(&h->max_us, memory_order_relaxed);
+	snap->p50_us = jitter_percentile(snap, 50.0);
+	snap->p99_us = jitter_percentile(snap, 99.0);
+	return 0;
+}
+
+/******************************************
+ * jitter_percentile()
+ * return: value (us) below which 'percent' of the snapshot's wake-ups fall, as the
+ *         upper bound of its bucket but never above the recorded max
+ *******************************************/
+uint32_t jitter_percentile(const struct jitter_snapshot *snap, double percent)
+{
+	uint64_t target, seen = 0;
+	unsigned int b;
+	uint32_t v;
+
+	if(snap->count == 0)
+		return 0;
+	target = (uint64_t)(snap->count * percent / 100.0 + 0.5);
+	if(target == 0)
+		target = 1;
+	for(b=0; b<JITTER_BUCKETS; b++) {
+		seen += snap->buckets[b];
+		if(seen >= target) {
+			v = jitter_bucket_high(b);
+			// a max taken after the buckets may be 0 or low: only trust it as a cap when set
+			return snap->max_us && v > snap->max_us ? snap->max_us : v;
+		}
+	}
+	return snap->max_us;
+}
+
+/******************************************
+ * jitter_count_le()
+ * return: wake-ups of the snapshot whose bucket lies entirely at or below 'le_us'; the
+ *         bound is rounded down to the resolution of the histogram (~6%)
+ *******************************************/
+uint32_t jitter_count_le(const struct jitter_snapshot *snap, uint32_t le_us)
+{
+	uint32_t count = 0;
+	unsigned int b;
+
+	for(b=0; b<JITTER_BUCKETS && jitter_bucket_high(b) <= le_us; b++)
+		count += snap->buckets[b];
+	return count;
+}
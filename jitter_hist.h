@@ -0,0 +1,40 @@
+#ifndef JITTER_HIST_H
+#define JITTER_HIST_H
+
+#include <stdint.h>
+
+/******************************************
+ *                Defines
+ *******************************************/
+// Log-linear (HDR style) histogram of wake-up lateness in microseconds: values below
+// JITTER_SUB_COUNT have a bucket each, every power of two above is split in
+// JITTER_SUB_COUNT/2 buckets, so a bucket is at most 1/16 (~6%) of its value wide.
+#define JITTER_SUB_BITS  5
+#define JITTER_SUB_COUNT (1 << JITTER_SUB_BITS)
+#define JITTER_MAX_BITS  32 // values are clamped to 2^32-1 us (~71 min)
+#define JITTER_BUCKETS   ((JITTER_MAX_BITS - JITTER_SUB_BITS + 1) * (JITTER_SUB_COUNT / 2) + JITTER_SUB_COUNT / 2)
+#define JITTER_TASKS     16 // task ids 0..JITTER_TASKS-1 are tracked
+
+/******************************************
+ *              Data Types
+ *******************************************/
+// what jitter_snapshot() read (and cleared) or jitter_totals() read for one task
+struct jitter_snapshot {
+	uint32_t count;
+	uint32_t max_us;
+	uint64_t sum_us;
+	uint32_t p50_us;
+	uint32_t p99_us;
+	uint32_t buckets[JITTER_BUCKETS];
+};
+
+/******************************************
+ *            Function Prototypes
+ *******************************************/
+void     jitter_record(unsigned int task_id, int64_t late_us);
+int      jitter_snapshot(unsigned int task_id, struct jitter_snapshot *snap);
+int      jitter_totals(unsigned int task_id, struct jitter_snapshot *snap);
+uint32_t jitter_percentile(const struct jitter_snapshot *snap, double percent);
+uint32_t jitter_count_le(const struct jitter_snapshot *snap, uint32_t le_us);
+
+#endif /* JITTER_HIST_H */
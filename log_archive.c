@@ -0,0 +1,415 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <glob.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <zstd.h>
+#include "flight_recorder.h"
+#include "logger.h"
+#include "log_archive.h"
+#include "tools/log_reader.h"
+
+#ifndef IOPRIO_CLASS_IDLE
+#define IOPRIO_CLASS_IDLE   3
+#define IOPRIO_CLASS_SHIFT  13
+#define IOPRIO_WHO_PROCESS  1
+#endif
+
+/******************************************
+ *            Global Variables
+ *******************************************/
+static char           archive_path[PATH_MAX - 32];
+static unsigned int   archive_seg_count;
+static size_t         archive_seg_bytes;
+static int            archive_seg_fd[LOG_SEGMENT_MAX];
+
+static pthread_t      archive_thread;
+static sem_t          archive_wakeup;
+static int            archive_started;
+static atomic_int     archive_stopping;
+static atomic_ullong  archive_closed_seq; // newest segment the writer has left
+static uint64_t       archive_done_seq;   // newest segment archived (or skipped)
+
+// work buffers of the archive thread, allocated once
+static unsigned char           *archive_raw;
+static unsigned char           *archive_out;
+static size_t                   archive_out_size;
+static size_t                  *archive_cut;
+static struct log_archive_time *archive_time;
+static struct log_reader        archive_reader;
+static ZSTD_CCtx               *archive_cctx;
+
+/******************************************
+ * archive_put32()
+ *******************************************/
+static unsigned char *archive_put32(unsigned char *p, uint32_t v)
+{
+	p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+	return p + 4;
+}
+
+/******************************************
+ * archive_put64()
+ *******************************************/
+static unsigned char *archive_put64(unsigned char *p, uint64_t v)
+{
+	p = archive_put32(p, (uint32_t)v);
+	return archive_put32(p, (uint32_t)(v >> 32));
+}
+
+/******************************************
+ * archive_write_all()
+ *******************************************/
+static int archive_write_all(int fd, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	ssize_t ret;
+
+	while(len) {
+		ret = write(fd, p, len);
+		if(ret < 0) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/******************************************
+ * archive_segment_seq()
+ * return: sequence number in the header of segment 'index', 0 if it has none
+ *******************************************/
+static uint64_t archive_segment_seq(unsigned int index)
+{
+	struct log_file_header hdr;
+
+	if(pread(archive_seg_fd[index], &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+	   hdr.magic != LOG_FORMAT_MAGIC || hdr.version != LOG_FORMAT_VERSION)
+		return 0;
+	return hdr.segment_seq;
+}
+
+/******************************************
+ * archive_dict()
+ * Appends a DICT record for every format 'archive_reader' has seen to 'buf'.
+ * return: new length of 'buf', 0 if it does not fit in 'size'
+ *******************************************/
+static size_t archive_dict(unsigned char *buf, size_t len, size_t size)
+{
+	size_t flen;
+	unsigned int id;
+
+	for(id=0; id<LOG_READER_DICT_SIZE; id++) {
+		if(archive_reader.dict[id] == NULL)
+			continue;
+		flen = strlen(archive_reader.dict[id]);
+		if(len + 1 + 2 * LOG_VARINT_MAX + flen > size)
+			return 0;
+		buf[len++] = LOG_REC_DICT;
+		len += log_varint_put(buf + len, id);
+		len += log_varint_put(buf + len, flen);
+		memcpy(buf + len, archive_reader.dict[id], flen);
+		len += flen;
+	}
+	return len;
+}
+
+/******************************************
+ * archive_segment()
+ * Compresses segment 'index', which holds 'seq', to <log file>-<seq>.zst.
+ * return: 0 on success, -1 if it could not be archived (e.g. reused meanwhile)
+ *******************************************/
+static int archive_segment(unsigned int index, uint64_t seq)
+{
+	struct log_archive_seek_entry *seek = NULL;
+	char path[PATH_MAX - 8], tmp_path[PATH_MAX];
+	struct log_event event;
+	unsigned char *dict = NULL;
+	unsigned char *p;
+	size_t len, offset, start, dict_len;
+	size_t csize;
+	unsigned int nframes = 0, i;
+	int have_first = 0;
+	int fd = -1;
+	int ret = -1;
+
+	// a private copy: the writer may come back to this segment while we work on it
+	len = 0;
+	while(len < archive_seg_bytes) {
+		ssize_t r = pread(archive_seg_fd[index], archive_raw + len, archive_seg_bytes - len, len);
+		if(r <= 0)
+			break;
+		len += r;
+	}
+	offset = log_reader_skip_header(archive_raw, len);
+	if(offset == 0)
+		return -1;
+
+	// cut the records in frames of about LOG_ARCHIVE_FRAME_BYTES, always after an event
+	log_reader_init(&archive_reader);
+	archive_cut[0] = offset;
+	memset(archive_time, 0, sizeof(*archive_time));
+	start = offset;
+	while(log_reader_next(&archive_reader, archive_raw, len, &offset, &event)) {
+		if(!have_first) {
+			archive_time[nframes + 1].first_sec = event.timestamp_sec;
+			have_first = 1;
+		}
+		archive_time[nframes + 1].last_sec = event.timestamp_sec;
+		if(offset - start >= LOG_ARCHIVE_FRAME_BYTES) {
+			archive_cut[++nframes] = offset;
+			start = offset;
+			have_first = 0;
+		}
+	}
+	if(have_first)
+		archive_cut[++nframes] = offset;
+
+	// frame 0: the segment header and all the formats, so any frame decodes after it
+	dict_len = sizeof(struct log_file_header) + LOG_READER_DICT_SIZE;
+	dict = malloc(dict_len);
+	seek = calloc(nframes + 1, sizeof(*seek));
+	if(dict == NULL || seek == NULL)
+		goto out;
+	memcpy(dict, archive_raw, sizeof(struct log_file_header));
+	while((len = archive_dict(dict, sizeof(struct log_file_header), dict_len)) == 0) {
+		dict_len *= 2;
+		p = realloc(dict, dict_len);
+		if(p == NULL)
+			goto out;
+		dict = p;
+	}
+	dict_len = len;
+
+	snprintf(path, sizeof(path), "%s-%010llu%s", archive_path, (unsigned long long)seq, LOG_ARCHIVE_SUFFIX);
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+		goto out;
+
+	for(i=0; i<=nframes; i++) {
+		const unsigned char *src = i ? archive_raw + archive_cut[i - 1] : dict;
+		size_t src_len = i ? archive_cut[i] - archive_cut[i - 1] : dict_len;
+
+		if(atomic_load(&archive_stopping))
+			goto out;
+		csize = ZSTD_compressCCtx(archive_cctx, archive_out, archive_out_size, src, src_len, LOG_ARCHIVE_LEVEL);
+		if(ZSTD_isError(csize) || archive_write_all(fd, archive_out, csize))
+			goto out;
+		seek[i].compressed_size   = csize;
+		seek[i].decompressed_size = src_len;
+	}
+
+	// time index, then the seek table
+	p = archive_put32(archive_out, LOG_ARCHIVE_TIME_MAGIC);
+	p = archive_put32(p, (nframes + 1) * 16);
+	for(i=0; i<=nframes; i++) {
+		p = archive_put64(p, archive_time[i].first_sec);
+		p = archive_put64(p, archive_time[i].last_sec);
+	}
+	p = archive_put32(p, LOG_ARCHIVE_SKIPPABLE_MAGIC);
+	p = archive_put32(p, (nframes + 1) * 8 + LOG_ARCHIVE_FOOTER_BYTES);
+	for(i=0; i<=nframes; i++) {
+		p = archive_put32(p, seek[i].compressed_size);
+		p = archive_put32(p, seek[i].decompressed_size);
+	}
+	p = archive_put32(p, nframes + 1);
+	*p++ = 0; // descriptor: no checksums
+	p = archive_put32(p, LOG_ARCHIVE_SEEKABLE_MAGIC);
+	if(archive_write_all(fd, archive_out, p - archive_out))
+		goto out;
+
+	// only keep the archive if the writer has not started to reuse the segment meanwhile
+	if(archive_segment_seq(index) != seq || fdatasync(fd))
+		goto out;
+	close(fd);
+	fd = -1;
+	if(rename(tmp_path, path))
+		goto out;
+	ret = 0;
+out:
+	if(fd >= 0) {
+		close(fd);
+		unlink(tmp_path);
+	}
+	log_reader_free(&archive_reader);
+	free(dict);
+	free(seek);
+	return ret;
+}
+
+/******************************************
+ * archive_prune()
+ * Removes the oldest archives beyond LOG_ARCHIVE_KEEP.
+ *******************************************/
+static void archive_prune(void)
+{
+	char pattern[PATH_MAX];
+	glob_t g;
+	size_t i;
+
+	snprintf(pattern, sizeof(pattern), "%s-*%s", archive_path, LOG_ARCHIVE_SUFFIX);
+	if(glob(pattern, 0, NULL, &g))
+		return;
+	// zero padded sequence numbers: the sorted names are in age order
+	for(i=0; i + LOG_ARCHIVE_KEEP < g.gl_pathc; i++)
+		unlink(g.gl_pathv[i]);
+	globfree(&g);
+}
+
+/******************************************
+ * archive_newest()
+ * return: sequence number of the newest archive on disk, 0 if there is none
+ *******************************************/
+static uint64_t archive_newest(void)
+{
+	char pattern[PATH_MAX];
+	unsigned long long seq = 0;
+	glob_t g;
+
+	snprintf(pattern, sizeof(pattern), "%s-*%s", archive_path, LOG_ARCHIVE_SUFFIX);
+	if(glob(pattern, 0, NULL, &g))
+		return 0;
+	sscanf(g.gl_pathv[g.gl_pathc - 1] + strlen(archive_path), "-%llu", &seq);
+	globfree(&g);
+	return seq;
+}
+
+/******************************************
+ * archive_run()
+ * Archive thread: compresses every segment closed by the writer, oldest first.
+ * It runs in the idle scheduling and I/O classes so it only ever uses time
+ * nothing else wants; the log writer never waits for it.
+ *******************************************/
+static void *archive_run(void *arg)
+{
+	struct sched_param param;
+	uint64_t closed, seq, oldest;
+	unsigned int i, index = 0;
+
+	(void)arg;
+	flight_recorder_thread_init();
+	memset(&param, 0, sizeof(param));
+	pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+	syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+
+	while(!atomic_load(&archive_stopping)) {
+		closed = atomic_load(&archive_closed_seq);
+		if(archive_done_seq >= closed) {
+			sem_wait(&archive_wakeup);
+			continue;
+		}
+
+		// oldest closed segment not archived yet; the ones overwritten before we got to them are gone
+		oldest = 0;
+		for(i=0; i<archive_seg_count; i++) {
+			seq = archive_segment_seq(i);
+			if(seq > archive_done_seq && seq <= closed && (oldest == 0 || seq < oldest)) {
+				oldest = seq;
+				index = i;
+			}
+		}
+		if(oldest == 0) {
+			archive_done_seq = closed;
+			continue;
+		}
+
+		if(archive_segment(index, oldest) == 0)
+			archive_prune();
+		archive_done_seq = oldest;
+	}
+	return NULL;
+}
+
+/******************************************
+ * log_archive_start()
+ * params: - const char* path: base name of the log, as given to logger_start()
+ * 		   - unsigned int segment_count: number of segments in the rotation
+ * 		   - size_t segment_bytes: size of every segment
+ * return: 0 on success, -1 on error
+ * NOTE: segments closed before a restart are archived as well, unless already done.
+ *******************************************/
+int log_archive_start(const char *path, unsigned int segment_count, size_t segment_bytes)
+{
+	char seg_path[PATH_MAX];
+	unsigned int i = 0;
+
+	if(segment_count > LOG_SEGMENT_MAX || strlen(path) >= sizeof(archive_path))
+		return -1;
+	strcpy(archive_path, path);
+	archive_seg_count = segment_count;
+	archive_seg_bytes = segment_bytes;
+
+	archive_out_size = ZSTD_compressBound(segment_bytes + LOG_READER_DICT_SIZE) + 32 * (segment_bytes / LOG_ARCHIVE_FRAME_BYTES + 2);
+	archive_raw  = malloc(segment_bytes);
+	archive_out  = malloc(archive_out_size);
+	archive_cut  = calloc(segment_bytes / LOG_ARCHIVE_FRAME_BYTES + 2, sizeof(*archive_cut));
+	archive_time = calloc(segment_bytes / LOG_ARCHIVE_FRAME_BYTES + 2, sizeof(*archive_time));
+	archive_cctx = ZSTD_createCCtx();
+	if(!archive_raw || !archive_out || !archive_cut || !archive_time || !archive_cctx)
+		goto error;
+
+	for(i=0; i<segment_count; i++) {
+		snprintf(seg_path, sizeof(seg_path), "%s.%u", path, i);
+		archive_seg_fd[i] = open(seg_path, O_RDONLY);
+		if(archive_seg_fd[i] < 0)
+			goto error;
+	}
+
+	archive_done_seq = archive_newest();
+	sem_init(&archive_wakeup, 0, 0);
+	if(pthread_create(&archive_thread, NULL, &archive_run, NULL))
+		goto error;
+	archive_started = 1;
+	atexit(log_archive_stop);
+	return 0;
+
+error:
+	while(i--)
+		close(archive_seg_fd[i]);
+	ZSTD_freeCCtx(archive_cctx);
+	free(archive_raw);
+	free(archive_out);
+	free(archive_cut);
+	free(archive_time);
+	return -1;
+}
+
+/******************************************
+ * log_archive_segment_closed()
+ * Called by the log writer when it leaves segment 'seq'; never blocks.
+ *******************************************/
+void log_archive_segment_closed(uint64_t seq)
+{
+	atomic_store(&archive_closed_seq, seq);
+	if(archive_started)
+		sem_post(&archive_wakeup);
+}
+
+/******************************************
+ * log_archive_stop()
+ * Stops the archive thread; a segment being compressed is left for the next start.
+ *******************************************/
+void log_archive_stop(void)
+{
+	unsigned int i;
+
+	if(!archive_started || atomic_exchange(&archive_stopping, 1))
+		return;
+	sem_post(&archive_wakeup);
+	pthread_join(archive_thread, NULL);
+	for(i=0; i<archive_seg_count; i++)
+		close(archive_seg_fd[i]);
+}
@@ -0,0 +1,49 @@
+#ifndef LOG_ARCHIVE_H
+#define LOG_ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/******************************************
+ *                Defines
+ *******************************************/
+// closed segments are compressed to <log file>-<segment seq>.zst
+#define LOG_ARCHIVE_SUFFIX      ".zst"
+#define LOG_ARCHIVE_KEEP        256          // archives kept; the oldest one is removed beyond that
+#define LOG_ARCHIVE_FRAME_BYTES (64 * 1024)  // raw log data per zstd frame
+#define LOG_ARCHIVE_LEVEL       3
+
+// Archive layout, all frames standard zstd so "zstd -d" gives back a decodable log:
+//   frame 0          segment header + every DICT record of the segment
+//   frames 1..n      the records, cut after an EVENT record so each frame decodes on
+//                    its own once frame 0 is known
+//   skippable frame  LOG_ARCHIVE_TIME_MAGIC: struct log_archive_time per frame
+//   skippable frame  zstd seekable format seek table (compressed/decompressed size per
+//                    frame, no checksums), always last
+#define LOG_ARCHIVE_SKIPPABLE_MAGIC 0x184D2A5Eu
+#define LOG_ARCHIVE_TIME_MAGIC      0x184D2A5Bu
+#define LOG_ARCHIVE_SEEKABLE_MAGIC  0x8F92EAB1u
+#define LOG_ARCHIVE_FOOTER_BYTES    9            // frame count, descriptor, seekable magic
+
+/******************************************
+ *              Data Types
+ *******************************************/
+struct log_archive_seek_entry {
+	uint32_t compressed_size;
+	uint32_t decompressed_size;
+};
+
+// time covered by the events of one frame; zero for frame 0
+struct log_archive_time {
+	int64_t first_sec;
+	int64_t last_sec;
+};
+
+/******************************************
+ *            Function Prototypes
+ *******************************************/
+int  log_archive_start(const char *path, unsigned int segment_count, size_t segment_bytes);
+void log_archive_segment_closed(uint64_t seq);
+void log_archive_stop(void);
+
+#endif /* LOG_ARCHIVE_H */
@@ -0,0 +1,111 @@
+#include <string.h>
+#include "log_format.h"
+
+/******************************************
+ * log_format_next_conv()
+ * params: - const char* fmt: printf style format string
+ * 		   - struct log_conv* conv: filled in with the next conversion specification
+ * return: pointer right after that specification, or NULL if there is none left
+ *******************************************/
+const char *log_format_next_conv(const char *fmt, struct log_conv *conv)
+{
+	const char *p = strchr(fmt, '%');
+	unsigned int l = 0;
+
+	if(p == NULL)
+		return NULL;
+
+	memset(conv, 0, sizeof(*conv));
+	conv->start = p++;
+
+	// flags
+	while(*p && strchr("-+ #0'", *p))
+		p++;
+	// width
+	if(*p == '*') {
+		conv->star_width = 1;
+		p++;
+	}
+	while(*p >= '0' && *p <= '9')
+		p++;
+	// precision
+	if(*p == '.') {
+		p++;
+		if(*p == '*') {
+			conv->star_prec = 1;
+			p++;
+		}
+		while(*p >= '0' && *p <= '9')
+			p++;
+	}
+	// length modifier
+	while(*p && strchr("hlLqjzt", *p) && l < sizeof(conv->length) - 1)
+		conv->length[l++] = *p++;
+
+	switch(*p) {
+	case 'd': case 'i':
+		conv->arg_type = LOG_ARG_INT;
+		break;
+	case 'u': case 'o': case 'x': case 'X': case 'c':
+		conv->arg_type = LOG_ARG_UINT;
+		break;
+	case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+		conv->arg_type = LOG_ARG_DOUBLE;
+		break;
+	case 's':
+		conv->arg_type = LOG_ARG_STR;
+		break;
+	case 'p':
+		conv->arg_type = LOG_ARG_PTR;
+		break;
+	case '%':
+		conv->arg_type = 0;
+		break;
+	case '\0':
+		// dangling '%': treat it as plain text
+		conv->len = (unsigned int)(p - conv->start);
+		return p;
+	default:
+		// unsupported conversion (e.g. %n): consumes nothing
+		conv->arg_type = 0;
+		break;
+	}
+	p++;
+	conv->len = (unsigned int)(p - conv->start);
+	return p;
+}
+
+/******************************************
+ * log_varint_put()
+ * return: number of bytes written to 'p' (at most LOG_VARINT_MAX)
+ *******************************************/
+unsigned int log_varint_put(uint8_t *p, uint64_t v)
+{
+	unsigned int n = 0;
+
+	while(v >= 0x80) {
+		p[n++] = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (uint8_t)v;
+	return n;
+}
+
+/******************************************
+ * log_varint_get()
+ * return: number of bytes read from 'p', 0 if the varint runs past 'end'
+ *******************************************/
+unsigned int log_varint_get(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+	unsigned int n = 0;
+	unsigned int shift = 0;
+
+	*v = 0;
+	while(p + n < end && n < LOG_VARINT_MAX) {
+		*v |= (uint64_t)(p[n] & 0x7F) << shift;
+		if(!(p[n++] & 0x80))
+			return n;
+		shift += 7;
+	}
+	return 0;
+}
@@ -0,0 +1,89 @@
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+#include <stdint.h>
+
+/******************************************
+ *                Defines
+ *******************************************/
+#define LOG_FORMAT_MAGIC   0x424C4756u /* "VGLB" little endian */
+#define LOG_FORMAT_VERSION 2
+
+// record types
+#define LOG_REC_DICT  1 // format string definition
+#define LOG_REC_EVENT 2 // one print_safe() call
+
+// argument types, derived from the conversions of the format string
+#define LOG_ARG_INT    1 // zigzag varint
+#define LOG_ARG_UINT   2 // varint
+#define LOG_ARG_DOUBLE 3 // 8 bytes
+#define LOG_ARG_STR    4 // uint8_t length + bytes, no terminator
+#define LOG_ARG_PTR    5 // varint
+
+#define LOG_MAX_ARGS    12  // arguments kept per message; conversions beyond are not captured
+#define LOG_MAX_STR_LEN 255
+#define LOG_VARINT_MAX  10  // bytes of a 64 bit varint
+
+/******************************************
+ *              Data Types
+ *******************************************/
+// Binary log layout (host byte order, written and decoded on the controller):
+//   struct log_file_header, then records, each starting with its type byte.
+//   LOG_REC_DICT : type, varint fmt_id, varint length, format string bytes
+//   LOG_REC_EVENT: type, varint fmt_id, varint task_id, varint timestamp_sec,
+//                  then the arguments, typed and counted after the conversions of
+//                  the format string the same way logger.c captured them
+// A format id is defined by a DICT record before its first use; later DICT records
+// with the same id (e.g. after a restart) replace the earlier definition.
+// Integers are LEB128 varints, so a typical wake-up event takes about 10 bytes.
+// The log is split in preallocated segments; the records of a segment end at the
+// first zero byte, and every segment defines the formats it uses.
+struct log_file_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t reserved;
+	uint64_t segment_seq; // increases by one with every segment written
+};
+
+// Sidecar index <segment>.idx, rewritten whenever its segment is reused: a header, then
+// entries in file order. An entry points at the start of a record: every LOG_INDEX_EVERY
+// records (task_id LOG_INDEX_ANY), every LOG_INDEX_EVERY records of one task (that task's
+// id) and every DICT record (LOG_INDEX_DICT), so a reader can load the formats and start
+// decoding close to any time and task without scanning the segment.
+#define LOG_INDEX_MAGIC   0x494C4756u /* "VGLI" little endian */
+#define LOG_INDEX_VERSION 1
+#define LOG_INDEX_EVERY   128
+#define LOG_INDEX_ANY     0xFFFFFFFFu
+#define LOG_INDEX_DICT    0xFFFFFFFEu
+
+struct log_index_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t reserved;
+	uint64_t segment_seq; // segment the entries belong to
+};
+
+struct log_index_entry {
+	uint32_t offset;      // of the record in the segment
+	uint32_t task_id;     // or LOG_INDEX_ANY / LOG_INDEX_DICT
+	int64_t  timestamp_sec;
+};
+
+// one conversion specification found in a format string
+struct log_conv {
+	const char *start; // the '%'
+	unsigned int len;  // up to and including the conversion character
+	int arg_type;      // LOG_ARG_*, 0 for "%%"
+	char length[3];    // length modifier as written ("", "l", "ll", "h", "hh", "z", ...)
+	int star_width;    // '*' width: takes an int argument first
+	int star_prec;     // '.*' precision: takes an int argument first
+};
+
+/******************************************
+ *            Function Prototypes
+ *******************************************/
+const char *log_format_next_conv(const char *fmt, struct log_conv *conv);
+unsigned int log_varint_put(uint8_t *p, uint64_t v);
+unsigned int log_varint_get(const uint8_t *p, const uint8_t *end, uint64_t *v);
+
+#endif /* LOG_FORMAT_H */
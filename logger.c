@@ -0,0 +1,839 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "flight_recorder.h"
+#include "log_format.h"
+#include "logger.h"
+#include "probes.h"
+
+/******************************************
+ *              Data Types
+ *******************************************/
+// One ring slot. 'seq' tells whose turn it is (bounded MPMC queue by D. Vyukov, used
+// here with a single consumer): seq == pos means free for the producer claiming 'pos',
+// seq == pos + 1 means filled and ready for the writer.
+// The slot holds the raw arguments; nothing is formatted on the producer's side.
+struct log_slot {
+	atomic_uint  seq;
+	unsigned int task_id;
+	time_t       timestamp_sec;
+	const char  *fmt;
+	unsigned int nargs;
+	unsigned int str_len;               // bytes of 'str' in use
+	uint8_t      tag[LOG_MAX_ARGS];     // LOG_ARG_* per argument
+	union {
+		int64_t  i;
+		uint64_t u;
+		double   d;
+		struct {
+			uint16_t off;
+			uint16_t len;
+		} s;
+	} arg[LOG_MAX_ARGS];
+	char         str[LOG_STR_BYTES];    // copies of the string arguments
+};
+
+/******************************************
+ *             Global Variables
+ *******************************************/
+// kept for the callers of print_safe(); the ring needs no lock
+pthread_mutex_t logfile_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct log_slot log_ring[LOG_RING_SIZE];
+static atomic_uint log_enqueue_pos;
+static unsigned int log_dequeue_pos;  // owned by the writer thread
+static atomic_int log_ring_ready;
+static pthread_once_t log_ring_once = PTHREAD_ONCE_INIT;
+
+static atomic_int  log_writer_idle;
+static atomic_int  log_stopping;
+static sem_t       log_wakeup;
+static pthread_t   log_writer_thread;
+static int         log_started;
+
+// rotating segments, owned by the writer thread: every file is preallocated once
+// and kept open, so switching to the next one is an index increment
+static int          log_seg_fd[LOG_SEGMENT_MAX];
+static unsigned int log_seg_count;
+static size_t       log_seg_bytes;
+static unsigned int log_seg_index;
+static uint64_t     log_seg_seq;
+static size_t       log_seg_off;   // end of the data in the active segment
+static void       (*log_seg_hook)(uint64_t seq);
+
+// sidecar index of the active segment (<segment>.idx), also owned by the writer thread
+static int                    log_idx_fd[LOG_SEGMENT_MAX];
+static off_t                  log_idx_off;
+static struct log_index_entry log_idx_pending[LOG_INDEX_PENDING];
+static unsigned int           log_idx_count;
+static unsigned int           log_idx_records;
+static unsigned int           log_idx_task_records[LOG_INDEX_TASKS];
+
+// data not yet written, starting at the block aligned segment offset 'log_buf_base'
+static unsigned char log_buf[LOG_BATCH_BYTES];
+static size_t        log_buf_base;
+// what the active segment holds on disk: data up to 'log_disk_off', followed by a zero
+// byte; blocks from 'log_disk_end' on were not written in this lap and are zero only
+// if 'log_seg_zeroed' (otherwise they still hold the records of the earlier lap)
+static size_t        log_disk_off;
+static size_t        log_disk_end;
+static int           log_seg_zeroed;
+static int64_t       log_tail_since_ms; // when data first waited in the partial last block, 0: none
+
+// format string -> format id, owned by the writer thread
+static const char *log_dict[LOG_DICT_SIZE];
+static uint16_t    log_dict_id[LOG_DICT_SIZE];
+static unsigned int log_dict_count;
+
+static atomic_ulong log_enqueued;
+static atomic_ulong log_dropped;
+static atomic_ulong log_written;
+static atomic_ulong log_bytes;
+
+/******************************************
+ * logger_ring_init()
+ *******************************************/
+static void logger_ring_init(void)
+{
+	unsigned int i;
+
+	for(i=0; i<LOG_RING_SIZE; i++)
+		atomic_init(&log_ring[i].seq, i);
+	atomic_store(&log_ring_ready, 1);
+}
+
+/******************************************
+ * logger_now_ms()
+ *******************************************/
+static int64_t logger_now_ms(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/******************************************
+ * logger_flush()
+ * params: - int with_tail: 1 to write the last, partial block too
+ * Writes the buffered data of the active segment with block aligned writes. Without
+ * 'with_tail' only the completed blocks are written, so a block is not rewritten for
+ * every message that lands in it. The data on disk is always followed by a zero byte
+ * (end marker), also while the segment still holds records from an earlier lap: when
+ * the block after the completed ones may hold old records, it goes out with them once.
+ * The partial block stays buffered either way and is rewritten in place later.
+ *******************************************/
+static void logger_flush(int with_tail)
+{
+	size_t len = log_seg_off - log_buf_base;
+	size_t tail = log_seg_off & ~(size_t)(LOG_BLOCK_BYTES - 1);
+	size_t wlen = tail - log_buf_base;
+	size_t done = 0;
+	unsigned int i, n;
+	ssize_t ret;
+
+	if(with_tail || (!log_seg_zeroed && tail >= log_disk_end))
+		wlen += LOG_BLOCK_BYTES;
+	if(log_buf_base + wlen > log_seg_bytes)
+		wlen = log_seg_bytes - log_buf_base;
+	if(wlen > len)
+		memset(log_buf + len, 0, wlen - len);
+
+	while(done < wlen) {
+		ret = pwrite(log_seg_fd[log_seg_index], log_buf + done, wlen - done, log_buf_base + done);
+		if(ret < 0) {
+			if(errno == EINTR)
+				continue;
+			// nowhere left to report to; drop the batch
+			break;
+		}
+		done += ret;
+	}
+	atomic_fetch_add_explicit(&log_bytes, done, memory_order_relaxed);
+	if(done == wlen && wlen) {
+		log_disk_off = log_buf_base + (wlen < len ? wlen : len);
+		if(log_buf_base + wlen > log_disk_end)
+			log_disk_end = log_buf_base + wlen;
+	}
+	if(log_disk_off == log_seg_off)
+		log_tail_since_ms = 0;
+	else if(log_tail_since_ms == 0)
+		log_tail_since_ms = logger_now_ms();
+
+	// index entries go out after the data they point to
+	for(n=0; n<log_idx_count && log_idx_pending[n].offset < log_disk_off; n++)
+		;
+	if(n) {
+		ret = pwrite(log_idx_fd[log_seg_index], log_idx_pending, n * sizeof(log_idx_pending[0]), log_idx_off);
+		if(ret > 0)
+			log_idx_off += ret;
+		for(i=n; i<log_idx_count; i++)
+			log_idx_pending[i - n] = log_idx_pending[i];
+		log_idx_count -= n;
+	}
+
+	memmove(log_buf, log_buf + (tail - log_buf_base), log_seg_off - tail);
+	log_buf_base = tail;
+}
+
+/******************************************
+ * logger_open_segment()
+ * Makes segment 'index' the active one and starts it with a header carrying 'seq'.
+ *******************************************/
+static void logger_open_segment(unsigned int index, uint64_t seq)
+{
+	struct log_index_header idx_hdr;
+	struct log_file_header hdr;
+
+	log_seg_index = index;
+	log_seg_seq   = seq;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic       = LOG_FORMAT_MAGIC;
+	hdr.version     = LOG_FORMAT_VERSION;
+	hdr.segment_seq = seq;
+	memcpy(log_buf, &hdr, sizeof(hdr));
+	log_buf_base = 0;
+	log_seg_off  = sizeof(hdr);
+
+	// zeroing the range only marks the extents unwritten, it writes no data; without it
+	// the block after the data gets the end marker written ahead (see logger_flush())
+	log_seg_zeroed    = fallocate(log_seg_fd[index], FALLOC_FL_ZERO_RANGE, 0, log_seg_bytes) == 0;
+	log_disk_off      = 0;
+	log_disk_end      = 0;
+	log_tail_since_ms = 0;
+
+	// every segment is decodable on its own: formats are defined again in each one
+	memset(log_dict, 0, sizeof(log_dict));
+	log_dict_count = 0;
+
+	// the index of the earlier lap is of no use any more
+	memset(&idx_hdr, 0, sizeof(idx_hdr));
+	idx_hdr.magic       = LOG_INDEX_MAGIC;
+	idx_hdr.version     = LOG_INDEX_VERSION;
+	idx_hdr.segment_seq = seq;
+	log_idx_off = 0;
+	if(ftruncate(log_idx_fd[index], 0) == 0 &&
+	   pwrite(log_idx_fd[index], &idx_hdr, sizeof(idx_hdr), 0) == (ssize_t)sizeof(idx_hdr))
+		log_idx_off = sizeof(idx_hdr);
+	log_idx_count   = 0;
+	log_idx_records = 0;
+	memset(log_idx_task_records, 0, sizeof(log_idx_task_records));
+}
+
+/******************************************
+ * logger_index_add()
+ * Queues an index entry for the record starting at 'offset' of the active segment.
+ *******************************************/
+static void logger_index_add(size_t offset, uint32_t task_id, time_t timestamp_sec)
+{
+	struct log_index_entry *entry;
+
+	// no header written: the index is unusable for this segment, don't grow it
+	if(log_idx_off == 0)
+		return;
+	// the entries waiting for their data to reach the disk
+	if(log_idx_count == LOG_INDEX_PENDING)
+		logger_flush(1);
+	// the write failed and nothing was drained: the index is sparse, lose this entry
+	if(log_idx_count == LOG_INDEX_PENDING)
+		return;
+	entry = &log_idx_pending[log_idx_count++];
+	entry->offset        = (uint32_t)offset;
+	entry->task_id       = task_id;
+	entry->timestamp_sec = timestamp_sec;
+}
+
+/******************************************
+ * logger_index()
+ * Index entries for the records of one message, just encoded at 'offset'.
+ *******************************************/
+static void logger_index(const struct log_slot *slot, size_t offset, int has_dict)
+{
+	if(has_dict)
+		logger_index_add(offset, LOG_INDEX_DICT, slot->timestamp_sec);
+	if(log_idx_records++ % LOG_INDEX_EVERY == 0)
+		logger_index_add(offset, LOG_INDEX_ANY, slot->timestamp_sec);
+	if(slot->task_id < LOG_INDEX_TASKS && log_idx_task_records[slot->task_id]++ % LOG_INDEX_EVERY == 0)
+		logger_index_add(offset, slot->task_id, slot->timestamp_sec);
+}
+
+/******************************************
+ * logger_next_segment()
+ *******************************************/
+static void logger_next_segment(void)
+{
+	logger_flush(1);
+	if(log_seg_hook)
+		log_seg_hook(log_seg_seq);
+	logger_open_segment((log_seg_index + 1) % log_seg_count, log_seg_seq + 1);
+}
+
+/******************************************
+ * logger_dict_lookup()
+ * params: - const char* fmt: format string of a message
+ * 		   - int* is_new: set to 1 if the format has not been written before
+ * return: format id of 'fmt'
+ *******************************************/
+static uint16_t logger_dict_lookup(const char *fmt, int *is_new)
+{
+	unsigned int h = (unsigned int)(((uintptr_t)fmt >> 3) * 2654435761u) & (LOG_DICT_SIZE - 1);
+	unsigned int probes;
+
+	*is_new = 0;
+	for(probes=0; probes<LOG_DICT_SIZE; probes++) {
+		if(log_dict[h] == fmt)
+			return log_dict_id[h];
+		if(log_dict[h] == NULL) {
+			// keep the table at most half full so lookups stay short
+			if(log_dict_count >= LOG_DICT_SIZE / 2)
+				break;
+			log_dict[h] = fmt;
+			log_dict_id[h] = (uint16_t)log_dict_count++;
+			*is_new = 1;
+			return log_dict_id[h];
+		}
+		h = (h + 1) & (LOG_DICT_SIZE - 1);
+	}
+	// table full: this id is redefined in front of every use
+	*is_new = 1;
+	return LOG_DICT_SIZE / 2;
+}
+
+/******************************************
+ * logger_encode()
+ * params: - const struct log_slot* slot: message to be encoded
+ * 		   - unsigned char* out: receives the DICT record (if needed) and the EVENT record
+ * return: number of bytes written to 'out' (at most LOG_MAX_ENCODED)
+ *******************************************/
+static size_t logger_encode(const struct log_slot *slot, unsigned char *out)
+{
+	unsigned char *p = out;
+	uint16_t fmt_id;
+	size_t fmt_len;
+	unsigned int i;
+	int is_new;
+
+	fmt_id = logger_dict_lookup(slot->fmt, &is_new);
+	if(is_new) {
+		fmt_len = strnlen(slot->fmt, LOG_MAX_FMT_LEN);
+		*p++ = LOG_REC_DICT;
+		p += log_varint_put(p, fmt_id);
+		p += log_varint_put(p, fmt_len);
+		memcpy(p, slot->fmt, fmt_len);
+		p += fmt_len;
+	}
+
+	*p++ = LOG_REC_EVENT;
+	p += log_varint_put(p, fmt_id);
+	p += log_varint_put(p, slot->task_id);
+	p += log_varint_put(p, (uint64_t)(int64_t)slot->timestamp_sec);
+	for(i=0; i<slot->nargs; i++) {
+		switch(slot->tag[i]) {
+		case LOG_ARG_INT:
+			// zigzag: small negative numbers stay short too
+			p += log_varint_put(p, ((uint64_t)slot->arg[i].i << 1) ^ (uint64_t)(slot->arg[i].i >> 63));
+			break;
+		case LOG_ARG_UINT:
+		case LOG_ARG_PTR:
+			p += log_varint_put(p, slot->arg[i].u);
+			break;
+		case LOG_ARG_DOUBLE:
+			memcpy(p, &slot->arg[i].d, sizeof(double));
+			p += sizeof(double);
+			break;
+		case LOG_ARG_STR:
+			*p++ = (unsigned char)slot->arg[i].s.len;
+			memcpy(p, slot->str + slot->arg[i].s.off, slot->arg[i].s.len);
+			p += slot->arg[i].s.len;
+			break;
+		}
+	}
+	return (size_t)(p - out);
+}
+
+/******************************************
+ * logger_drain()
+ * Encodes every message currently in the ring into the segment buffer, flushing
+ * the completed blocks whenever the buffer fills up and once at the end.
+ * return: number of messages taken from the ring
+ *******************************************/
+static unsigned int logger_drain(void)
+{
+	struct log_slot *slot;
+	unsigned char *rec;
+	unsigned int n = 0;
+	size_t offset;
+
+	while(1) {
+		slot = &log_ring[log_dequeue_pos & (LOG_RING_SIZE - 1)];
+		if(atomic_load_explicit(&slot->seq, memory_order_acquire) != log_dequeue_pos + 1)
+			break;
+
+		// keep room for the end marker behind the last record
+		if(log_seg_off + LOG_MAX_ENCODED + 1 > log_seg_bytes)
+			logger_next_segment();
+		else if(log_seg_off - log_buf_base + LOG_MAX_ENCODED + 1 > LOG_BATCH_BYTES)
+			logger_flush(0);
+		offset = log_seg_off;
+		rec = log_buf + (log_seg_off - log_buf_base);
+		log_seg_off += logger_encode(slot, rec);
+		logger_index(slot, offset, rec[0] == LOG_REC_DICT);
+
+		// hand the slot back to the producers, one lap ahead
+		atomic_store_explicit(&slot->seq, log_dequeue_pos + LOG_RING_SIZE, memory_order_release);
+		log_dequeue_pos++;
+		n++;
+	}
+
+	if(n)
+		logger_flush(0);
+	atomic_fetch_add_explicit(&log_written, n, memory_order_relaxed);
+	return n;
+}
+
+/******************************************
+ * logger_run()
+ * Writer thread: drains the ring into large writes on the log file kept open. The
+ * partial last block is written once its oldest data waited LOG_TAIL_FLUSH_MS, and
+ * when the writer stops.
+ *******************************************/
+static void *logger_run(void *arg)
+{
+	struct timespec deadline;
+
+	(void)arg;
+	flight_recorder_thread_init();
+	while(1) {
+		if(logger_drain())
+			continue;
+		if(atomic_load(&log_stopping))
+			break;
+		if(log_tail_since_ms && logger_now_ms() - log_tail_since_ms >= LOG_TAIL_FLUSH_MS)
+			logger_flush(1);
+
+		// announce that we are about to sleep, then look again: a producer either sees
+		// the flag and posts, or published early enough for this second drain to find it
+		atomic_store(&log_writer_idle, 1);
+		atomic_thread_fence(memory_order_seq_cst);
+		if(logger_drain()) {
+			atomic_store(&log_writer_idle, 0);
+			continue;
+		}
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += LOG_IDLE_WAIT_MS * 1000000L;
+		if(deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		sem_timedwait(&log_wakeup, &deadline);
+		atomic_store(&log_writer_idle, 0);
+	}
+	logger_flush(1);
+	return NULL;
+}
+
+/******************************************
+ * logger_start()
+ * params: - const char* path: base name of the log; segments are <path>.0 ... <path>.<count-1>
+ * 		   - unsigned int segment_count: number of segments in the rotation (2..LOG_SEGMENT_MAX)
+ * 		   - size_t segment_bytes: size of every segment, preallocated (multiple of LOG_BLOCK_BYTES)
+ * return: 0 on success, -1 if a segment could not be created or the writer not started
+ * NOTE: messages logged before logger_start() are kept in the ring (up to LOG_RING_SIZE).
+ *       Logging resumes in the segment after the newest one found, so at most
+ *       segment_count * segment_bytes of flash are ever used.
+ *******************************************/
+int logger_start(const char *path, unsigned int segment_count, size_t segment_bytes)
+{
+	struct log_file_header hdr;
+	char seg_path[PATH_MAX];
+	unsigned int newest = 0;
+	uint64_t newest_seq = 0;
+	unsigned int i;
+	int err;
+
+	if(segment_count < 2 || segment_count > LOG_SEGMENT_MAX ||
+	   segment_bytes % LOG_BLOCK_BYTES || segment_bytes < LOG_BATCH_BYTES)
+		return -1;
+
+	pthread_once(&log_ring_once, logger_ring_init);
+	log_seg_count = segment_count;
+	log_seg_bytes = segment_bytes;
+
+	for(i=0; i<segment_count; i++) {
+		snprintf(seg_path, sizeof(seg_path), "%s.%u", path, i);
+		log_seg_fd[i] = open(seg_path, O_RDWR | O_CREAT, 0644);
+		if(log_seg_fd[i] < 0)
+			goto error;
+
+		// reserve the blocks once; later writes never change the file's size or extents
+		err = fallocate(log_seg_fd[i], 0, 0, segment_bytes);
+		if(err && (errno == EOPNOTSUPP || errno == ENOSYS))
+			err = posix_fallocate(log_seg_fd[i], 0, segment_bytes);
+		if(err) {
+			close(log_seg_fd[i]);
+			goto error;
+		}
+
+		snprintf(seg_path, sizeof(seg_path), "%s.%u.idx", path, i);
+		log_idx_fd[i] = open(seg_path, O_RDWR | O_CREAT, 0644);
+		if(log_idx_fd[i] < 0) {
+			close(log_seg_fd[i]);
+			goto error;
+		}
+
+		if(pread(log_seg_fd[i], &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) &&
+		   hdr.magic == LOG_FORMAT_MAGIC && hdr.segment_seq >= newest_seq) {
+			newest = i;
+			newest_seq = hdr.segment_seq;
+		}
+	}
+	logger_open_segment((newest + 1) % segment_count, newest_seq + 1);
+	if(log_seg_hook && newest_seq)
+		log_seg_hook(newest_seq);
+
+	sem_init(&log_wakeup, 0, 0);
+	if(pthread_create(&log_writer_thread, NULL, &logger_run, NULL))
+		goto error;
+	log_started = 1;
+	// whatever is still in the ring when exit() is called gets written out
+	atexit(logger_stop);
+	return 0;
+
+error:
+	while(i--) {
+		close(log_seg_fd[i]);
+		close(log_idx_fd[i]);
+	}
+	return -1;
+}
+
+/******************************************
+ * logger_set_segment_hook()
+ * params: - void (*hook)(uint64_t seq): called from the writer thread with the sequence
+ *           number of every segment it closes (at start: the newest one found); it
+ *           must not block
+ * NOTE: to be set before logger_start().
+ *******************************************/
+void logger_set_segment_hook(void (*hook)(uint64_t seq))
+{
+	log_seg_hook = hook;
+}
+
+/******************************************
+ * logger_stop()
+ * Writes out the messages still queued and stops the writer thread.
+ *******************************************/
+void logger_stop(void)
+{
+	unsigned int i;
+
+	if(!log_started || atomic_exchange(&log_stopping, 1))
+		return;
+	sem_post(&log_wakeup);
+	pthread_join(log_writer_thread, NULL);
+	for(i=0; i<log_seg_count; i++) {
+		close(log_seg_fd[i]);
+		close(log_idx_fd[i]);
+	}
+}
+
+/******************************************
+ * logger_get_stats()
+ *******************************************/
+void logger_get_stats(struct logger_stats *stats)
+{
+	stats->enqueued = atomic_load_explicit(&log_enqueued, memory_order_relaxed);
+	stats->dropped  = atomic_load_explicit(&log_dropped, memory_order_relaxed);
+	stats->written  = atomic_load_explicit(&log_written, memory_order_relaxed);
+	stats->bytes    = atomic_load_explicit(&log_bytes, memory_order_relaxed);
+}
+
+/******************************************
+ * log_aggregate_add()
+ * Counts one occurrence of a repetitive event instead of logging it.
+ * params: - struct log_aggregate* agg: the event's aggregate
+ * 		   - int64_t value: value of this occurrence, folded into min/max/sum
+ * 		   - time_t now_sec: current time
+ * 		   - unsigned int period_sec: summary period (LOG_SUMMARY_SEC)
+ * return: 1 if the window is 'period_sec' old: the caller logs the summary from 'agg'
+ *         and calls log_aggregate_reset(); 0 otherwise
+ *******************************************/
+int log_aggregate_add(struct log_aggregate *agg, int64_t value, time_t now_sec, unsigned int period_sec)
+{
+	if(agg->count == 0) {
+		agg->start_sec = now_sec;
+		agg->min = agg->max = value;
+		agg->sum = 0;
+	}
+	agg->count++;
+	agg->sum += value;
+	if(value < agg->min)
+		agg->min = value;
+	if(value > agg->max)
+		agg->max = value;
+	return now_sec - agg->start_sec >= (time_t)period_sec;
+}
+
+/******************************************
+ * log_aggregate_reset()
+ * Starts a new window, after its summary has been logged.
+ *******************************************/
+void log_aggregate_reset(struct log_aggregate *agg)
+{
+	memset(agg, 0, sizeof(*agg));
+}
+
+/******************************************
+ * logger_capture_str()
+ * Copies string argument 'n' into the string area of 'slot', truncated if it is full.
+ *******************************************/
+static void logger_capture_str(struct log_slot *slot, unsigned int n, const char *str)
+{
+	size_t len;
+
+	if(str == NULL)
+		str = "(null)";
+	len = strnlen(str, LOG_MAX_STR_LEN);
+	if(len > LOG_STR_BYTES - slot->str_len)
+		len = LOG_STR_BYTES - slot->str_len;
+	memcpy(slot->str + slot->str_len, str, len);
+	slot->arg[n].s.off = (uint16_t)slot->str_len;
+	slot->arg[n].s.len = (uint16_t)len;
+	slot->str_len += len;
+}
+
+/******************************************
+ * logger_capture_args()
+ * Copies the arguments described by the conversions in 'fmt' into 'slot',
+ * fetching each with the type printf would use for it.
+ *******************************************/
+static void logger_capture_args(struct log_slot *slot, const char *fmt, va_list args)
+{
+	struct log_conv conv;
+	const char *p = fmt;
+	unsigned int n = 0;
+	int pass;
+
+	slot->str_len = 0;
+	while(n < LOG_MAX_ARGS && (p = log_format_next_conv(p, &conv)) != NULL) {
+		// '*' width and precision come first, as int arguments
+		for(pass=0; pass<conv.star_width + conv.star_prec && n < LOG_MAX_ARGS; pass++) {
+			slot->tag[n] = LOG_ARG_INT;
+			slot->arg[n++].i = va_arg(args, int);
+		}
+		if(n == LOG_MAX_ARGS)
+			break;
+
+		switch(conv.arg_type) {
+		case LOG_ARG_INT:
+			if(conv.length[0] == 'j' || conv.length[0] == 'q' || strcmp(conv.length, "ll") == 0)
+				slot->arg[n].i = va_arg(args, long long);
+			else if(conv.length[0] == 'l' || conv.length[0] == 'z' || conv.length[0] == 't')
+				slot->arg[n].i = va_arg(args, long);
+			else
+				slot->arg[n].i = va_arg(args, int);
+			break;
+		case LOG_ARG_UINT:
+			if(conv.length[0] == 'j' || conv.length[0] == 'q' || strcmp(conv.length, "ll") == 0)
+				slot->arg[n].u = va_arg(args, unsigned long long);
+			else if(conv.length[0] == 'l' || conv.length[0] == 'z' || conv.length[0] == 't')
+				slot->arg[n].u = va_arg(args, unsigned long);
+			else
+				slot->arg[n].u = va_arg(args, unsigned int);
+			break;
+		case LOG_ARG_DOUBLE:
+			if(conv.length[0] == 'L')
+				slot->arg[n].d = (double)va_arg(args, long double);
+			else
+				slot->arg[n].d = va_arg(args, double);
+			break;
+		case LOG_ARG_PTR:
+			slot->arg[n].u = (uintptr_t)va_arg(args, void *);
+			break;
+		case LOG_ARG_STR:
+			logger_capture_str(slot, n, va_arg(args, const char *));
+			break;
+		default:
+			// "%%" and unsupported conversions take no argument
+			continue;
+		}
+		slot->tag[n++] = (uint8_t)conv.arg_type;
+	}
+	slot->nargs = n;
+}
+
+/******************************************
+ * logger_capture_values()
+ * Like logger_capture_args(), for arguments already captured with their C type.
+ * Each value is stored as the type its conversion in 'fmt' asks for, which is
+ * what the decoder expects; missing values are logged as 0 / "".
+ *******************************************/
+static void logger_capture_values(struct log_slot *slot, const char *fmt, const struct log_value *values, unsigned int count)
+{
+	static const struct log_value none;
+	const struct log_value *v;
+	struct log_conv conv;
+	const char *p = fmt;
+	unsigned int n = 0, next = 0;
+	int pass, type;
+
+	slot->str_len = 0;
+	while(n < LOG_MAX_ARGS && (p = log_format_next_conv(p, &conv)) != NULL) {
+		for(pass=0; pass<=conv.star_width + conv.star_prec && n < LOG_MAX_ARGS; pass++) {
+			// '*' width and precision come first, as int arguments
+			type = pass < conv.star_width + conv.star_prec ? LOG_ARG_INT : conv.arg_type;
+			if(type == 0)
+				break;
+			v = next < count ? &values[next++] : &none;
+
+			switch(type) {
+			case LOG_ARG_INT:
+				slot->arg[n].i = v->type == LOG_ARG_DOUBLE ? (int64_t)v->v.d : v->v.i;
+				break;
+			case LOG_ARG_UINT:
+			case LOG_ARG_PTR:
+				slot->arg[n].u = v->type == LOG_ARG_DOUBLE ? (uint64_t)v->v.d : v->v.u;
+				break;
+			case LOG_ARG_DOUBLE:
+				if(v->type == LOG_ARG_DOUBLE)
+					slot->arg[n].d = v->v.d;
+				else if(v->type == LOG_ARG_INT)
+					slot->arg[n].d = (double)v->v.i;
+				else
+					slot->arg[n].d = (double)v->v.u;
+				break;
+			case LOG_ARG_STR:
+				logger_capture_str(slot, n, v->type == LOG_ARG_STR ? v->v.s : "");
+				break;
+			}
+			slot->tag[n++] = (uint8_t)type;
+		}
+	}
+	slot->nargs = n;
+}
+
+/******************************************
+ * logger_claim()
+ * Claims the next ring slot for a producer.
+ * return: the slot, its position in 'pos'; NULL if the message has to be dropped
+ *******************************************/
+static struct log_slot *logger_claim(unsigned int *pos)
+{
+	struct log_slot *slot;
+	unsigned int seq;
+	unsigned int retries = 0;
+
+	if(!atomic_load_explicit(&log_ring_ready, memory_order_acquire))
+		pthread_once(&log_ring_once, logger_ring_init);
+
+	*pos = atomic_load_explicit(&log_enqueue_pos, memory_order_relaxed);
+	while(1) {
+		slot = &log_ring[*pos & (LOG_RING_SIZE - 1)];
+		seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		if(seq == *pos) {
+			if(atomic_compare_exchange_weak_explicit(&log_enqueue_pos, pos, *pos + 1,
+													 memory_order_relaxed, memory_order_relaxed))
+				return slot;
+		} else if((int)(seq - *pos) < 0) {
+			// the writer is a full lap behind: give it a moment, then drop the message
+			if(retries++ == LOG_FULL_RETRIES) {
+				atomic_fetch_add_explicit(&log_dropped, 1, memory_order_relaxed);
+				return NULL;
+			}
+			if(atomic_exchange(&log_writer_idle, 0))
+				sem_post(&log_wakeup);
+			sched_yield();
+			*pos = atomic_load_explicit(&log_enqueue_pos, memory_order_relaxed);
+		} else {
+			*pos = atomic_load_explicit(&log_enqueue_pos, memory_order_relaxed);
+		}
+	}
+}
+
+/******************************************
+ * logger_publish()
+ * Hands a filled slot over to the writer, waking it up if it sleeps.
+ *******************************************/
+static void logger_publish(struct log_slot *slot, unsigned int pos)
+{
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+	atomic_fetch_add_explicit(&log_enqueued, 1, memory_order_relaxed);
+
+	atomic_thread_fence(memory_order_seq_cst);
+	if(atomic_load_explicit(&log_writer_idle, memory_order_relaxed) &&
+	   atomic_exchange(&log_writer_idle, 0))
+		sem_post(&log_wakeup);
+}
+
+/******************************************
+ * logger_log()
+ * Backend of the LOG_*() macros in logger.h.
+ * params: - unsigned int task_id: id of the calling task, 0 for the main thread
+ * 		   - const char* fmt: printf format, a string literal
+ * 		   - const struct log_value* values: the arguments, captured by type
+ * 		   - unsigned int count: number of elements in 'values'
+ *******************************************/
+void logger_log(unsigned int task_id, const char *fmt, const struct log_value *values, unsigned int count)
+{
+	struct log_slot *slot;
+	unsigned int pos;
+
+	slot = logger_claim(&pos);
+	if(slot == NULL)
+		return;
+	slot->task_id       = task_id;
+	slot->timestamp_sec = time(NULL);
+	slot->fmt           = fmt;
+	logger_capture_values(slot, fmt, values, count);
+	logger_publish(slot, pos);
+	VG_PROBE2(log_enqueue, task_id, fmt);
+}
+
+/******************************************
+ * print_safe()
+ * params: - unsigned int task_id: id of the taks calling this function;
+ * 								 primarily used for identifiying the thread in case of failure
+ * 		   - pthread_mutex_t* mutex: no longer used; the log ring is lock-free
+ * 		   - char* msg: pointer to the string to be written to logfile
+ * 		   - int argn: number of arguments given in the elipses ('...') argument
+ * 		   - ... : variable number of arguments (the number of arguments passed should match 'argn' parameter)
+ * NOTE: only the raw arguments are queued here; the writer thread stores them in the
+ *       binary log and tools/log_decode formats them offline. If the ring stays full for LOG_FULL_RETRIES yields the message
+ *       is dropped and counted.
+ *       Kept for older callers: the LOG_*() macros check the arguments at compile time.
+ *******************************************/
+void print_safe(unsigned int task_id, pthread_mutex_t* mutex, char* msg, int argn, ...)
+{
+	struct log_slot *slot;
+	unsigned int pos;
+	va_list args;
+
+	(void)mutex;
+	slot = logger_claim(&pos);
+	if(slot == NULL)
+		return;
+
+	// fill it in: raw arguments only, typed after the conversions in 'msg'
+	slot->task_id       = task_id;
+	slot->timestamp_sec = time(NULL);
+	slot->fmt           = msg;
+	va_start(args, argn);
+	logger_capture_args(slot, msg, args);
+	va_end(args);
+
+	logger_publish(slot, pos);
+	VG_PROBE2(log_enqueue, task_id, msg);
+}
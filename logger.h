@@ -0,0 +1,178 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include "log_format.h"
+
+/******************************************
+ *                Defines
+ *******************************************/
+// binary log, written to rotating segments log_file.bin.0 ... log_file.bin.<LOG_SEGMENT_COUNT-1>;
+// "tools/log_decode log_file.bin.* > log_file.csv" gives the text layout
+#define LOG_FILE "log_file.bin"
+#define LOG_SEGMENT_COUNT 8
+#define LOG_SEGMENT_BYTES (4 * 1024 * 1024)
+#define LOG_SEGMENT_MAX   64
+#define LOG_BLOCK_BYTES   4096        // writes are aligned to and sized in this unit
+#define LOG_INDEX_PENDING 256         // index entries buffered by the writer between writes
+#define LOG_INDEX_TASKS   64          // tasks with their own index entries (ids 0..LOG_INDEX_TASKS-1)
+
+#define LOG_RING_SIZE     1024        // messages buffered between the producers and the writer (power of 2)
+#define LOG_STR_BYTES     128         // room for the string arguments of one message
+#define LOG_DICT_SIZE     512         // format strings tracked by the writer (power of 2)
+#define LOG_MAX_FMT_LEN   1024        // longest format string stored
+// worst case size of one message in the file: DICT + EVENT record
+#define LOG_MAX_ENCODED   (2 + 5 * LOG_VARINT_MAX + LOG_MAX_FMT_LEN + LOG_MAX_ARGS * LOG_VARINT_MAX + LOG_STR_BYTES)
+#define LOG_BATCH_BYTES   (64 * 1024) // the writer issues one write() per this many bytes at most
+#define LOG_IDLE_WAIT_MS  100         // writer wake-up period when nobody signals it
+#define LOG_TAIL_FLUSH_MS 5000        // a partial block is written at most this long after its first data
+#define LOG_FULL_RETRIES  64          // yields a producer waits for a free slot before dropping
+#define LOG_SUMMARY_SEC   3600        // repetitive events are logged as one summary this often
+
+// log levels; calls above LOG_COMPILE_LEVEL are compiled out (-DLOG_COMPILE_LEVEL=LOG_LEVEL_DEBUG
+// for a debug build), but their format and arguments are still type checked
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN  1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_DEBUG 3
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#endif
+
+/******************************************
+ *              Data Types
+ *******************************************/
+struct logger_stats {
+	unsigned long enqueued; // messages accepted into the ring
+	unsigned long dropped;  // messages lost because the ring was full
+	unsigned long written;  // messages written to the log file
+	unsigned long bytes;    // bytes written to the log segments, block padding included
+};
+
+// A repetitive event collapsed into a periodic summary: count and min/max/sum of one value.
+// Owned by one thread (e.g. on the stack of a task thread), so it needs no locking.
+struct log_aggregate {
+	time_t       start_sec; // first event of the window, 0 while empty
+	unsigned int count;
+	int64_t      min;
+	int64_t      max;
+	int64_t      sum;
+};
+
+// one argument of a LOG_*() call, captured with its C type
+struct log_value {
+	uint8_t type; // LOG_ARG_*, 0 ends the list
+	union {
+		int64_t     i;
+		uint64_t    u;
+		double      d;
+		const char *s;
+	} v;
+};
+
+/******************************************
+ *             Global Variables
+ *******************************************/
+extern pthread_mutex_t logfile_mutex;
+
+/******************************************
+ *            Function Prototypes
+ *******************************************/
+int  logger_start(const char *path, unsigned int segment_count, size_t segment_bytes);
+void logger_stop(void);
+void logger_set_segment_hook(void (*hook)(uint64_t seq));
+void logger_get_stats(struct logger_stats *stats);
+int  log_aggregate_add(struct log_aggregate *agg, int64_t value, time_t now_sec, unsigned int period_sec);
+void log_aggregate_reset(struct log_aggregate *agg);
+void logger_log(unsigned int task_id, const char *fmt, const struct log_value *values, unsigned int count);
+void print_safe(unsigned int task_id, pthread_mutex_t* mutex, char* msg, int argn, ...);
+
+/******************************************
+ *              Typed logging
+ * LOG_ERROR/LOG_WARN/LOG_INFO/LOG_DEBUG(task_id, format, args...)
+ * The format is checked against the arguments by the compiler (-Wformat), every
+ * argument is captured after its own type (no varargs, no argument count) and the
+ * format must be a string literal: the writer keeps it by address.
+ *******************************************/
+#define LOG_ERROR(task_id, ...) LOG_AT(LOG_LEVEL_ERROR, task_id, __VA_ARGS__)
+#define LOG_WARN(task_id, ...)  LOG_AT(LOG_LEVEL_WARN, task_id, __VA_ARGS__)
+#define LOG_INFO(task_id, ...)  LOG_AT(LOG_LEVEL_INFO, task_id, __VA_ARGS__)
+#define LOG_DEBUG(task_id, ...) LOG_AT(LOG_LEVEL_DEBUG, task_id, __VA_ARGS__)
+
+#define LOG_AT(level, task_id, ...) do { \
+	if(0) \
+		log_format_check(__VA_ARGS__); \
+	if((level) <= LOG_COMPILE_LEVEL) \
+		logger_log((task_id), LOG_FIRST(__VA_ARGS__), \
+		           (const struct log_value[]){ LOG_CAT(LOG_VALUES_, LOG_COUNT(__VA_ARGS__))(__VA_ARGS__) { 0 } }, \
+		           LOG_COUNT(__VA_ARGS__) - 1); \
+} while(0)
+
+#define LOG_VALUE(x) _Generic((x), \
+	char *: log_value_str, const char *: log_value_str, \
+	float: log_value_double, double: log_value_double, long double: log_value_double, \
+	char: log_value_int, signed char: log_value_int, short: log_value_int, int: log_value_int, \
+	long: log_value_int, long long: log_value_int, \
+	_Bool: log_value_uint, unsigned char: log_value_uint, unsigned short: log_value_uint, \
+	unsigned int: log_value_uint, unsigned long: log_value_uint, unsigned long long: log_value_uint, \
+	default: log_value_ptr)(x)
+
+// argument list helpers, for up to LOG_MAX_ARGS arguments after the format
+#define LOG_CAT_(a, b) a##b
+#define LOG_CAT(a, b)  LOG_CAT_(a, b)
+#define LOG_FIRST(...) LOG_FIRST_(__VA_ARGS__, ~)
+#define LOG_FIRST_(first, ...) first
+#define LOG_COUNT(...) LOG_COUNT_(__VA_ARGS__, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, ~)
+#define LOG_COUNT_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, n, ...) n
+#define LOG_VALUES_1(f)
+#define LOG_VALUES_2(f, a)       LOG_VALUE(a),
+#define LOG_VALUES_3(f, a, ...)  LOG_VALUE(a), LOG_VALUES_2(f, __VA_ARGS__)
+#define LOG_VALUES_4(f, a, ...)  LOG_VALUE(a), LOG_VALUES_3(f, __VA_ARGS__)
+#define LOG_VALUES_5(f, a, ...)  LOG_VALUE(a), LOG_VALUES_4(f, __VA_ARGS__)
+#define LOG_VALUES_6(f, a, ...)  LOG_VALUE(a), LOG_VALUES_5(f, __VA_ARGS__)
+#define LOG_VALUES_7(f, a, ...)  LOG_VALUE(a), LOG_VALUES_6(f, __VA_ARGS__)
+#define LOG_VALUES_8(f, a, ...)  LOG_VALUE(a), LOG_VALUES_7(f, __VA_ARGS__)
+#define LOG_VALUES_9(f, a, ...)  LOG_VALUE(a), LOG_VALUES_8(f, __VA_ARGS__)
+#define LOG_VALUES_10(f, a, ...) LOG_VALUE(a), LOG_VALUES_9(f, __VA_ARGS__)
+#define LOG_VALUES_11(f, a, ...) LOG_VALUE(a), LOG_VALUES_10(f, __VA_ARGS__)
+#define LOG_VALUES_12(f, a, ...) LOG_VALUE(a), LOG_VALUES_11(f, __VA_ARGS__)
+#define LOG_VALUES_13(f, a, ...) LOG_VALUE(a), LOG_VALUES_12(f, __VA_ARGS__)
+
+// never called: only there for the compiler's printf format check
+__attribute__((format(printf, 1, 2)))
+static inline void log_format_check(const char *fmt, ...) { (void)fmt; }
+
+static inline struct log_value log_value_int(long long x)
+{
+	struct log_value v = { LOG_ARG_INT, { .i = x } };
+	return v;
+}
+
+static inline struct log_value log_value_uint(unsigned long long x)
+{
+	struct log_value v = { LOG_ARG_UINT, { .u = x } };
+	return v;
+}
+
+static inline struct log_value log_value_double(long double x)
+{
+	struct log_value v = { LOG_ARG_DOUBLE, { .d = (double)x } };
+	return v;
+}
+
+static inline struct log_value log_value_str(const char *x)
+{
+	struct log_value v = { LOG_ARG_STR, { .s = x } };
+	return v;
+}
+
+static inline struct log_value log_value_ptr(const void *x)
+{
+	struct log_value v = { LOG_ARG_PTR, { .u = (uintptr_t)x } };
+	return v;
+}
+
+#endif /* LOGGER_H */
@@ -0,0 +1,437 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "flight_recorder.h"
+#include "jitter_hist.h"
+#include "logger.h"
+#include "metrics.h"
+#include "water_ledger.h"
+
+/******************************************
+ *              Data Types
+ *******************************************/
+// Everything one thread updates, on cache lines of its own: the hot paths are relaxed
+// atomic adds on memory no other thread writes. Only a scrape walks all the slots.
+struct metrics_slot {
+	_Alignas(64) atomic_ullong counters[METRIC_COUNTERS][METRICS_LABELS];
+	atomic_ullong  buckets[METRIC_HISTS][METRICS_HIST_BOUNDS + 1]; // the last one is +Inf
+	_Atomic double sum[METRIC_HISTS];
+};
+
+struct metrics_def {
+	const char *name;
+	const char *help;
+	const char *label;  // label name, NULL if the metric has none
+};
+
+struct metrics_hist_def {
+	const char *name;
+	const char *help;
+	double      bounds[METRICS_HIST_BOUNDS];
+};
+
+/******************************************
+ *            Global Variables
+ *******************************************/
+static struct metrics_slot metrics_slots[METRICS_SLOTS];
+static atomic_uint         metrics_slots_used;
+static _Thread_local struct metrics_slot *metrics_my_slot;
+static atomic_llong        metrics_gauges[METRIC_GAUGES];
+
+static const struct metrics_def metrics_counter_defs[METRIC_COUNTERS] = {
+	[METRIC_TASK_FIRINGS]   = { "vg_task_firings_total",   "Irrigation runs started.", "task" },
+	[METRIC_TASK_MISSED]    = { "vg_task_missed_total",    "Planned runs skipped because the task woke up too late.", "task" },
+	[METRIC_TASK_FAILED]    = { "vg_task_failed_total",    "Runs that could not open the valve.", "task" },
+	[METRIC_GPIO_WRITES]    = { "vg_gpio_writes_total",    "Valve GPIO level changes.", NULL },
+	[METRIC_STORAGE_ERRORS] = { "vg_storage_errors_total", "Failed schedule loads and history writes.", NULL },
+	[METRIC_TASK_CPU_US]      = { "vg_task_cpu_microseconds_total", "CPU time of the task thread.", "task" },
+	[METRIC_TASK_SCHEDULE_US] = { "vg_task_schedule_microseconds_total", "Wall time spent working out the next action.", "task" },
+	[METRIC_TASK_ACTUATE_US]  = { "vg_task_actuate_microseconds_total", "Wall time spent driving the valve and recording the run, valve open time excluded.", "task" },
+	[METRIC_TASK_LOG_US]      = { "vg_task_log_microseconds_total", "Wall time spent on metrics and logging before sleeping.", "task" },
+};
+
+static const struct metrics_def metrics_gauge_defs[METRIC_GAUGES] = {
+	[METRIC_TASKS_SCHEDULED] = { "vg_tasks_scheduled", "Tasks in the active schedule.", NULL },
+};
+
+// unused bounds stay 0 and end the list
+static const struct metrics_hist_def metrics_hist_defs[METRIC_HISTS] = {
+	[METRIC_SLEEP_SEC]        = { "vg_task_sleep_seconds", "Task thread sleep durations.",
+								  { 1, 5, 15, 30, 60, 300, 900, 3600, 14400, 86400 } },
+	[METRIC_STORAGE_LOAD_MS]  = { "vg_storage_load_milliseconds", "Schedule load latency.",
+								  { 1, 5, 10, 25, 50, 100, 250, 1000, 5000, 10000 } },
+	[METRIC_STORAGE_WRITE_MS] = { "vg_storage_write_milliseconds", "History write latency.",
+								  { 1, 5, 10, 25, 50, 100, 250, 1000, 5000, 10000 } },
+	[METRIC_TASK_BUSY_US]     = { "vg_task_busy_microseconds", "Wall time of one task loop iteration outside its sleeps.",
+								  { 10, 50, 100, 250, 500, 1000, 5000, 10000, 50000, 100000 } },
+};
+
+/******************************************
+ * metrics_slot()
+ * return: the calling thread's slot, claimed on its first update
+ *******************************************/
+static struct metrics_slot *metrics_slot(void)
+{
+	unsigned int n;
+
+	if(metrics_my_slot == NULL) {
+		n = atomic_fetch_add_explicit(&metrics_slots_used, 1, memory_order_relaxed);
+		metrics_my_slot = &metrics_slots[n < METRICS_SLOTS ? n : METRICS_SLOTS - 1];
+	}
+	return metrics_my_slot;
+}
+
+/******************************************
+ * metrics_inc()
+ * params: - enum metrics_counter id: counter to be increased
+ * 		   - unsigned int label: task id for labelled counters, 0 otherwise; ids from
+ * 		     METRICS_LABELS-1 up share the last slot, served as task="other"
+ * 		   - uint64_t n: increment
+ *******************************************/
+void metrics_inc(enum metrics_counter id, unsigned int label, uint64_t n)
+{
+	if(label >= METRICS_LABELS)
+		label = METRICS_LABELS - 1;
+	atomic_fetch_add_explicit(&metrics_slot()->counters[id][label], n, memory_order_relaxed);
+}
+
+/******************************************
+ * metrics_observe()
+ * Adds one sample to a histogram.
+ *******************************************/
+void metrics_observe(enum metrics_hist id, double value)
+{
+	const double *bounds = metrics_hist_defs[id].bounds;
+	struct metrics_slot *slot = metrics_slot();
+	double sum;
+	unsigned int b;
+
+	for(b=0; b<METRICS_HIST_BOUNDS && bounds[b] != 0 && value > bounds[b]; b++)
+		;
+	if(b < METRICS_HIST_BOUNDS && bounds[b] == 0)
+		b = METRICS_HIST_BOUNDS;
+	atomic_fetch_add_explicit(&slot->buckets[id][b], 1, memory_order_relaxed);
+
+	// the slot may be shared by late threads: a CAS keeps the sum exact anyway
+	sum = atomic_load_explicit(&slot->sum[id], memory_order_relaxed);
+	while(!atomic_compare_exchange_weak_explicit(&slot->sum[id], &sum, sum + value,
+												 memory_order_relaxed, memory_order_relaxed))
+		;
+}
+
+/******************************************
+ * metrics_gauge_set()
+ *******************************************/
+void metrics_gauge_set(enum metrics_gauge id, int64_t value)
+{
+	atomic_store_explicit(&metrics_gauges[id], value, memory_order_relaxed);
+}
+
+/******************************************
+ * metrics_append()
+ * snprintf() to the end of 'buf', keeping track of its length; output past 'size' is cut.
+ *******************************************/
+static void metrics_append(char *buf, unsigned int size, unsigned int *len, const char *fmt, ...)
+{
+	va_list args;
+	int ret;
+
+	if(*len >= size)
+		return;
+	va_start(args, fmt);
+	ret = vsnprintf(buf + *len, size - *len, fmt, args);
+	va_end(args);
+	if(ret > 0)
+		*len = *len + ret < size ? *len + ret : size - 1;
+}
+
+/******************************************
+ * metrics_render_water()
+ * Appends today's run count, open time and volume per task and per valve GPIO.
+ *******************************************/
+static void metrics_render_water(char *buf, unsigned int size, unsigned int *len)
+{
+	static const struct {
+		const char *name;
+		const char *help;
+	} defs[3] = {
+		{ "vg_water_runs_today",         "Valve runs since local midnight." },
+		{ "vg_water_open_seconds_today", "Valve open time since local midnight." },
+		{ "vg_water_volume_liters_today","Estimated water volume since local midnight." },
+	};
+	struct water_usage tasks[WATER_TASKS], pins[WATER_PINS];
+	const struct water_usage *u;
+	double value;
+	unsigned int d, i;
+
+	water_ledger_today(tasks, pins);
+	for(d=0; d<3; d++) {
+		metrics_append(buf, size, len, "# HELP %s %s\n# TYPE %s gauge\n", defs[d].name, defs[d].help, defs[d].name);
+		for(i=0; i<WATER_TASKS + WATER_PINS; i++) {
+			u = i < WATER_TASKS ? &tasks[i] : &pins[i - WATER_TASKS];
+			if(u->runs == 0)
+				continue;
+			value = d == 0 ? u->runs : d == 1 ? u->open_sec : u->volume_ml / 1000.0;
+			metrics_append(buf, size, len, "%s{%s=\"%u\"} %g\n", defs[d].name, i < WATER_TASKS ? "task" : "gpio",
+						   i < WATER_TASKS ? i : i - WATER_TASKS, value);
+		}
+	}
+}
+
+/******************************************
+ * metrics_render_jitter()
+ * Appends every task's wake-up lateness since the start as a histogram and its max.
+ * jitter_totals() clears nothing, so both endpoints and retried scrapes see the same
+ * monotonic counts.
+ *******************************************/
+static void metrics_render_jitter(char *buf, unsigned int size, unsigned int *len)
+{
+	static const uint32_t bounds[METRICS_HIST_BOUNDS] = {
+		100, 1000, 5000, 10000, 50000, 100000, 500000, 1000000, 5000000, 60000000
+	};
+	static struct jitter_snapshot totals[JITTER_TASKS]; // scrapes are served one at a time
+	unsigned int b, t;
+
+	for(t=0; t<JITTER_TASKS; t++)
+		jitter_totals(t, &totals[t]);
+
+	metrics_append(buf, size, len, "# HELP vg_task_wakeup_late_microseconds Wake-up lateness against the planned "
+				   "wake-up (bounds rounded down to the ~6%% resolution of the recorder).\n"
+				   "# TYPE vg_task_wakeup_late_microseconds histogram\n");
+	for(t=0; t<JITTER_TASKS; t++) {
+		if(totals[t].count == 0)
+			continue;
+		for(b=0; b<METRICS_HIST_BOUNDS; b++)
+			metrics_append(buf, size, len, "vg_task_wakeup_late_microseconds_bucket{task=\"%u\",le=\"%u\"} %u\n",
+						   t, bounds[b], jitter_count_le(&totals[t], bounds[b]));
+		metrics_append(buf, size, len, "vg_task_wakeup_late_microseconds_bucket{task=\"%u\",le=\"+Inf\"} %u\n"
+					   "vg_task_wakeup_late_microseconds_sum{task=\"%u\"} %llu\n"
+					   "vg_task_wakeup_late_microseconds_count{task=\"%u\"} %u\n",
+					   t, totals[t].count, t, (unsigned long long)totals[t].sum_us, t, totals[t].count);
+	}
+
+	metrics_append(buf, size, len, "# HELP vg_task_wakeup_late_max_microseconds Largest wake-up lateness since the start.\n"
+				   "# TYPE vg_task_wakeup_late_max_microseconds gauge\n");
+	for(t=0; t<JITTER_TASKS; t++)
+		if(totals[t].count)
+			metrics_append(buf, size, len, "vg_task_wakeup_late_max_microseconds{task=\"%u\"} %u\n", t, totals[t].max_us);
+}
+
+/******************************************
+ * metrics_render()
+ * Sums all the thread slots and writes the metrics in the Prometheus text format.
+ * params: - char* buf: output buffer
+ * 		   - unsigned int size: size of 'buf'
+ * return: length of the text in 'buf'
+ *******************************************/
+int metrics_render(char *buf, unsigned int size)
+{
+	unsigned long long total[METRICS_LABELS], cumulative;
+	unsigned long long buckets[METRICS_HIST_BOUNDS + 1];
+	const struct metrics_hist_def *hd;
+	struct logger_stats log_stats;
+	unsigned int len = 0;
+	unsigned int id, s, l, b;
+	double sum;
+
+	buf[0] = '\0';
+	for(id=0; id<METRIC_COUNTERS; id++) {
+		memset(total, 0, sizeof(total));
+		for(s=0; s<METRICS_SLOTS; s++)
+			for(l=0; l<METRICS_LABELS; l++)
+				total[l] += atomic_load_explicit(&metrics_slots[s].counters[id][l], memory_order_relaxed);
+
+		if(metrics_counter_defs[id].label == NULL) {
+			metrics_append(buf, size, &len, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+						   metrics_counter_defs[id].name, metrics_counter_defs[id].help, metrics_counter_defs[id].name,
+						   metrics_counter_defs[id].name, total[0]);
+			continue;
+		}
+		metrics_append(buf, size, &len, "# HELP %s %s Task ids from %u up are summed as %s=\"other\".\n# TYPE %s counter\n",
+					   metrics_counter_defs[id].name, metrics_counter_defs[id].help, METRICS_LABELS - 1,
+					   metrics_counter_defs[id].label, metrics_counter_defs[id].name);
+		for(l=0; l<METRICS_LABELS - 1; l++)
+			if(total[l])
+				metrics_append(buf, size, &len, "%s{%s=\"%u\"} %llu\n", metrics_counter_defs[id].name,
+							   metrics_counter_defs[id].label, l, total[l]);
+		if(total[METRICS_LABELS - 1])
+			metrics_append(buf, size, &len, "%s{%s=\"other\"} %llu\n", metrics_counter_defs[id].name,
+						   metrics_counter_defs[id].label, total[METRICS_LABELS - 1]);
+	}
+
+	for(id=0; id<METRIC_GAUGES; id++)
+		metrics_append(buf, size, &len, "# HELP %s %s\n# TYPE %s gauge\n%s %lld\n",
+					   metrics_gauge_defs[id].name, metrics_gauge_defs[id].help, metrics_gauge_defs[id].name,
+					   metrics_gauge_defs[id].name, (long long)atomic_load(&metrics_gauges[id]));
+
+	for(id=0; id<METRIC_HISTS; id++) {
+		hd = &metrics_hist_defs[id];
+		memset(buckets, 0, sizeof(buckets));
+		sum = 0;
+		for(s=0; s<METRICS_SLOTS; s++) {
+			for(b=0; b<=METRICS_HIST_BOUNDS; b++)
+				buckets[b] += atomic_load_explicit(&metrics_slots[s].buckets[id][b], memory_order_relaxed);
+			sum += atomic_load_explicit(&metrics_slots[s].sum[id], memory_order_relaxed);
+		}
+
+		metrics_append(buf, size, &len, "# HELP %s %s\n# TYPE %s histogram\n", hd->name, hd->help, hd->name);
+		cumulative = 0;
+		for(b=0; b<METRICS_HIST_BOUNDS && hd->bounds[b] != 0; b++) {
+			cumulative += buckets[b];
+			metrics_append(buf, size, &len, "%s_bucket{le=\"%g\"} %llu\n", hd->name, hd->bounds[b], cumulative);
+		}
+		cumulative += buckets[METRICS_HIST_BOUNDS];
+		metrics_append(buf, size, &len, "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %g\n%s_count %llu\n",
+					   hd->name, cumulative, hd->name, sum, hd->name, cumulative);
+	}
+
+	// valves: today's totals, kept by water_ledger.c
+	metrics_render_water(buf, size, &len);
+
+	// task wake-up lateness, kept by jitter_hist.c
+	metrics_render_jitter(buf, size, &len);
+
+	// logger: read from its own counters, nothing to do on the logging path
+	logger_get_stats(&log_stats);
+	metrics_append(buf, size, &len,
+				   "# HELP vg_log_queue_depth Messages waiting for the log writer.\n# TYPE vg_log_queue_depth gauge\n"
+				   "vg_log_queue_depth %lu\n"
+				   "# HELP vg_log_messages_total Messages accepted by the logger.\n# TYPE vg_log_messages_total counter\n"
+				   "vg_log_messages_total %lu\n"
+				   "# HELP vg_log_dropped_total Messages dropped because the log queue was full.\n# TYPE vg_log_dropped_total counter\n"
+				   "vg_log_dropped_total %lu\n"
+				   "# HELP vg_log_bytes_total Bytes written to the log segments.\n# TYPE vg_log_bytes_total counter\n"
+				   "vg_log_bytes_total %lu\n",
+				   log_stats.enqueued - log_stats.written, log_stats.enqueued, log_stats.dropped, log_stats.bytes);
+	return len;
+}
+
+/******************************************
+ * metrics_serve()
+ * Answers one client: an HTTP request gets a response header first, a plain
+ * connection (Unix socket) just the text.
+ *******************************************/
+static void metrics_serve(int fd, int http)
+{
+	static char text[METRICS_TEXT_BYTES];
+	char header[160];
+	char request[1024];
+	struct timeval tv = { 1, 0 };
+	ssize_t ret;
+	int len, hlen = 0;
+	size_t done;
+
+	if(http) {
+		// read the request (its content is not needed); clients that say nothing get cut off
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		ret = recv(fd, request, sizeof(request) - 1, 0);
+		if(ret <= 0)
+			return;
+	}
+	len = metrics_render(text, sizeof(text));
+	if(http)
+		hlen = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+						"Content-Length: %d\r\nConnection: close\r\n\r\n", len);
+
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	if(hlen && send(fd, header, hlen, MSG_NOSIGNAL) != hlen)
+		return;
+	for(done=0; done<(size_t)len; done+=ret) {
+		ret = send(fd, text + done, len - done, MSG_NOSIGNAL);
+		if(ret <= 0)
+			return;
+	}
+}
+
+/******************************************
+ * metrics_run()
+ * Metrics server thread: one client at a time, scrapes are rare and cheap.
+ *******************************************/
+static void *metrics_run(void *arg)
+{
+	struct pollfd *fds = arg;
+	unsigned int i;
+	int fd;
+
+	flight_recorder_thread_init();
+	while(1) {
+		if(poll(fds, 2, -1) < 0) {
+			if(errno == EINTR)
+				continue;
+			return NULL;
+		}
+		for(i=0; i<2; i++) {
+			if(fds[i].fd < 0 || !(fds[i].revents & POLLIN))
+				continue;
+			fd = accept(fds[i].fd, NULL, NULL);
+			if(fd < 0)
+				continue;
+			metrics_serve(fd, i == 1);
+			close(fd);
+		}
+	}
+	return NULL;
+}
+
+/******************************************
+ * metrics_start()
+ * params: - const char* socket_path: Unix socket to listen on, NULL for none
+ * 		   - unsigned short http_port: port on 127.0.0.1 for HTTP, 0 for none
+ * return: 0 if at least one endpoint listens and the server thread runs, -1 otherwise
+ *******************************************/
+int metrics_start(const char *socket_path, unsigned short http_port)
+{
+	static struct pollfd fds[2];
+	struct sockaddr_un un;
+	struct sockaddr_in in;
+	pthread_t thread;
+	int one = 1;
+
+	fds[0].fd = fds[1].fd = -1;
+	fds[0].events = fds[1].events = POLLIN;
+
+	if(socket_path && strlen(socket_path) < sizeof(un.sun_path)) {
+		memset(&un, 0, sizeof(un));
+		un.sun_family = AF_UNIX;
+		strcpy(un.sun_path, socket_path);
+		unlink(socket_path);
+		fds[0].fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if(fds[0].fd >= 0 &&
+		   (bind(fds[0].fd, (struct sockaddr *)&un, sizeof(un)) || listen(fds[0].fd, 4))) {
+			close(fds[0].fd);
+			fds[0].fd = -1;
+		}
+	}
+
+	if(http_port) {
+		memset(&in, 0, sizeof(in));
+		in.sin_family = AF_INET;
+		in.sin_port = htons(http_port);
+		in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		fds[1].fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if(fds[1].fd >= 0)
+			setsockopt(fds[1].fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if(fds[1].fd >= 0 &&
+		   (bind(fds[1].fd, (struct sockaddr *)&in, sizeof(in)) || listen(fds[1].fd, 4))) {
+			close(fds[1].fd);
+			fds[1].fd = -1;
+		}
+	}
+
+	if(fds[0].fd < 0 && fds[1].fd < 0)
+		return -1;
+	if(pthread_create(&thread, NULL, &metrics_run, fds))
+		return -1;
+	pthread_detach(thread);
+	return 0;
+}
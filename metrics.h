@@ -0,0 +1,53 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+/******************************************
+ *                Defines
+ *******************************************/
+#define METRICS_SOCKET      "vertical_garden.metrics.sock" // plain text on connect
+#define METRICS_HTTP_PORT   9464                           // http://127.0.0.1:9464/metrics
+#define METRICS_SLOTS       32   // per-thread slots; threads beyond share the last one
+#define METRICS_LABELS      16   // label values per labelled metric: task ids 0..14, the last is "other"
+#define METRICS_HIST_BOUNDS 10   // finite bucket bounds per histogram (+Inf comes on top)
+#define METRICS_TEXT_BYTES  (32 * 1024)
+
+// counters, labelled by task id where it makes sense
+enum metrics_counter {
+	METRIC_TASK_FIRINGS,    // per task: runs started
+	METRIC_TASK_MISSED,     // per task: planned runs skipped because the thread woke too late
+	METRIC_TASK_FAILED,     // per task: runs that could not open the valve
+	METRIC_GPIO_WRITES,     // valve GPIO level changes
+	METRIC_STORAGE_ERRORS,  // failed schedule loads / history writes
+	METRIC_TASK_CPU_US,     // per task: CPU time of the task thread (CLOCK_THREAD_CPUTIME_ID)
+	METRIC_TASK_SCHEDULE_US,// per task: wall time spent working out the next action
+	METRIC_TASK_ACTUATE_US, // per task: wall time spent in execute_task(), valve open time excluded
+	METRIC_TASK_LOG_US,     // per task: wall time spent on metrics and logging before sleeping
+	METRIC_COUNTERS
+};
+
+// gauges: set rarely, kept once for the whole process
+enum metrics_gauge {
+	METRIC_TASKS_SCHEDULED, // tasks in the active schedule
+	METRIC_GAUGES
+};
+
+enum metrics_hist {
+	METRIC_SLEEP_SEC,       // task thread sleep durations
+	METRIC_STORAGE_LOAD_MS, // schedule load latency
+	METRIC_STORAGE_WRITE_MS,// history write latency
+	METRIC_TASK_BUSY_US,    // wall time of one task loop iteration outside its sleeps
+	METRIC_HISTS
+};
+
+/******************************************
+ *            Function Prototypes
+ *******************************************/
+void metrics_inc(enum metrics_counter id, unsigned int label, uint64_t n);
+void metrics_observe(enum metrics_hist id, double value);
+void metrics_gauge_set(enum metrics_gauge id, int64_t value);
+int  metrics_render(char *buf, unsigned int size);
+int  metrics_start(const char *socket_path, unsigned short http_port);
+
+#endif /* METRICS_H */
@@ -0,0 +1,29 @@
+#ifndef PERIODIC_TASK_H
+#define PERIODIC_TASK_H
+
+/******************************************
+ *                Defines
+ *******************************************/
+#define PERIODIC_TASKS_NO   6
+
+// valve GPIO of every task, indexed by task id - 1; 0 means no valve wired
+// (shared with tools/schedule_replay, which only keeps tasks with a valve busy)
+#define TASK_GPIOS { 4, 0, 0, 0, 0, 0 }
+// measured flow through the valve of every task in ml/min, indexed like TASK_GPIOS; it
+// turns the open time into the water ledger's volume, 0 = not measured (no volume)
+#define TASK_FLOWS { 0, 0, 0, 0, 0, 0 }
+
+/******************************************
+ *              Data Types
+ *******************************************/
+struct periodic_task {
+	unsigned int id;
+	unsigned int start_hour;
+	unsigned int start_min;
+	unsigned int end_hour;
+	unsigned int end_min;
+	unsigned int freq;
+	unsigned int duration;
+};
+
+#endif /* PERIODIC_TASK_H */
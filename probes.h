@@ -0,0 +1,41 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/******************************************
+ *                Defines
+ *******************************************/
+// USDT (user level statically defined tracing) probes of provider "vertical_garden",
+// listed with "bpftrace -l 'usdt:./vertical_garden_rpi_app:*'" and used by the scripts
+// in tools/bpftrace. A probe is a single nop in the code plus an ELF note: it costs
+// nothing until a tracer attaches to it. Built without <sys/sdt.h> (package
+// systemtap-sdt-dev) or with -DVG_NO_PROBES, the probes are not compiled at all.
+//
+//   task_wake     (task id, current sec, planned wake sec)  run_periodic_task()
+//   task_fire     (task id, planned interval start)         run_periodic_task()
+//   execute_entry (task id, gpio)                           execute_task()
+//   execute_exit  (task id, run result, seconds open)       execute_task()
+//   log_enqueue   (task id, format)                         print_safe(), LOG_*()
+//   db_load_start (backend name)                            storage_load_schedule()
+//   db_load_end   (backend name, result, tasks loaded)      storage_load_schedule()
+//   spi_start     (bytes)                                   bcm2835_spi_*()
+//   spi_end       (bytes)
+//   i2c_start     (bytes)                                   bcm2835_i2c_*()
+//   i2c_end       (bytes, reason)
+#if !defined(VG_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define VG_HAVE_PROBES
+#endif
+#endif
+
+#ifdef VG_HAVE_PROBES
+#define VG_PROBE1(name, a)       DTRACE_PROBE1(vertical_garden, name, a)
+#define VG_PROBE2(name, a, b)    DTRACE_PROBE2(vertical_garden, name, a, b)
+#define VG_PROBE3(name, a, b, c) DTRACE_PROBE3(vertical_garden, name, a, b, c)
+#else
+#define VG_PROBE1(name, a)       do { } while(0)
+#define VG_PROBE2(name, a, b)    do { } while(0)
+#define VG_PROBE3(name, a, b, c) do { } while(0)
+#endif
+
+#endif /* PROBES_H */
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "crc32.h"
+#include "schedule_snapshot.h"
+
+/******************************************
+ * schedule_snapshot_load()
+ * params: - const char* path: snapshot file
+ * 		   - struct periodic_task* tasks: array receiving the tasks
+ * 		   - unsigned int max: number of elements in 'tasks'
+ * 		   - unsigned int* count: number of tasks actually loaded
+ * return: 0 on success, -1 if the file is missing, truncated or corrupted
+ *******************************************/
+int schedule_snapshot_load(const char *path, struct periodic_task *tasks, unsigned int max, unsigned int *count)
+{
+	const struct schedule_snapshot_header *hdr;
+	const struct schedule_snapshot_record *rec;
+	struct stat st;
+	void *map;
+	size_t expected;
+	unsigned int i;
+	int fd;
+	int ret = -1;
+
+	*count = 0;
+
+	fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return -1;
+	if(fstat(fd, &st) || (size_t)st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return -1;
+
+	hdr = (const struct schedule_snapshot_header *)map;
+	rec = (const struct schedule_snapshot_record *)(hdr + 1);
+	expected = sizeof(*hdr) + (size_t)hdr->count * sizeof(*rec);
+
+	// validate before trusting a single field of the records
+	if(hdr->magic       != SCHEDULE_SNAPSHOT_MAGIC   ||
+	   hdr->version     != SCHEDULE_SNAPSHOT_VERSION ||
+	   hdr->record_size != sizeof(*rec)              ||
+	   hdr->count       >  max                       ||
+	   (size_t)st.st_size != expected                ||
+	   hdr->crc != crc32(0, rec, (size_t)hdr->count * sizeof(*rec)))
+		goto out;
+
+	for(i=0; i<hdr->count; i++) {
+		tasks[i].id         = rec[i].id;
+		tasks[i].freq       = rec[i].freq;
+		tasks[i].duration   = rec[i].duration;
+		tasks[i].start_hour = rec[i].start_hour;
+		tasks[i].start_min  = rec[i].start_min;
+		tasks[i].end_hour   = rec[i].end_hour;
+		tasks[i].end_min    = rec[i].end_min;
+	}
+	*count = hdr->count;
+	ret = 0;
+out:
+	munmap(map, st.st_size);
+	return ret;
+}
+
+/******************************************
+ * schedule_snapshot_save()
+ * params: - const char* path: snapshot file
+ * 		   - const struct periodic_task* tasks: tasks to be persisted
+ * 		   - unsigned int count: number of elements in 'tasks'
+ * return: 0 on success, -1 on error
+ * NOTE: the snapshot is written to a temporary file which is then renamed
+ *       over 'path', so a power cut never leaves a half written snapshot behind
+ *******************************************/
+int schedule_snapshot_save(const char *path, const struct periodic_task *tasks, unsigned int count)
+{
+	struct schedule_snapshot_header hdr;
+	struct schedule_snapshot_record rec[PERIODIC_TASKS_NO];
+	char tmp_path[PATH_MAX];
+	char dir_path[PATH_MAX];
+	unsigned int i;
+	int fd;
+
+	if(count > PERIODIC_TASKS_NO)
+		return -1;
+
+	memset(rec, 0, sizeof(rec));
+	for(i=0; i<count; i++) {
+		rec[i].id         = tasks[i].id;
+		rec[i].freq       = tasks[i].freq;
+		rec[i].duration   = tasks[i].duration;
+		rec[i].start_hour = (uint8_t)tasks[i].start_hour;
+		rec[i].start_min  = (uint8_t)tasks[i].start_min;
+		rec[i].end_hour   = (uint8_t)tasks[i].end_hour;
+		rec[i].end_min    = (uint8_t)tasks[i].end_min;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic       = SCHEDULE_SNAPSHOT_MAGIC;
+	hdr.version     = SCHEDULE_SNAPSHOT_VERSION;
+	hdr.record_size = sizeof(rec[0]);
+	hdr.count       = count;
+	hdr.crc         = crc32(0, rec, count * sizeof(rec[0]));
+	hdr.saved_sec   = (int64_t)time(NULL);
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+		return -1;
+	if(write(fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr) ||
+	   write(fd, rec, count * sizeof(rec[0])) != (ssize_t)(count * sizeof(rec[0])) ||
+	   fsync(fd)) {
+		close(fd);
+		unlink(tmp_path);
+		return -1;
+	}
+	close(fd);
+
+	if(rename(tmp_path, path)) {
+		unlink(tmp_path);
+		return -1;
+	}
+
+	// make the rename itself durable
+	snprintf(dir_path, sizeof(dir_path), "%s", path);
+	fd = open(dirname(dir_path), O_RDONLY | O_DIRECTORY);
+	if(fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+	return 0;
+}
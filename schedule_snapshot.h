@@ -0,0 +1,44 @@
+#ifndef SCHEDULE_SNAPSHOT_H
+#define SCHEDULE_SNAPSHOT_H
+
+#include <stdint.h>
+#include "periodic_task.h"
+
+/******************************************
+ *                Defines
+ *******************************************/
+#define SCHEDULE_SNAPSHOT_FILE    "schedule_snapshot.bin"
+#define SCHEDULE_SNAPSHOT_MAGIC   0x53534756u /* "VGSS" little endian */
+#define SCHEDULE_SNAPSHOT_VERSION 1
+
+/******************************************
+ *              Data Types
+ *******************************************/
+// On-disk layout: one header followed by 'count' fixed size records.
+// The file is written in host byte order; it never leaves the controller.
+struct schedule_snapshot_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+	uint32_t count;
+	uint32_t crc;       // crc32 over all the records following the header
+	int64_t  saved_sec; // time of the database load the snapshot was taken from
+};
+
+struct schedule_snapshot_record {
+	uint32_t id;
+	uint32_t freq;
+	uint32_t duration;
+	uint8_t  start_hour;
+	uint8_t  start_min;
+	uint8_t  end_hour;
+	uint8_t  end_min;
+};
+
+/******************************************
+ *            Function Prototypes
+ *******************************************/
+int schedule_snapshot_load(const char *path, struct periodic_task *tasks, unsigned int max, unsigned int *count);
+int schedule_snapshot_save(const char *path, const struct periodic_task *tasks, unsigned int count);
+
+#endif /* SCHEDULE_SNAPSHOT_H */
@@ -0,0 +1,164 @@
+#include <string.h>
+#include <time.h>
+#include "scheduler.h"
+
+/******************************************
+ *              Data Types
+ *******************************************/
+struct time_segment {
+	time_t        segment_start;
+	time_t        segment_end;
+	unsigned char active;
+};
+
+/******************************************
+ * schedule_next_action()
+ * params: - const struct periodic_task* task: task to be scheduled
+ * 		   - time_t current_sec: current time in seconds since epoch
+ * 		   - struct schedule_action* action: what the task thread has to do now
+ * NOTE: pure function of its arguments (and the local time zone), so it can be
+ *       driven by the real clock as well as by a virtual one
+ *******************************************/
+void schedule_next_action(const struct periodic_task *task, time_t current_sec, struct schedule_action *action)
+{
+	time_t start_sec;
+	time_t end_sec;
+	time_t interval_start;
+	time_t interval_end;
+	time_t sleep_sec;
+
+	struct tm time_buf;
+	struct tm *time_broken_down;
+
+	struct time_segment time_segments[3];
+
+	unsigned int intervals;
+	unsigned int i, s;
+
+	memset(time_segments, 0, sizeof(time_segments));
+
+	// get current time broken down
+	time_broken_down = localtime_r(&current_sec, &time_buf);
+
+	// get task start time in sec
+	time_broken_down->tm_hour = task->start_hour; // overwrite current time's hour with the start hour 
+	time_broken_down->tm_min = task->start_min;   // overwrite current time's minute with the start minute
+	time_broken_down->tm_sec = 0;                // NOTE: start and end time do not supprt seconds resolution
+	start_sec = mktime(time_broken_down);        // transform in seconds since epoch
+
+	// set task end time in sec
+	time_broken_down->tm_hour = task->end_hour; // overwrite current time's hour with the end hour
+	time_broken_down->tm_min = task->end_min;   // overwrite current time's minute with the end minute
+	time_broken_down->tm_sec = 0;              // NOTE: start and end time do not supprt seconds resolution
+	end_sec = mktime(time_broken_down);        // transform in seconds since epoch
+
+	// Algorithm rationale:
+	//                         00:00:00                   23:59:59
+	// ||<------- DAY n-1 ------->||<--------- DAY n ------->||<------- DAY n+1 ------->|| }
+	// ||                         ||                         ||                         || }
+	// ||    start      end       ||    start      end       ||     start     end       || } case 1: start < end
+                // ||______|_________|________||______|_________|________||______|_________|________|| }
+	// ||      ^^^^^^^^^^^        ||      ^^^^^^^^^^^        ||      ^^^^^^^^^^^        || }
+	// ||      | active  |        ||      | active  |        ||      | active  |        || }
+                // ||      |         |        ||      |         |        ||      |         |        ||
+	// ||      |         |        ||      |         |        ||      |         |        || }
+	// ||     end      start      ||     end      start      ||     end      start      || }
+        // ||______|_________|________||______|_________|________||______|_________|________|| } case 2: start > end
+	// ^^^^^^^^^         ^^^^^^^^^^^^^^^^^^         ^^^^^^^^^^^^^^^^^^         ^^^^^^^^^^^ }
+                //   active          |      active    |         |      active    |             active  }
+                //                   |                |         |                |                     }
+	//                   ^^^^^^^^^^^^^^^^^^         |                |
+	//                       SEGMENT_0    ^^^^^^^^^^^                |
+	//                                    SEGMENT_1  ^^^^^^^^^^^^^^^^^
+                //                                                 SEGMENT_2
+
+	// calculate time segments as per the above diagram
+	// case 1
+	if(start_sec < end_sec){
+		// time segment_0
+		time_segments[0].segment_start = end_sec - 86400;
+		time_segments[0].segment_end   = start_sec;
+		time_segments[0].active        = 0;
+		// time segment_1
+		time_segments[1].segment_start = start_sec;
+		time_segments[1].segment_end   = end_sec;
+		time_segments[1].active        = 1;
+		// time segment_2
+		time_segments[2].segment_start = end_sec;
+		time_segments[2].segment_end   = start_sec + 86400;
+		time_segments[2].active        = 0;
+	// case 2
+	} else if(start_sec > end_sec){
+		// time segment_0
+		time_segments[0].segment_start = start_sec - 86400;
+		time_segments[0].segment_end   = end_sec;
+		time_segments[0].active        = 1;
+		// time segment_1
+		time_segments[1].segment_start = end_sec;
+		time_segments[1].segment_end   = start_sec;
+		time_segments[1].active        = 0;
+		// time segment_2
+		time_segments[2].segment_start = start_sec;
+		time_segments[2].segment_end   = end_sec + 86400;
+		time_segments[2].active        = 1;
+	// case 3
+	} else {
+		// active period is around the clock
+		// NOTE: not handled yet; all the segments stay inactive
+	}
+
+	// set the default sleep time for the current thread
+	sleep_sec = 60;
+	action->fire        = 0;
+	action->planned_sec = 0;
+
+	// iterate through all the time segments and determine in which one the current time fits in
+	for(s=0; s<3; s++){
+		// active segment
+		if( (current_sec >= time_segments[s].segment_start) &&
+			(current_sec <= time_segments[s].segment_end)   &&
+			(time_segments[s].active == 1)) {
+			// calculate the wake-up intervals across the active segment
+			intervals = (unsigned int)(time_segments[s].segment_end -
+					                   time_segments[s].segment_start) /
+					                   (task->freq * 60);
+			// determine in which of these intervals the current time is
+			for(i=0; i<intervals; i++){
+				interval_start = ( i    * task->freq * 60) + time_segments[s].segment_start;
+				interval_end   = ((i+1) * task->freq * 60) + time_segments[s].segment_start;
+				// found a valid interval inside the active time segment
+				if(current_sec >= interval_start &&
+				   current_sec <  interval_end) {
+					// determine now if the current time perfectly matches the start of the interval
+					// or if the thread need to be put to sleep until the start of the next interval
+					if(current_sec == interval_start) {
+						// execute task; the caller sleeps from the end of the execution
+						// until the next interval start
+						action->fire        = 1;
+						action->planned_sec = interval_start;
+						sleep_sec = interval_end - current_sec;
+					} else {
+						// put thread to sleep until next interval start
+						sleep_sec = interval_end - current_sec;
+					}
+					// break the for loop;
+					break;
+				}
+			}
+		// inactive segment
+		} else if ( (current_sec > time_segments[s].segment_start) &&
+				    (current_sec < time_segments[s].segment_end)   &&
+				    (time_segments[s].active == 0) ) {
+
+			switch(s){
+			case 0: sleep_sec = time_segments[1].segment_start - current_sec; break;
+			case 1: sleep_sec = time_segments[2].segment_start - current_sec; break;
+			case 2: sleep_sec = (time_segments[1].segment_start + 86400) - current_sec; break;
+			default: // we're in trouble if program flow choses this case
+				break;
+			}
+		}
+	}
+
+	action->wake_sec = current_sec + sleep_sec;
+}
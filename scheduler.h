@@ -0,0 +1,21 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <time.h>
+#include "periodic_task.h"
+
+/******************************************
+ *              Data Types
+ *******************************************/
+struct schedule_action {
+	unsigned char fire;        // 1 if the task has to be executed now
+	time_t        planned_sec; // interval start the execution is planned for (if fire)
+	time_t        wake_sec;    // next wake-up, seconds since epoch
+};
+
+/******************************************
+ *            Function Prototypes
+ *******************************************/
+void schedule_next_action(const struct periodic_task *task, time_t current_sec, struct schedule_action *action);
+
+#endif /* SCHEDULER_H */
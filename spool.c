@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "crc32.h"
+#include "spool.h"
+
+/******************************************
+ *             Global Variables
+ *******************************************/
+static int spool_fd = -1;
+static pthread_mutex_t spool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// records appended since the last commit; written out with a single write + fdatasync
+static unsigned char spool_buf[SPOOL_COMMIT_BYTES];
+static size_t spool_buf_len;
+static unsigned int spool_buf_records;
+
+static uint64_t spool_size;     // end of the committed records on disk
+static uint64_t spool_consumed; // first record not delivered yet
+
+/******************************************
+ * spool_record_crc()
+ *******************************************/
+static uint32_t spool_record_crc(const struct spool_record_header *hdr, const void *payload)
+{
+	uint32_t crc;
+
+	crc = crc32(0, &hdr->type, sizeof(hdr->type) + sizeof(hdr->reserved));
+	return crc32(crc, payload, hdr->len);
+}
+
+/******************************************
+ * spool_write_header()
+ *******************************************/
+static int spool_write_header(void)
+{
+	struct spool_file_header hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic    = SPOOL_MAGIC;
+	hdr.consumed = spool_consumed;
+	if(pwrite(spool_fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) || fdatasync(spool_fd))
+		return -1;
+	return 0;
+}
+
+/******************************************
+ * spool_reset()
+ * Drops every record. The file is cut before the header is rewritten: a crash
+ * in between leaves 'consumed' past the end of the file, which spool_open() treats
+ * as empty, so delivered records are never replayed twice because of the reset.
+ *******************************************/
+static int spool_reset(void)
+{
+	if(ftruncate(spool_fd, sizeof(struct spool_file_header)) || fdatasync(spool_fd))
+		return -1;
+	spool_size     = sizeof(struct spool_file_header);
+	spool_consumed = sizeof(struct spool_file_header);
+	return spool_write_header();
+}
+
+/******************************************
+ * spool_scan()
+ * params: - const unsigned char* map: file contents
+ * 		   - uint64_t offset: where to start
+ * 		   - uint64_t size: end of the data in 'map'
+ * return: offset right after the last intact record
+ *******************************************/
+static uint64_t spool_scan(const unsigned char *map, uint64_t offset, uint64_t size)
+{
+	const struct spool_record_header *rec;
+
+	while(offset + sizeof(*rec) <= size) {
+		rec = (const struct spool_record_header *)(map + offset);
+		if(rec->len > size - offset - sizeof(*rec) ||
+		   rec->crc != spool_record_crc(rec, rec + 1))
+			break;
+		offset += sizeof(*rec) + rec->len;
+	}
+	return offset;
+}
+
+/******************************************
+ * spool_open()
+ * params: - const char* path: spool file, created if missing
+ * return: 0 on success, -1 on error
+ *******************************************/
+int spool_open(const char *path)
+{
+	struct spool_file_header hdr;
+	struct stat st;
+	unsigned char *map;
+	int ret = 0;
+
+	pthread_mutex_lock(&spool_mutex);
+	spool_fd = open(path, O_RDWR | O_CREAT, 0644);
+	if(spool_fd < 0 || fstat(spool_fd, &st)) {
+		ret = -1;
+		goto out;
+	}
+	spool_buf_len     = 0;
+	spool_buf_records = 0;
+
+	if((size_t)st.st_size < sizeof(hdr) ||
+	   pread(spool_fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+	   hdr.magic != SPOOL_MAGIC ||
+	   hdr.consumed < sizeof(hdr) || hdr.consumed >= (uint64_t)st.st_size) {
+		// new, foreign or fully delivered spool
+		ret = spool_reset();
+		goto out;
+	}
+
+	// cut off whatever a power loss left half written
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, spool_fd, 0);
+	if(map == MAP_FAILED) {
+		ret = -1;
+		goto out;
+	}
+	spool_consumed = hdr.consumed;
+	spool_size = spool_scan(map, spool_consumed, st.st_size);
+	munmap(map, st.st_size);
+
+	if(spool_size == spool_consumed)
+		ret = spool_reset();
+	else if(spool_size < (uint64_t)st.st_size)
+		ret = (ftruncate(spool_fd, spool_size) || fdatasync(spool_fd)) ? -1 : 0;
+out:
+	pthread_mutex_unlock(&spool_mutex);
+	return ret;
+}
+
+/******************************************
+ * spool_commit_locked()
+ *******************************************/
+static int spool_commit_locked(void)
+{
+	if(spool_buf_len == 0)
+		return 0;
+	if(pwrite(spool_fd, spool_buf, spool_buf_len, spool_size) != (ssize_t)spool_buf_len ||
+	   fdatasync(spool_fd))
+		return -1;
+	spool_size += spool_buf_len;
+	spool_buf_len     = 0;
+	spool_buf_records = 0;
+	return 0;
+}
+
+/******************************************
+ * spool_append()
+ * params: - uint16_t type: SPOOL_RECORD_* type of the payload
+ * 		   - const void* payload: record contents
+ * 		   - uint32_t len: size of 'payload'
+ * return: 0 if buffered, -1 if the spool is full or the payload is too large
+ * NOTE: records become durable on the next spool_commit(), or earlier when the
+ *       group commit buffer fills up
+ *******************************************/
+int spool_append(uint16_t type, const void *payload, uint32_t len)
+{
+	struct spool_record_header rec;
+	size_t rec_len = sizeof(rec) + len;
+	int ret = -1;
+
+	if(rec_len > sizeof(spool_buf))
+		return -1;
+
+	pthread_mutex_lock(&spool_mutex);
+	if(spool_fd < 0 || spool_size + spool_buf_len + rec_len > SPOOL_MAX_BYTES)
+		goto out;
+	if(spool_buf_len + rec_len > sizeof(spool_buf) && spool_commit_locked())
+		goto out;
+
+	rec.len      = len;
+	rec.type     = type;
+	rec.reserved = 0;
+	rec.crc      = spool_record_crc(&rec, payload);
+	memcpy(spool_buf + spool_buf_len, &rec, sizeof(rec));
+	memcpy(spool_buf + spool_buf_len + sizeof(rec), payload, len);
+	spool_buf_len += rec_len;
+	spool_buf_records++;
+	ret = 0;
+out:
+	pthread_mutex_unlock(&spool_mutex);
+	return ret;
+}
+
+/******************************************
+ * spool_commit()
+ * Writes all the buffered records with one write and one fdatasync.
+ * return: 0 on success, -1 on error (the records stay buffered)
+ *******************************************/
+int spool_commit(void)
+{
+	int ret;
+
+	pthread_mutex_lock(&spool_mutex);
+	ret = (spool_fd < 0) ? -1 : spool_commit_locked();
+	pthread_mutex_unlock(&spool_mutex);
+	return ret;
+}
+
+/******************************************
+ * spool_discard()
+ * Drops the buffered records, for a caller which keeps them itself after a failed
+ * spool_commit().
+ * return: number of records dropped
+ *******************************************/
+int spool_discard(void)
+{
+	int n;
+
+	pthread_mutex_lock(&spool_mutex);
+	n = spool_buf_records;
+	spool_buf_len     = 0;
+	spool_buf_records = 0;
+	pthread_mutex_unlock(&spool_mutex);
+	return n;
+}
+
+/******************************************
+ * spool_pending()
+ * return: 1 if there are records waiting to be replayed, 0 otherwise
+ *******************************************/
+int spool_pending(void)
+{
+	int ret;
+
+	pthread_mutex_lock(&spool_mutex);
+	ret = (spool_size > spool_consumed || spool_buf_len > 0);
+	pthread_mutex_unlock(&spool_mutex);
+	return ret;
+}
+
+/******************************************
+ * spool_replay()
+ * params: - spool_deliver_fn deliver: called with up to SPOOL_REPLAY_BATCH records at a time
+ * 		   - void* ctx: passed through to 'deliver'
+ * return: number of records delivered, or -1 if 'deliver' failed (the records
+ *         from the failed batch on stay in the spool)
+ * NOTE: delivery is at-least-once: after a crash between 'deliver' returning and the
+ *       header update, the last batch is delivered again
+ *******************************************/
+int spool_replay(spool_deliver_fn deliver, void *ctx)
+{
+	struct spool_entry entries[SPOOL_REPLAY_BATCH];
+	const struct spool_record_header *rec;
+	unsigned char *map;
+	uint64_t offset;
+	unsigned int n;
+	int delivered = 0;
+
+	pthread_mutex_lock(&spool_mutex);
+	if(spool_fd < 0 || spool_commit_locked()) {
+		delivered = -1;
+		goto out;
+	}
+	if(spool_size == spool_consumed)
+		goto out;
+
+	map = mmap(NULL, spool_size, PROT_READ, MAP_SHARED, spool_fd, 0);
+	if(map == MAP_FAILED) {
+		delivered = -1;
+		goto out;
+	}
+
+	offset = spool_consumed;
+	while(offset < spool_size) {
+		for(n=0; n<SPOOL_REPLAY_BATCH && offset < spool_size; n++) {
+			rec = (const struct spool_record_header *)(map + offset);
+			entries[n].type    = rec->type;
+			entries[n].len     = rec->len;
+			entries[n].payload = rec + 1;
+			offset += sizeof(*rec) + rec->len;
+		}
+		if(deliver(entries, n, ctx)) {
+			delivered = -1;
+			break;
+		}
+		delivered += n;
+		// remember the progress so a crash does not replay the whole spool
+		spool_consumed = offset;
+		if(spool_write_header()) {
+			delivered = -1;
+			break;
+		}
+	}
+	munmap(map, spool_size);
+
+	if(spool_size == spool_consumed && spool_reset())
+		delivered = -1;
+out:
+	pthread_mutex_unlock(&spool_mutex);
+	return delivered;
+}
+
+/******************************************
+ * spool_close()
+ *******************************************/
+void spool_close(void)
+{
+	pthread_mutex_lock(&spool_mutex);
+	if(spool_fd >= 0) {
+		spool_commit_locked();
+		close(spool_fd);
+	}
+	spool_fd = -1;
+	pthread_mutex_unlock(&spool_mutex);
+}
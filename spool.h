@@ -0,0 +1,58 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <stdint.h>
+
+/******************************************
+ *                Defines
+ *******************************************/
+#define SPOOL_FILE          "telemetry.spool"
+#define SPOOL_MAGIC         0x4C505356u          /* "VSPL" little endian */
+#define SPOOL_MAX_BYTES     (4 * 1024 * 1024)   // records beyond this size are dropped
+#define SPOOL_COMMIT_BYTES  (16 * 1024)         // group commit buffer
+#define SPOOL_REPLAY_BATCH  256                 // records handed over per replay callback
+
+// spool record types
+#define SPOOL_RECORD_RUN_HISTORY 1 // payload: struct run_history_event
+
+/******************************************
+ *              Data Types
+ *******************************************/
+// On-disk layout: a header block followed by records
+//     [uint32 len][uint32 crc][uint16 type][uint16 reserved][len bytes payload]
+// crc covers type, reserved and payload. Records in front of 'consumed' have been
+// delivered already; a torn or corrupted tail is cut off when the spool is opened.
+struct spool_file_header {
+	uint32_t magic;
+	uint32_t reserved;
+	uint64_t consumed; // file offset of the first record not delivered yet
+};
+
+struct spool_record_header {
+	uint32_t len;
+	uint32_t crc;
+	uint16_t type;
+	uint16_t reserved;
+};
+
+struct spool_entry {
+	uint16_t    type;
+	uint32_t    len;
+	const void *payload;
+};
+
+// returns 0 once the entries are stored for good, -1 to stop the replay
+typedef int (*spool_deliver_fn)(const struct spool_entry *entries, unsigned int count, void *ctx);
+
+/******************************************
+ *            Function Prototypes
+ *******************************************/
+int  spool_open(const char *path);
+int  spool_append(uint16_t type, const void *payload, uint32_t len);
+int  spool_commit(void);
+int  spool_discard(void);
+int  spool_pending(void);
+int  spool_replay(spool_deliver_fn deliver, void *ctx);
+void spool_close(void);
+
+#endif /* SPOOL_H */
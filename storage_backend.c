@@ -0,0 +1,222 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "flight_recorder.h"
+#include "metrics.h"
+#include "probes.h"
+#include "storage_backend.h"
+
+/******************************************
+ *             Global Variables
+ *******************************************/
+static const struct storage_backend *storage_backends[] = {
+#ifndef STORAGE_WITHOUT_MYSQL
+	&storage_backend_mysql,
+#endif
+#ifndef STORAGE_WITHOUT_SQLITE
+	&storage_backend_sqlite,
+#endif
+	&storage_backend_flatfile,
+};
+
+// backends keep a single connection/handle, so all the calls are serialized
+static pthread_mutex_t storage_mutex = PTHREAD_MUTEX_INITIALIZER;
+static const struct storage_backend *storage_opened;
+
+/******************************************
+ * storage_backend_find()
+ * params: - const char* name: backend name; NULL selects STORAGE_BACKEND_DEFAULT
+ * return: the backend, or NULL if no backend with this name was built in
+ *******************************************/
+const struct storage_backend *storage_backend_find(const char *name)
+{
+	unsigned int i;
+
+	if(name == NULL || *name == '\0')
+		name = STORAGE_BACKEND_DEFAULT;
+
+	for(i=0; i<sizeof(storage_backends)/sizeof(storage_backends[0]); i++)
+		if(strcmp(storage_backends[i]->name, name) == 0)
+			return storage_backends[i];
+	return NULL;
+}
+
+/******************************************
+ * storage_open_locked()
+ *******************************************/
+static int storage_open_locked(const struct storage_backend *backend)
+{
+	if(storage_opened == backend)
+		return 0;
+	if(storage_opened != NULL)
+		storage_opened->close();
+	storage_opened = NULL;
+	if(backend->open())
+		return -1;
+	storage_opened = backend;
+	return 0;
+}
+
+/******************************************
+ * storage_elapsed_ms()
+ * return: milliseconds since 't0' (CLOCK_MONOTONIC), connecting included
+ *******************************************/
+static double storage_elapsed_ms(const struct timespec *t0)
+{
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) * 1000.0 + (t1.tv_nsec - t0->tv_nsec) / 1e6;
+}
+
+/******************************************
+ * storage_load_schedule()
+ * params: - const struct storage_backend* backend: backend to read from
+ * 		   - struct periodic_task* tasks: array receiving the enabled tasks
+ * 		   - unsigned int max: number of elements in 'tasks'
+ * 		   - unsigned int* count: number of tasks written to 'tasks'
+ * return: 0 on success, -1 on error
+ *******************************************/
+int storage_load_schedule(const struct storage_backend *backend, struct periodic_task *tasks, unsigned int max, unsigned int *count)
+{
+	struct timespec t0;
+	double elapsed_ms;
+	int ret = -1;
+
+	*count = 0;
+	VG_PROBE1(db_load_start, backend->name);
+	pthread_mutex_lock(&storage_mutex);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if(storage_open_locked(backend) == 0) {
+		ret = backend->load_schedule(tasks, max, count);
+		// drop the handle after a failure so the next call reconnects
+		if(ret) {
+			backend->close();
+			storage_opened = NULL;
+		}
+	}
+	elapsed_ms = storage_elapsed_ms(&t0);
+	metrics_observe(METRIC_STORAGE_LOAD_MS, elapsed_ms);
+	pthread_mutex_unlock(&storage_mutex);
+	flight_record(FLIGHT_STORAGE_LOAD, 0, ret, (int32_t)elapsed_ms);
+	VG_PROBE3(db_load_end, backend->name, ret, *count);
+	if(ret)
+		metrics_inc(METRIC_STORAGE_ERRORS, 0, 1);
+	return ret;
+}
+
+/******************************************
+ * storage_write_history()
+ * params: - const struct storage_backend* backend: backend to write to
+ * 		   - const struct run_history_event* events: events to be stored
+ * 		   - unsigned int count: number of elements in 'events'
+ * return: 0 if all the events were stored, -1 on error (none of them stored)
+ *******************************************/
+int storage_write_history(const struct storage_backend *backend, const struct run_history_event *events, unsigned int count)
+{
+	struct timespec t0;
+	int ret = -1;
+
+	if(count == 0)
+		return 0;
+
+	pthread_mutex_lock(&storage_mutex);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if(storage_open_locked(backend) == 0) {
+		ret = backend->write_history(events, count);
+		if(ret) {
+			backend->close();
+			storage_opened = NULL;
+		}
+	}
+	metrics_observe(METRIC_STORAGE_WRITE_MS, storage_elapsed_ms(&t0));
+	pthread_mutex_unlock(&storage_mutex);
+	flight_record(FLIGHT_STORAGE_WRITE, 0, ret, (int32_t)count);
+	if(ret)
+		metrics_inc(METRIC_STORAGE_ERRORS, 0, 1);
+	return ret;
+}
+
+/******************************************
+ * storage_delete_history()
+ * params: - const struct storage_backend* backend: backend to delete from
+ * 		   - unsigned int task_id: task whose runs are deleted
+ * return: 0 on success, -1 on error or if the backend cannot delete
+ * NOTE: for clean-up after tests and benchmarks; the app never deletes history
+ *******************************************/
+int storage_delete_history(const struct storage_backend *backend, unsigned int task_id)
+{
+	int ret = -1;
+
+	if(backend->delete_history == NULL)
+		return -1;
+	pthread_mutex_lock(&storage_mutex);
+	if(storage_open_locked(backend) == 0) {
+		ret = backend->delete_history(task_id);
+		if(ret) {
+			backend->close();
+			storage_opened = NULL;
+		}
+	}
+	pthread_mutex_unlock(&storage_mutex);
+	return ret;
+}
+
+/******************************************
+ * storage_close()
+ *******************************************/
+void storage_close(const struct storage_backend *backend)
+{
+	pthread_mutex_lock(&storage_mutex);
+	if(storage_opened == backend) {
+		backend->close();
+		storage_opened = NULL;
+	}
+	pthread_mutex_unlock(&storage_mutex);
+}
+
+/******************************************
+ * storage_parse_task_row()
+ * params: - char** row: one irrigation_table row as TASK_COLUMNS_NO strings
+ * 		   - struct periodic_task* task: filled in from 'row'
+ * return: 1 if the task is enabled, 0 if it is disabled or malformed
+ * NOTE: the start/end time strings are modified ("hh:mm:ss" is tokenized in place)
+ *******************************************/
+int storage_parse_task_row(char **row, struct periodic_task *task)
+{
+	char *save;
+	char *hour;
+	char *min;
+
+	// process only the enabled tasks
+	if(row[TASK_ACTIVE_POS] == NULL || !atoi(row[TASK_ACTIVE_POS]))
+		return 0;
+	if(row[TASK_ID_POS] == NULL || row[TASK_FREQ_POS] == NULL || row[TASK_DURATION_POS] == NULL ||
+	   row[TASK_START_TIME_POS] == NULL || row[TASK_END_TIME_POS] == NULL)
+		return 0;
+
+	task->id       = (unsigned int)atoi(row[TASK_ID_POS]);
+	task->freq     = (unsigned int)atoi(row[TASK_FREQ_POS]);
+	task->duration = (unsigned int)atoi(row[TASK_DURATION_POS]);
+	// a zero frequency would divide by zero in the scheduler
+	if(task->freq == 0)
+		return 0;
+
+	// start time read in the "hh:mm:ss" format
+	hour = strtok_r(row[TASK_START_TIME_POS], ":", &save);
+	min  = strtok_r(NULL, ":", &save);
+	if(hour == NULL || min == NULL)
+		return 0;
+	task->start_hour = (unsigned int)atoi(hour);
+	task->start_min  = (unsigned int)atoi(min);
+
+	// end time read in the "hh:mm:ss" format
+	hour = strtok_r(row[TASK_END_TIME_POS], ":", &save);
+	min  = strtok_r(NULL, ":", &save);
+	if(hour == NULL || min == NULL)
+		return 0;
+	task->end_hour = (unsigned int)atoi(hour);
+	task->end_min  = (unsigned int)atoi(min);
+	return 1;
+}
@@ -0,0 +1,74 @@
+#ifndef STORAGE_BACKEND_H
+#define STORAGE_BACKEND_H
+
+#include <stdint.h>
+#include "periodic_task.h"
+
+/******************************************
+ *                Defines
+ *******************************************/
+// environment variable selecting the backend at runtime: "mysql", "sqlite" or "flatfile"
+#define STORAGE_BACKEND_ENV     "VG_STORAGE"
+#define STORAGE_BACKEND_DEFAULT "mysql"
+
+#define STORAGE_SQLITE_FILE         "vertical_garden.db"
+#define STORAGE_FLATFILE_SCHEDULE   "irrigation_table.csv"
+#define STORAGE_FLATFILE_HISTORY    "run_history.csv"
+
+// column positions in irrigation_table, shared by every backend
+#define TASK_ID_POS	    0
+#define TASK_ACTIVE_POS     1
+#define TASK_START_TIME_POS 2
+#define TASK_END_TIME_POS   3
+#define TASK_FREQ_POS	    4
+#define TASK_DURATION_POS   5
+#define TASK_COLUMNS_NO     6
+
+// run_history_event.result values
+#define RUN_RESULT_OK        0
+#define RUN_RESULT_NO_VALVE  1 // no GPIO configured for the task
+#define RUN_RESULT_HAL_ERROR 2 // bcm2835 library not initialized
+
+/******************************************
+ *              Data Types
+ *******************************************/
+// one irrigation run, as written to the run_history table
+struct run_history_event {
+	unsigned int task_id;
+	int64_t      planned_sec;  // interval start the run was scheduled for
+	int64_t      start_sec;    // actual valve open time
+	unsigned int open_sec;     // actual valve open duration
+	int          result;
+};
+
+// A storage backend loads the schedule and stores the run history.
+// open() is called lazily before the first load/write and again after any failure;
+// every call returns 0 on success and -1 on error. Calls are serialized by storage_backend.c.
+struct storage_backend {
+	const char *name;
+	int  (*open)(void);
+	int  (*load_schedule)(struct periodic_task *tasks, unsigned int max, unsigned int *count);
+	int  (*write_history)(const struct run_history_event *events, unsigned int count);
+	int  (*delete_history)(unsigned int task_id); // optional (NULL): drops every run of a task
+	void (*close)(void);
+};
+
+#ifndef STORAGE_WITHOUT_MYSQL
+extern const struct storage_backend storage_backend_mysql;
+#endif
+#ifndef STORAGE_WITHOUT_SQLITE
+extern const struct storage_backend storage_backend_sqlite;
+#endif
+extern const struct storage_backend storage_backend_flatfile;
+
+/******************************************
+ *            Function Prototypes
+ *******************************************/
+const struct storage_backend *storage_backend_find(const char *name);
+int  storage_load_schedule(const struct storage_backend *backend, struct periodic_task *tasks, unsigned int max, unsigned int *count);
+int  storage_write_history(const struct storage_backend *backend, const struct run_history_event *events, unsigned int count);
+int  storage_delete_history(const struct storage_backend *backend, unsigned int task_id);
+void storage_close(const struct storage_backend *backend);
+int  storage_parse_task_row(char **row, struct periodic_task *task);
+
+#endif /* STORAGE_BACKEND_H */
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "logger.h"
+#include "storage_backend.h"
+
+/******************************************
+ *                Defines
+ *******************************************/
+#define FLATFILE_LINE_LEN 256
+
+/******************************************
+ *             Global Variables
+ *******************************************/
+static FILE *history_fp;
+
+/******************************************
+ * flatfile_backend_open()
+ *******************************************/
+static int flatfile_backend_open(void)
+{
+	history_fp = fopen(STORAGE_FLATFILE_HISTORY, "a");
+	if(history_fp == NULL) {
+		LOG_ERROR(0, "ERROR: could not open %s\n", STORAGE_FLATFILE_HISTORY);
+		return -1;
+	}
+	return 0;
+}
+
+/******************************************
+ * flatfile_backend_load_schedule()
+ * The schedule file holds one irrigation_table row per line, in column order:
+ *     id,active,start_time,end_time,freq,duration
+ * e.g. "1,1,06:00:00,22:00:00,30,60". Empty lines and lines starting with '#' are skipped.
+ *******************************************/
+static int flatfile_backend_load_schedule(struct periodic_task *tasks, unsigned int max, unsigned int *count)
+{
+	FILE *fp;
+	char line[FLATFILE_LINE_LEN];
+	char *row[TASK_COLUMNS_NO];
+	char *save;
+	unsigned int i;
+	int c;
+
+	fp = fopen(STORAGE_FLATFILE_SCHEDULE, "r");
+	if(fp == NULL) {
+		LOG_ERROR(0, "ERROR: could not open %s\n", STORAGE_FLATFILE_SCHEDULE);
+		return -1;
+	}
+
+	i=0;
+	while(i < max && fgets(line, sizeof(line), fp) != NULL) {
+		if(line[0] == '#' || line[0] == '\n')
+			continue;
+		line[strcspn(line, "\r\n")] = '\0';
+
+		row[0] = strtok_r(line, ",", &save);
+		for(c=1; c<TASK_COLUMNS_NO; c++)
+			row[c] = strtok_r(NULL, ",", &save);
+
+		if(storage_parse_task_row(row, &tasks[i]))
+			i++;
+	}
+	*count = i;
+
+	fclose(fp);
+	return 0;
+}
+
+/******************************************
+ * flatfile_backend_write_history()
+ * Appends one CSV line per event: task_id,planned_sec,start_sec,open_sec,result
+ *******************************************/
+static int flatfile_backend_write_history(const struct run_history_event *events, unsigned int count)
+{
+	unsigned int i;
+
+	for(i=0; i<count; i++)
+		fprintf(history_fp, "%u,%lld,%lld,%u,%d\n",
+				events[i].task_id,
+				(long long)events[i].planned_sec,
+				(long long)events[i].start_sec,
+				events[i].open_sec,
+				events[i].result);
+
+	if(fflush(history_fp) || fdatasync(fileno(history_fp))) {
+		LOG_ERROR(0, "ERROR: could not write %s\n", STORAGE_FLATFILE_HISTORY);
+		return -1;
+	}
+	return 0;
+}
+
+/******************************************
+ * flatfile_backend_close()
+ *******************************************/
+static void flatfile_backend_close(void)
+{
+	if(history_fp != NULL)
+		fclose(history_fp);
+	history_fp = NULL;
+}
+
+const struct storage_backend storage_backend_flatfile = {
+	.name          = "flatfile",
+	.open          = flatfile_backend_open,
+	.load_schedule = flatfile_backend_load_schedule,
+	.write_history = flatfile_backend_write_history,
+	.close         = flatfile_backend_close,
+};
@@ -0,0 +1,316 @@
+#ifndef STORAGE_WITHOUT_MYSQL
+
+#include <mysql.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include "logger.h"
+#include "storage_backend.h"
+#include "vertical_garden_rpi_app.h"
+
+/******************************************
+ *                Defines
+ *******************************************/
+// worst case length of one "(task_id,planned,start,open,result)," tuple
+#define MYSQL_HISTORY_ROW_LEN 96
+
+// upper bound for any single connect/query round trip; a slow or hung server
+// costs the calling storage thread at most this long
+#define MYSQL_OP_TIMEOUT_MS   5000
+
+// MariaDB Connector/C (and libmariadbclient) provide the non-blocking client API
+#if defined(MARIADB_BASE_VERSION) || defined(MARIADB_PACKAGE_VERSION)
+#define MYSQL_HAVE_NONBLOCK
+#endif
+
+/******************************************
+ *             Global Variables
+ *******************************************/
+static MYSQL *conn;
+
+#ifdef MYSQL_HAVE_NONBLOCK
+/******************************************
+ * deadline_ms_left()
+ *******************************************/
+static long deadline_ms_left(const struct timespec *deadline)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (deadline->tv_sec - now.tv_sec) * 1000 + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+}
+
+/******************************************
+ * deadline_start()
+ *******************************************/
+static void deadline_start(struct timespec *deadline)
+{
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+	deadline->tv_sec  += MYSQL_OP_TIMEOUT_MS / 1000;
+	deadline->tv_nsec += (MYSQL_OP_TIMEOUT_MS % 1000) * 1000000L;
+	if(deadline->tv_nsec >= 1000000000L) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000L;
+	}
+}
+
+/******************************************
+ * mysql_wait()
+ * params: - MYSQL* mysql: connection with an operation in progress
+ * 		   - int status: MYSQL_WAIT_* flags returned by the last _start()/_cont() call
+ * 		   - const struct timespec* deadline: CLOCK_MONOTONIC time at which the operation is abandoned
+ * return: the MYSQL_WAIT_* flags to pass to the next _cont() call, or -1 if the deadline passed
+ *******************************************/
+static int mysql_wait(MYSQL *mysql, int status, const struct timespec *deadline)
+{
+	struct pollfd pfd;
+	long timeout_ms;
+	int res;
+
+	pfd.fd = mysql_get_socket(mysql);
+	pfd.events = ((status & MYSQL_WAIT_READ)   ? POLLIN  : 0) |
+				 ((status & MYSQL_WAIT_WRITE)  ? POLLOUT : 0) |
+				 ((status & MYSQL_WAIT_EXCEPT) ? POLLPRI : 0);
+
+	do {
+		timeout_ms = deadline_ms_left(deadline);
+		if(timeout_ms <= 0)
+			return -1;
+		// the client library may ask for its own (shorter) timeout as well
+		if((status & MYSQL_WAIT_TIMEOUT) && mysql_get_timeout_value_ms(mysql) < timeout_ms)
+			timeout_ms = mysql_get_timeout_value_ms(mysql);
+		res = poll(&pfd, 1, (int)timeout_ms);
+	} while(res < 0 && errno == EINTR);
+
+	if(res < 0)
+		return -1;
+	if(res == 0)
+		return (status & MYSQL_WAIT_TIMEOUT) ? MYSQL_WAIT_TIMEOUT : -1;
+
+	status = 0;
+	if(pfd.revents & POLLIN)  status |= MYSQL_WAIT_READ;
+	if(pfd.revents & POLLOUT) status |= MYSQL_WAIT_WRITE;
+	if(pfd.revents & POLLPRI) status |= MYSQL_WAIT_EXCEPT;
+	// errors/hangups are reported to the library as readable so it picks them up itself
+	if(pfd.revents & (POLLERR | POLLHUP)) status |= MYSQL_WAIT_READ;
+	return status;
+}
+
+// Drives one non-blocking MariaDB call to completion or until 'deadline'.
+// Evaluates to 0 when the call completed and -1 when it was abandoned.
+#define MYSQL_NB_RUN(status, deadline, start_call, cont_call)	\
+	({								\
+		int _ret = 0;						\
+		status = (start_call);					\
+		while(status) {						\
+			status = mysql_wait(conn, status, deadline);	\
+			if(status < 0) {				\
+				_ret = -1;				\
+				break;					\
+			}						\
+			status = (cont_call);				\
+		}							\
+		_ret;							\
+	})
+#endif
+
+/******************************************
+ * mysql_nb_connect()
+ * return: 0 on success, -1 on error or timeout
+ *******************************************/
+static int mysql_nb_connect(void)
+{
+	MYSQL *ret;
+#ifdef MYSQL_HAVE_NONBLOCK
+	struct timespec deadline;
+	int status;
+
+	deadline_start(&deadline);
+	mysql_options(conn, MYSQL_OPT_NONBLOCK, 0);
+	if(MYSQL_NB_RUN(status, &deadline,
+					mysql_real_connect_start(&ret, conn, db_server, db_user, db_password, db_database, 0, NULL, 0),
+					mysql_real_connect_cont(&ret, conn, status)))
+		return -1;
+#else
+	// blocking client library: fall back to the socket level timeouts
+	unsigned int timeout_sec = (MYSQL_OP_TIMEOUT_MS + 999) / 1000;
+
+	mysql_options(conn, MYSQL_OPT_CONNECT_TIMEOUT, &timeout_sec);
+	mysql_options(conn, MYSQL_OPT_READ_TIMEOUT, &timeout_sec);
+	mysql_options(conn, MYSQL_OPT_WRITE_TIMEOUT, &timeout_sec);
+	ret = mysql_real_connect(conn, db_server, db_user, db_password, db_database, 0, NULL, 0);
+#endif
+	return ret ? 0 : -1;
+}
+
+/******************************************
+ * mysql_nb_query()
+ * params: - const char* query: statement to run
+ * 		   - unsigned long len: length of 'query'
+ * 		   - MYSQL_RES** res: if not NULL, receives the whole result set
+ * return: 0 on success, -1 on error or timeout
+ * NOTE: the result set is fetched in full (mysql_store_result) so that walking
+ *       the rows afterwards never touches the network
+ *******************************************/
+static int mysql_nb_query(const char *query, unsigned long len, MYSQL_RES **res)
+{
+	int err;
+#ifdef MYSQL_HAVE_NONBLOCK
+	struct timespec deadline;
+	int status;
+
+	deadline_start(&deadline);
+	if(MYSQL_NB_RUN(status, &deadline,
+					mysql_real_query_start(&err, conn, query, len),
+					mysql_real_query_cont(&err, conn, status)) || err)
+		return -1;
+	if(res == NULL)
+		return 0;
+	if(MYSQL_NB_RUN(status, &deadline,
+					mysql_store_result_start(res, conn),
+					mysql_store_result_cont(res, conn, status)))
+		return -1;
+#else
+	err = mysql_real_query(conn, query, len);
+	if(err)
+		return -1;
+	if(res == NULL)
+		return 0;
+	*res = mysql_store_result(conn);
+#endif
+	return (*res != NULL) ? 0 : -1;
+}
+
+/******************************************
+ * mysql_backend_close()
+ *******************************************/
+static void mysql_backend_close(void)
+{
+	if(conn == NULL)
+		return;
+	// mysql_close() says goodbye to the server, which would block on a hung
+	// connection; shutting the socket down first makes that fail immediately
+	if(mysql_get_socket(conn) >= 0)
+		shutdown(mysql_get_socket(conn), SHUT_RDWR);
+	mysql_close(conn);
+	conn = NULL;
+}
+
+/******************************************
+ * mysql_backend_open()
+ *******************************************/
+static int mysql_backend_open(void)
+{
+	//printf("MySQL Database connection initiated\n");
+	LOG_INFO(0, "MySQL Database connection initiated\n");
+
+	conn = mysql_init(NULL);
+	if(conn == NULL)
+		return -1;
+
+	if(mysql_nb_connect()) {
+		fprintf(stderr, "%s\n", mysql_error(conn));
+		LOG_ERROR(0, "MySQL DB Connect Error: %s\n", mysql_error(conn));
+		mysql_backend_close();
+		return -1;
+	}
+	return 0;
+}
+
+/******************************************
+ * mysql_backend_load_schedule()
+ *******************************************/
+static int mysql_backend_load_schedule(struct periodic_task *tasks, unsigned int max, unsigned int *count)
+{
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+	unsigned int i;
+
+	// SELECT * FROM irrigation_table
+	if(mysql_nb_query("SELECT * FROM irrigation_table", strlen("SELECT * FROM irrigation_table"), &res)) {
+		fprintf(stderr, "%s\n", mysql_error(conn));
+		LOG_ERROR(0, "MySQL DB Query Error: %s\n", mysql_error(conn));
+		return -1;
+	}
+
+	// update periodic tasks with database parameters
+	i=0;
+	// mysql_fetch_row() returns the next database row in the form of an array of strings
+	while((row = mysql_fetch_row(res)) != NULL) {
+		// watch out not to exceed the limit
+		if(i >= max)
+			break;
+		if(storage_parse_task_row(row, &tasks[i]))
+			i++;
+	}
+	*count = i;
+
+	mysql_free_result(res);
+	LOG_INFO(0, "MySQL Database connection done\n");
+	return 0;
+}
+
+/******************************************
+ * mysql_backend_write_history()
+ * All the events go out in one multi-row INSERT.
+ *******************************************/
+static int mysql_backend_write_history(const struct run_history_event *events, unsigned int count)
+{
+	static const char head[] = "INSERT INTO run_history (task_id, planned_sec, start_sec, open_sec, result) VALUES ";
+	char *query;
+	size_t len;
+	unsigned int i;
+	int ret = 0;
+
+	query = (char*)malloc(sizeof(head) + (size_t)count * MYSQL_HISTORY_ROW_LEN);
+	if(query == NULL)
+		return -1;
+
+	memcpy(query, head, sizeof(head));
+	len = sizeof(head) - 1;
+	for(i=0; i<count; i++)
+		len += sprintf(query + len, "%s(%u,%lld,%lld,%u,%d)", i ? "," : "",
+					   events[i].task_id,
+					   (long long)events[i].planned_sec,
+					   (long long)events[i].start_sec,
+					   events[i].open_sec,
+					   events[i].result);
+
+	if(mysql_nb_query(query, len, NULL)) {
+		LOG_ERROR(0, "MySQL DB Insert Error: %s\n", mysql_error(conn));
+		ret = -1;
+	}
+	free(query);
+	return ret;
+}
+
+/******************************************
+ * mysql_backend_delete_history()
+ *******************************************/
+static int mysql_backend_delete_history(unsigned int task_id)
+{
+	char query[64];
+	int len;
+
+	len = snprintf(query, sizeof(query), "DELETE FROM run_history WHERE task_id = %u", task_id);
+	if(mysql_nb_query(query, (unsigned long)len, NULL)) {
+		LOG_ERROR(0, "MySQL DB Delete Error: %s\n", mysql_error(conn));
+		return -1;
+	}
+	return 0;
+}
+
+const struct storage_backend storage_backend_mysql = {
+	.name           = "mysql",
+	.open           = mysql_backend_open,
+	.load_schedule  = mysql_backend_load_schedule,
+	.write_history  = mysql_backend_write_history,
+	.delete_history = mysql_backend_delete_history,
+	.close          = mysql_backend_close,
+};
+
+#endif /* STORAGE_WITHOUT_MYSQL */
@@ -0,0 +1,150 @@
+#ifndef STORAGE_WITHOUT_SQLITE
+
+#include <sqlite3.h>
+#include <stdio.h>
+#include "logger.h"
+#include "storage_backend.h"
+
+/******************************************
+ *             Global Variables
+ *******************************************/
+static sqlite3 *db;
+static sqlite3_stmt *insert_history;
+
+/******************************************
+ * sqlite_backend_close()
+ *******************************************/
+static void sqlite_backend_close(void)
+{
+	sqlite3_finalize(insert_history);
+	insert_history = NULL;
+	sqlite3_close(db);
+	db = NULL;
+}
+
+/******************************************
+ * sqlite_backend_open()
+ * The tables mirror the MySQL schema, so the same rows can be copied across.
+ *******************************************/
+static int sqlite_backend_open(void)
+{
+	static const char schema[] =
+		"CREATE TABLE IF NOT EXISTS irrigation_table ("
+		"id INTEGER PRIMARY KEY, active INTEGER, start_time TEXT, end_time TEXT, freq INTEGER, duration INTEGER);"
+		"CREATE TABLE IF NOT EXISTS run_history ("
+		"task_id INTEGER, planned_sec INTEGER, start_sec INTEGER, open_sec INTEGER, result INTEGER);";
+
+	if(sqlite3_open(STORAGE_SQLITE_FILE, &db) != SQLITE_OK ||
+	   sqlite3_exec(db, schema, NULL, NULL, NULL) != SQLITE_OK ||
+	   sqlite3_prepare_v2(db, "INSERT INTO run_history VALUES (?, ?, ?, ?, ?)", -1, &insert_history, NULL) != SQLITE_OK) {
+		LOG_ERROR(0, "SQLite Error: %s\n", sqlite3_errmsg(db));
+		sqlite_backend_close();
+		return -1;
+	}
+	return 0;
+}
+
+/******************************************
+ * sqlite_backend_load_schedule()
+ *******************************************/
+static int sqlite_backend_load_schedule(struct periodic_task *tasks, unsigned int max, unsigned int *count)
+{
+	sqlite3_stmt *stmt;
+	char text[TASK_COLUMNS_NO][16];
+	char *row[TASK_COLUMNS_NO];
+	unsigned int i;
+	int c, rc;
+
+	if(sqlite3_prepare_v2(db, "SELECT * FROM irrigation_table", -1, &stmt, NULL) != SQLITE_OK) {
+		LOG_ERROR(0, "SQLite Query Error: %s\n", sqlite3_errmsg(db));
+		return -1;
+	}
+
+	// rows are handed to the common parser as strings, the way MySQL returns them
+	i=0;
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		// watch out not to exceed the limit
+		if(i >= max)
+			continue;
+		for(c=0; c<TASK_COLUMNS_NO; c++) {
+			if(sqlite3_column_type(stmt, c) == SQLITE_NULL) {
+				row[c] = NULL;
+			} else {
+				snprintf(text[c], sizeof(text[c]), "%s", (const char *)sqlite3_column_text(stmt, c));
+				row[c] = text[c];
+			}
+		}
+		if(storage_parse_task_row(row, &tasks[i]))
+			i++;
+	}
+	*count = i;
+
+	sqlite3_finalize(stmt);
+	if(rc != SQLITE_DONE) {
+		LOG_ERROR(0, "SQLite Query Error: %s\n", sqlite3_errmsg(db));
+		return -1;
+	}
+	return 0;
+}
+
+/******************************************
+ * sqlite_backend_write_history()
+ * One transaction per batch; the prepared INSERT is reused for every row.
+ *******************************************/
+static int sqlite_backend_write_history(const struct run_history_event *events, unsigned int count)
+{
+	unsigned int i;
+
+	if(sqlite3_exec(db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK)
+		goto error;
+
+	for(i=0; i<count; i++) {
+		sqlite3_bind_int64(insert_history, 1, events[i].task_id);
+		sqlite3_bind_int64(insert_history, 2, events[i].planned_sec);
+		sqlite3_bind_int64(insert_history, 3, events[i].start_sec);
+		sqlite3_bind_int64(insert_history, 4, events[i].open_sec);
+		sqlite3_bind_int(insert_history, 5, events[i].result);
+		if(sqlite3_step(insert_history) != SQLITE_DONE) {
+			sqlite3_reset(insert_history);
+			sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+			goto error;
+		}
+		sqlite3_reset(insert_history);
+	}
+
+	if(sqlite3_exec(db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK) {
+		sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+		goto error;
+	}
+	return 0;
+
+error:
+	LOG_ERROR(0, "SQLite Insert Error: %s\n", sqlite3_errmsg(db));
+	return -1;
+}
+
+/******************************************
+ * sqlite_backend_delete_history()
+ *******************************************/
+static int sqlite_backend_delete_history(unsigned int task_id)
+{
+	char query[64];
+
+	snprintf(query, sizeof(query), "DELETE FROM run_history WHERE task_id = %u", task_id);
+	if(sqlite3_exec(db, query, NULL, NULL, NULL) != SQLITE_OK) {
+		LOG_ERROR(0, "SQLite Delete Error: %s\n", sqlite3_errmsg(db));
+		return -1;
+	}
+	return 0;
+}
+
+const struct storage_backend storage_backend_sqlite = {
+	.name           = "sqlite",
+	.open           = sqlite_backend_open,
+	.load_schedule  = sqlite_backend_load_schedule,
+	.write_history  = sqlite_backend_write_history,
+	.delete_history = sqlite_backend_delete_history,
+	.close          = sqlite_backend_close,
+};
+
+#endif /* STORAGE_WITHOUT_SQLITE */
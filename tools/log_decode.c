@@ -0,0 +1,272 @@
+/******************************************
+ * log_decode
+ * Turns the binary log written by logger.c back into the text layout of log_file.csv.
+ * The segments and archives given are decoded oldest first, whatever order they are
+ * named in. With a time range only the archive frames overlapping it are decompressed.
+ *
+ * usage: log_decode [-f from_sec] [-t to_sec] [log_file.bin.N | log_file.bin-SEQ.zst ...] > log_file.csv
+ *******************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <glob.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zstd.h>
+#include "log_reader.h"
+#include "../log_archive.h"
+
+struct segment {
+	const char *path;
+	uint64_t seq;
+};
+
+// events outside [range_from, range_to] are not printed
+static int64_t range_from = INT64_MIN;
+static int64_t range_to   = INT64_MAX;
+static struct log_reader reader;
+
+/******************************************
+ * get32()
+ *******************************************/
+static uint32_t get32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/******************************************
+ * get64()
+ *******************************************/
+static uint64_t get64(const unsigned char *p)
+{
+	return get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+/******************************************
+ * has_suffix()
+ *******************************************/
+static int has_suffix(const char *path, const char *suffix)
+{
+	size_t len = strlen(path), slen = strlen(suffix);
+
+	return len > slen && strcmp(path + len - slen, suffix) == 0;
+}
+
+/******************************************
+ * is_archive()
+ *******************************************/
+static int is_archive(const char *path)
+{
+	return has_suffix(path, LOG_ARCHIVE_SUFFIX);
+}
+
+/******************************************
+ * decode_records()
+ * Prints the events of 'buf' that fall in the time range.
+ *******************************************/
+static void decode_records(const unsigned char *buf, size_t len, size_t offset, FILE *out)
+{
+	struct log_event event;
+
+	while(log_reader_next(&reader, buf, len, &offset, &event))
+		if(event.timestamp_sec >= range_from && event.timestamp_sec <= range_to)
+			log_reader_print(&event, out);
+}
+
+/******************************************
+ * decode_archive()
+ * Decodes a compressed segment (layout in log_archive.h): frame 0 for the formats,
+ * then only the frames whose time span overlaps the range.
+ * return: 0 on success, -1 if the archive is damaged
+ *******************************************/
+static int decode_archive(const unsigned char *map, size_t size, FILE *out)
+{
+	const unsigned char *seek, *times;
+	unsigned char *frame = NULL;
+	size_t offset = 0, dsize, frame_size = 0;
+	uint32_t nframes, i;
+	int64_t first, last;
+	int ret = -1;
+
+	if(size < LOG_ARCHIVE_FOOTER_BYTES || get32(map + size - 4) != LOG_ARCHIVE_SEEKABLE_MAGIC)
+		return -1;
+	nframes = get32(map + size - LOG_ARCHIVE_FOOTER_BYTES);
+	if(nframes == 0 || (uint64_t)nframes * 24 + 16 + LOG_ARCHIVE_FOOTER_BYTES > size)
+		return -1;
+	seek  = map + size - LOG_ARCHIVE_FOOTER_BYTES - (size_t)nframes * 8;
+	times = seek - 8 - (size_t)nframes * 16;
+	if(get32(seek - 8) != LOG_ARCHIVE_SKIPPABLE_MAGIC || get32(times - 8) != LOG_ARCHIVE_TIME_MAGIC)
+		return -1;
+
+	for(i=0; i<nframes; i++) {
+		size_t csize = get32(seek + 8 * i);
+
+		dsize = get32(seek + 8 * i + 4);
+		if(offset + csize > size)
+			goto out;
+		first = (int64_t)get64(times + 16 * i);
+		last  = (int64_t)get64(times + 16 * i + 8);
+		// frame 0 (the formats) is always needed
+		if(i == 0 || (last >= range_from && first <= range_to)) {
+			if(dsize > frame_size) {
+				free(frame);
+				frame_size = dsize;
+				frame = malloc(frame_size);
+				if(frame == NULL)
+					goto out;
+			}
+			if(ZSTD_decompress(frame, dsize, map + offset, csize) != dsize)
+				goto out;
+			decode_records(frame, dsize, i ? 0 : log_reader_skip_header(frame, dsize), out);
+		}
+		offset += csize;
+	}
+	ret = 0;
+out:
+	free(frame);
+	return ret;
+}
+
+/******************************************
+ * decode_file()
+ *******************************************/
+static int decode_file(const char *path, FILE *out)
+{
+	struct stat st;
+	unsigned char *map;
+	size_t offset;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if(fd < 0 || fstat(fd, &st)) {
+		perror(path);
+		if(fd >= 0)
+			close(fd);
+		return -1;
+	}
+	if(st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		perror(path);
+		return -1;
+	}
+
+	log_reader_init(&reader);
+	if(is_archive(path)) {
+		if(decode_archive(map, st.st_size, out))
+			fprintf(stderr, "%s: damaged archive\n", path);
+	} else {
+		offset = log_reader_skip_header(map, st.st_size);
+		// a preallocated segment that was never written starts with zeroes
+		if(offset == 0 && map[0] != 0)
+			fprintf(stderr, "%s: not a binary log file\n", path);
+		else
+			decode_records(map, st.st_size, offset, out);
+	}
+	log_reader_free(&reader);
+
+	munmap(map, st.st_size);
+	return 0;
+}
+
+/******************************************
+ * segment_seq()
+ * return: sequence number from the header of 'path' (from the name of an archive),
+ *         0 if it has no valid header
+ *******************************************/
+static uint64_t segment_seq(const char *path)
+{
+	struct log_file_header hdr;
+	const char *dash;
+	int fd;
+
+	if(is_archive(path)) {
+		dash = strrchr(path, '-');
+		return dash ? strtoull(dash + 1, NULL, 10) : 0;
+	}
+
+	fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return 0;
+	if(read(fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr) || !log_reader_skip_header((unsigned char *)&hdr, sizeof(hdr)))
+		hdr.segment_seq = 0;
+	close(fd);
+	return hdr.segment_seq;
+}
+
+/******************************************
+ * segment_cmp()
+ *******************************************/
+static int segment_cmp(const void *a, const void *b)
+{
+	const struct segment *sa = a, *sb = b;
+
+	return (sa->seq > sb->seq) - (sa->seq < sb->seq);
+}
+
+/******************************************
+ * main()
+ *******************************************/
+int main(int argc, char **argv)
+{
+	struct segment *segs;
+	glob_t g;
+	char **paths;
+	int i, n, opt, ret = 0;
+
+	while((opt = getopt(argc, argv, "f:t:")) != -1) {
+		switch(opt) {
+		case 'f':
+			range_from = strtoll(optarg, NULL, 10);
+			break;
+		case 't':
+			range_to = strtoll(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-f from_sec] [-t to_sec] [log segment | archive ...]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if(optind >= argc) {
+		if(glob("log_file.bin.*", 0, NULL, &g)) {
+			fprintf(stderr, "no log segments found\n");
+			return 1;
+		}
+		paths = g.gl_pathv;
+		n = g.gl_pathc;
+	} else {
+		paths = argv + optind;
+		n = argc - optind;
+	}
+
+	segs = calloc(n, sizeof(*segs));
+	if(!segs)
+		return 1;
+	for(i=0; i<n; i++) {
+		segs[i].path = paths[i];
+		segs[i].seq  = segment_seq(paths[i]);
+	}
+	qsort(segs, n, sizeof(*segs), segment_cmp);
+
+	for(i=0; i<n; i++) {
+		// a segment still on disk and its archive hold the same records
+		if(i && segs[i].seq && segs[i].seq == segs[i - 1].seq)
+			continue;
+		// sidecar indexes match the segments' glob; they hold no records
+		if(has_suffix(segs[i].path, ".idx"))
+			continue;
+		if(decode_file(segs[i].path, stdout))
+			ret = 1;
+	}
+	free(segs);
+	return ret;
+}
@@ -0,0 +1,233 @@
+/******************************************
+ * log_query
+ * Prints the log records of a time range (and optionally one task) from the live log
+ * segments. The sidecar index of every segment (<segment>.idx, see log_format.h) is
+ * used to load the formats and to start decoding next to the range instead of at the
+ * start of the segment; segments without a usable index are scanned in full.
+ *
+ * usage: log_query [-f from_sec] [-t to_sec] [-k task_id] [log_file.bin.N ...] > range.csv
+ *******************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <glob.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "log_reader.h"
+
+// timestamps are taken by the producers before the writer orders the records, so
+// they may step back by a moment; the index is searched with this much slack
+#define QUERY_SLACK_SEC 2
+
+struct segment {
+	char    *path;
+	uint64_t seq;
+};
+
+static int64_t range_from = INT64_MIN;
+static int64_t range_to   = INT64_MAX;
+static int64_t query_task = -1;
+static struct log_reader reader;
+
+/******************************************
+ * load_index()
+ * return: the entries of the index of 'path', NULL if it is missing or does not
+ *         belong to segment 'seq'; the number of entries in 'count'
+ *******************************************/
+static struct log_index_entry *load_index(const char *path, uint64_t seq, size_t *count)
+{
+	struct log_index_header hdr;
+	struct log_index_entry *entries = NULL;
+	char idx_path[4096];
+	struct stat st;
+	ssize_t len;
+	int fd;
+
+	*count = 0;
+	snprintf(idx_path, sizeof(idx_path), "%s.idx", path);
+	fd = open(idx_path, O_RDONLY);
+	if(fd < 0)
+		return NULL;
+	if(fstat(fd, &st) || read(fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr) ||
+	   hdr.magic != LOG_INDEX_MAGIC || hdr.version != LOG_INDEX_VERSION || hdr.segment_seq != seq)
+		goto out;
+
+	len = (st.st_size - sizeof(hdr)) / sizeof(*entries) * sizeof(*entries);
+	entries = malloc(len ? len : 1);
+	if(entries == NULL || read(fd, entries, len) != len) {
+		free(entries);
+		entries = NULL;
+		goto out;
+	}
+	*count = len / sizeof(*entries);
+out:
+	close(fd);
+	return entries;
+}
+
+/******************************************
+ * query_segment()
+ * return: 0 on success, -1 if the segment could not be read
+ *******************************************/
+static int query_segment(const char *path, FILE *out)
+{
+	const struct log_file_header *hdr;
+	struct log_index_entry *index;
+	struct log_event event;
+	struct stat st;
+	unsigned char *map;
+	size_t count, i;
+	size_t start, end, offset;
+	int64_t from_key, to_key;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if(fd < 0 || fstat(fd, &st)) {
+		perror(path);
+		if(fd >= 0)
+			close(fd);
+		return -1;
+	}
+	if((size_t)st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return 0;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		perror(path);
+		return -1;
+	}
+	start = log_reader_skip_header(map, st.st_size);
+	if(start == 0) {
+		munmap(map, st.st_size);
+		return 0;
+	}
+	hdr = (const struct log_file_header *)map;
+	end = st.st_size;
+
+	from_key = range_from > INT64_MIN + QUERY_SLACK_SEC ? range_from - QUERY_SLACK_SEC : INT64_MIN;
+	to_key   = range_to < INT64_MAX - QUERY_SLACK_SEC ? range_to + QUERY_SLACK_SEC : INT64_MAX;
+
+	log_reader_init(&reader);
+	index = load_index(path, hdr->segment_seq, &count);
+	for(i=0; i<count; i++) {
+		if(index[i].offset < start || index[i].offset >= (size_t)st.st_size)
+			continue;
+		// formats: read every DICT record (and the event right behind it)
+		if(index[i].task_id == LOG_INDEX_DICT) {
+			offset = index[i].offset;
+			log_reader_next(&reader, map, st.st_size, &offset, &event);
+			continue;
+		}
+		// first record to decode: the last entry for our task (or for all) before the range
+		if((index[i].task_id == LOG_INDEX_ANY || index[i].task_id == query_task) &&
+		   index[i].timestamp_sec < from_key && index[i].offset > start)
+			start = index[i].offset;
+		// last: the first entry for all tasks past the range
+		if(index[i].task_id == LOG_INDEX_ANY && index[i].timestamp_sec > to_key &&
+		   index[i].offset < end)
+			end = index[i].offset;
+	}
+
+	offset = start;
+	while(offset < end && log_reader_next(&reader, map, end, &offset, &event)) {
+		if(event.timestamp_sec < range_from || event.timestamp_sec > range_to)
+			continue;
+		if(query_task >= 0 && event.task_id != (uint64_t)query_task)
+			continue;
+		log_reader_print(&event, out);
+	}
+
+	log_reader_free(&reader);
+	free(index);
+	munmap(map, st.st_size);
+	return 0;
+}
+
+/******************************************
+ * segment_seq()
+ * return: sequence number from the header of 'path', 0 if it is not a log segment
+ *******************************************/
+static uint64_t segment_seq(const char *path)
+{
+	struct log_file_header hdr;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return 0;
+	if(read(fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr) || !log_reader_skip_header((unsigned char *)&hdr, sizeof(hdr)))
+		hdr.segment_seq = 0;
+	close(fd);
+	return hdr.segment_seq;
+}
+
+/******************************************
+ * segment_cmp()
+ *******************************************/
+static int segment_cmp(const void *a, const void *b)
+{
+	const struct segment *sa = a, *sb = b;
+
+	return (sa->seq > sb->seq) - (sa->seq < sb->seq);
+}
+
+/******************************************
+ * main()
+ *******************************************/
+int main(int argc, char **argv)
+{
+	struct segment *segs;
+	glob_t g;
+	char **paths;
+	int i, n, opt, ret = 0;
+
+	while((opt = getopt(argc, argv, "f:t:k:")) != -1) {
+		switch(opt) {
+		case 'f':
+			range_from = strtoll(optarg, NULL, 10);
+			break;
+		case 't':
+			range_to = strtoll(optarg, NULL, 10);
+			break;
+		case 'k':
+			query_task = strtoll(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-f from_sec] [-t to_sec] [-k task_id] [log segment ...]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if(optind >= argc) {
+		if(glob("log_file.bin.*", 0, NULL, &g)) {
+			fprintf(stderr, "no log segments found\n");
+			return 1;
+		}
+		paths = g.gl_pathv;
+		n = g.gl_pathc;
+	} else {
+		paths = argv + optind;
+		n = argc - optind;
+	}
+
+	segs = calloc(n, sizeof(*segs));
+	if(!segs)
+		return 1;
+	for(i=0; i<n; i++) {
+		segs[i].path = paths[i];
+		segs[i].seq  = segment_seq(paths[i]);
+	}
+	qsort(segs, n, sizeof(*segs), segment_cmp);
+
+	// indexes and never written segments have no sequence number
+	for(i=0; i<n; i++)
+		if(segs[i].seq && query_segment(segs[i].path, stdout))
+			ret = 1;
+	free(segs);
+	return ret;
+}
@@ -0,0 +1,263 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "log_reader.h"
+
+/******************************************
+ * log_reader_init()
+ *******************************************/
+void log_reader_init(struct log_reader *reader)
+{
+	memset(reader, 0, sizeof(*reader));
+}
+
+/******************************************
+ * log_reader_free()
+ *******************************************/
+void log_reader_free(struct log_reader *reader)
+{
+	unsigned int i;
+
+	for(i=0; i<LOG_READER_DICT_SIZE; i++)
+		free(reader->dict[i]);
+	memset(reader, 0, sizeof(*reader));
+}
+
+/******************************************
+ * log_reader_skip_header()
+ * return: size of the file header at the start of 'buf', 0 if there is none
+ *******************************************/
+size_t log_reader_skip_header(const unsigned char *buf, size_t len)
+{
+	struct log_file_header hdr;
+
+	if(len < sizeof(hdr))
+		return 0;
+	memcpy(&hdr, buf, sizeof(hdr));
+	if(hdr.magic != LOG_FORMAT_MAGIC || hdr.version != LOG_FORMAT_VERSION)
+		return 0;
+	return sizeof(hdr);
+}
+
+/******************************************
+ * log_reader_args()
+ * Decodes the arguments of an event, typed and counted after its format string
+ * exactly the way logger_capture_args() captured them.
+ * return: pointer past the arguments, NULL if they run past 'end'
+ *******************************************/
+static const unsigned char *log_reader_args(const char *fmt, const unsigned char *p, const unsigned char *end, struct log_event *event)
+{
+	struct log_conv conv;
+	const char *f = fmt;
+	struct log_arg *arg;
+	unsigned int n = 0, used;
+	int pass, type;
+	uint64_t v;
+
+	while(n < LOG_MAX_ARGS && (f = log_format_next_conv(f, &conv)) != NULL) {
+		for(pass=0; pass<conv.star_width + conv.star_prec + 1; pass++) {
+			type = (pass < conv.star_width + conv.star_prec) ? LOG_ARG_INT : conv.arg_type;
+			if(type == 0 || n == LOG_MAX_ARGS)
+				break;
+			arg = &event->args[n++];
+			arg->type = (uint8_t)type;
+			switch(type) {
+			case LOG_ARG_DOUBLE:
+				if(p + sizeof(double) > end)
+					return NULL;
+				memcpy(&arg->v.d, p, sizeof(double));
+				p += sizeof(double);
+				break;
+			case LOG_ARG_STR:
+				if(p >= end || p + 1 + *p > end)
+					return NULL;
+				arg->v.s.len = *p;
+				arg->v.s.p   = (const char *)p + 1;
+				p += 1 + *p;
+				break;
+			default:
+				used = log_varint_get(p, end, &v);
+				if(used == 0)
+					return NULL;
+				p += used;
+				if(type == LOG_ARG_INT)
+					arg->v.i = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+				else
+					arg->v.u = v;
+				break;
+			}
+		}
+	}
+	event->nargs = n;
+	return p;
+}
+
+/******************************************
+ * log_reader_next()
+ * params: - struct log_reader* reader: decoding state, updated by DICT records
+ * 		   - const unsigned char* buf: binary log data
+ * 		   - size_t len: bytes in 'buf'
+ * 		   - size_t* offset: current position in 'buf', advanced past the records read
+ * 		   - struct log_event* event: receives the next EVENT record
+ * return: 1 if an event was read, 0 at the end of the data (or at a torn/zeroed tail)
+ *******************************************/
+int log_reader_next(struct log_reader *reader, const unsigned char *buf, size_t len, size_t *offset, struct log_event *event)
+{
+	const unsigned char *end = buf + len;
+	const unsigned char *p;
+	uint64_t id, v;
+	unsigned int used;
+	char *fmt;
+
+	while(*offset < len) {
+		p = buf + *offset;
+
+		if(*p == LOG_REC_DICT) {
+			p++;
+			if((used = log_varint_get(p, end, &id)) == 0 || id >= LOG_READER_DICT_SIZE)
+				return 0;
+			p += used;
+			if((used = log_varint_get(p, end, &v)) == 0 || v > (uint64_t)(end - p - used))
+				return 0;
+			p += used;
+			fmt = (char*)malloc(v + 1);
+			if(fmt == NULL)
+				return 0;
+			memcpy(fmt, p, v);
+			fmt[v] = '\0';
+			free(reader->dict[id]);
+			reader->dict[id] = fmt;
+			*offset = (p + v) - buf;
+		} else if(*p == LOG_REC_EVENT) {
+			p++;
+			if((used = log_varint_get(p, end, &id)) == 0 || id >= LOG_READER_DICT_SIZE)
+				return 0;
+			p += used;
+			event->fmt_id = (uint32_t)id;
+			if((used = log_varint_get(p, end, &v)) == 0)
+				return 0;
+			p += used;
+			event->task_id = (uint32_t)v;
+			if((used = log_varint_get(p, end, &v)) == 0)
+				return 0;
+			p += used;
+			event->timestamp_sec = (int64_t)v;
+			// without its format an event cannot even be skipped
+			event->fmt = reader->dict[id];
+			if(event->fmt == NULL)
+				return 0;
+			p = log_reader_args(event->fmt, p, end, event);
+			if(p == NULL)
+				return 0;
+			*offset = p - buf;
+			return 1;
+		} else {
+			// zero fill or garbage: nothing sensible follows
+			return 0;
+		}
+	}
+	return 0;
+}
+
+/******************************************
+ * log_reader_print()
+ * Writes one event in the log_file.csv layout:
+ *     <epoch sec>,-,<y>:<m>:<d>:<h>:<min>:<s>:, <formatted message>
+ *******************************************/
+void log_reader_print(const struct log_event *event, FILE *out)
+{
+	const struct log_arg *arg;
+	struct log_conv conv;
+	struct tm timestamp;
+	time_t timestamp_sec = (time_t)event->timestamp_sec;
+	const char *p, *next;
+	char spec[64];
+	int stars[2];
+	unsigned int nstars, n = 0, i, k;
+	int64_t v;
+	char c;
+
+	localtime_r(&timestamp_sec, &timestamp);
+	fprintf(out, "%lu,-,%d:%d:%d:%d:%d:%d:, ", (unsigned long)event->timestamp_sec,
+			timestamp.tm_year + 1900,
+			timestamp.tm_mon + 1,
+			timestamp.tm_mday,
+			timestamp.tm_hour,
+			timestamp.tm_min,
+			timestamp.tm_sec);
+
+	p = event->fmt;
+	while((next = log_format_next_conv(p, &conv)) != NULL) {
+		fwrite(p, 1, conv.start - p, out);
+		p = next;
+		c = conv.start[conv.len - 1];
+
+		if(conv.arg_type == 0) {
+			if(c == '%')
+				fputc('%', out);
+			else
+				fwrite(conv.start, 1, conv.len, out);
+			continue;
+		}
+
+		// '*' arguments come in front of the value
+		nstars = 0;
+		while(nstars < (unsigned int)(conv.star_width + conv.star_prec) && n < event->nargs)
+			stars[nstars++] = (int)event->args[n++].v.i;
+		if(n >= event->nargs) {
+			// not captured (more than LOG_MAX_ARGS): print the specification as written
+			fwrite(conv.start, 1, conv.len, out);
+			continue;
+		}
+		arg = &event->args[n++];
+
+		// rebuild the specification without the length modifier, with the stars resolved
+		k = 0;
+		nstars = 0;
+		for(i=0; i<conv.len - 1 && k < sizeof(spec) - 24; i++) {
+			if(conv.start[i] == '*')
+				k += snprintf(spec + k, sizeof(spec) - k, "%d", stars[nstars++]);
+			else if(!strchr("hlLqjzt", conv.start[i]))
+				spec[k++] = conv.start[i];
+		}
+
+		switch(arg->type) {
+		case LOG_ARG_INT:
+		case LOG_ARG_UINT:
+			if(c == 'c') {
+				snprintf(spec + k, sizeof(spec) - k, "c");
+				fprintf(out, spec, (int)arg->v.i);
+			} else {
+				// the value was captured with the width printf would have used;
+				// only the h/hh narrowing is left to do
+				v = arg->v.i;
+				if(strcmp(conv.length, "hh") == 0)
+					v = (arg->type == LOG_ARG_INT) ? (int64_t)(signed char)v : (int64_t)(unsigned char)v;
+				else if(strcmp(conv.length, "h") == 0)
+					v = (arg->type == LOG_ARG_INT) ? (int64_t)(short)v : (int64_t)(unsigned short)v;
+				snprintf(spec + k, sizeof(spec) - k, "ll%c", c);
+				fprintf(out, spec, v);
+			}
+			break;
+		case LOG_ARG_DOUBLE:
+			snprintf(spec + k, sizeof(spec) - k, "%c", c);
+			fprintf(out, spec, arg->v.d);
+			break;
+		case LOG_ARG_STR:
+			snprintf(spec + k, sizeof(spec) - k, "s");
+			{
+				char str[LOG_MAX_STR_LEN + 1];
+
+				memcpy(str, arg->v.s.p, arg->v.s.len);
+				str[arg->v.s.len] = '\0';
+				fprintf(out, spec, str);
+			}
+			break;
+		case LOG_ARG_PTR:
+			snprintf(spec + k, sizeof(spec) - k, "p");
+			fprintf(out, spec, (void*)(uintptr_t)arg->v.u);
+			break;
+		}
+	}
+	fputs(p, out);
+}
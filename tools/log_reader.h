@@ -0,0 +1,54 @@
+#ifndef LOG_READER_H
+#define LOG_READER_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "../log_format.h"
+
+/******************************************
+ *                Defines
+ *******************************************/
+#define LOG_READER_DICT_SIZE 65536
+
+/******************************************
+ *              Data Types
+ *******************************************/
+// Decoding state of one binary log stream: the format strings defined so far.
+struct log_reader {
+	char *dict[LOG_READER_DICT_SIZE];
+};
+
+struct log_arg {
+	uint8_t type; // LOG_ARG_*
+	union {
+		int64_t  i;
+		uint64_t u;
+		double   d;
+		struct {
+			const char *p;
+			uint8_t     len;
+		} s;
+	} v;
+};
+
+// one decoded EVENT record; string arguments point into the log data
+struct log_event {
+	uint32_t       fmt_id;
+	uint32_t       task_id;
+	int64_t        timestamp_sec;
+	const char    *fmt;
+	unsigned int   nargs;
+	struct log_arg args[LOG_MAX_ARGS];
+};
+
+/******************************************
+ *            Function Prototypes
+ *******************************************/
+void   log_reader_init(struct log_reader *reader);
+void   log_reader_free(struct log_reader *reader);
+size_t log_reader_skip_header(const unsigned char *buf, size_t len);
+int    log_reader_next(struct log_reader *reader, const unsigned char *buf, size_t len, size_t *offset, struct log_event *event);
+void   log_reader_print(const struct log_event *event, FILE *out);
+
+#endif /* LOG_READER_H */
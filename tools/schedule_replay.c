@@ -0,0 +1,394 @@
+/******************************************
+ * schedule_replay
+ * Runs the scheduler on a virtual clock over a time range and lists the exact firings
+ * the task threads of the app would make, or diffs them against a recorded trace.
+ *
+ * usage: schedule_replay [-s snapshot] [-f from_sec] [-t to_sec] [-w warmup_sec]
+ *                        [-g golden.csv | -l log_file.csv] [-d late_sec] [-a]
+ *
+ *   -s  schedule from a schedule snapshot (schedule_snapshot.bin) instead of the
+ *       irrigation_table of the storage backend selected by VG_STORAGE, as the app does
+ *   -f  start of the range, seconds since epoch (default: the last local midnight)
+ *   -t  end of the range (default: one day after the start)
+ *   -w  how long before the range the task threads started (default one day)
+ *   -g  compare with a trace written earlier by this tool
+ *   -l  compare with the "fired planned" lines of a decoded log (tools/log_decode);
+ *       the app logs one for every firing, whether the task has a valve or not
+ *   -d  a firing more than late_sec after its planned time is late (default 2)
+ *   -a  list the matching firings too
+ *
+ * Every task thread is replayed like run_periodic_task(): it starts warmup_sec before the
+ * range (the firing times of a thread can depend on when it started), a firing keeps it
+ * busy for the task's duration if TASK_GPIOS (periodic_task.h) gives the task a valve and
+ * the HAL is assumed up, and it then sleeps until the wake-up schedule_next_action() returned.
+ * Local time is used as on the controller: run it with the controller's TZ.
+ *
+ * Without -g/-l the trace is printed, the golden trace format:
+ *     task_id,planned_sec,time,duration
+ * With -g/-l only the differences are printed, and the exit status is 1 if there are any:
+ *     result,task_id,planned_sec,observed_sec,delay_sec,time
+ * result is "missing" (planned, never seen), "extra" (seen, not planned), "late" (seen
+ * more than late_sec after the planned time) or "ok" (-a). A firing seen up to one
+ * interval of the task after its planned time counts as that firing.
+ *******************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../scheduler.h"
+#include "../schedule_snapshot.h"
+#include "../storage_backend.h"
+
+/******************************************
+ *                Defines
+ *******************************************/
+#define REPLAY_TASKS_MAX  256
+#define REPLAY_LINE_LEN   1024
+#define REPLAY_LATE_SEC   2
+#define REPLAY_WARMUP_SEC 86400
+
+/******************************************
+ *              Data Types
+ *******************************************/
+struct firing {
+	unsigned int task_id;
+	int64_t      sec;     // planned time (replay, golden trace) or time of the firing line (log)
+	int          matched;
+};
+
+struct firing_list {
+	struct firing *v;
+	size_t         count;
+	size_t         size;
+};
+
+/******************************************
+ *             Global Variables
+ *******************************************/
+static struct periodic_task tasks[REPLAY_TASKS_MAX];
+static unsigned int task_count;
+
+/******************************************
+ * firing_add()
+ * return: 0 on success, -1 if out of memory
+ *******************************************/
+static int firing_add(struct firing_list *list, unsigned int task_id, int64_t sec)
+{
+	struct firing *v;
+
+	if(list->count == list->size) {
+		v = realloc(list->v, (list->size ? list->size * 2 : 1024) * sizeof(*v));
+		if(v == NULL)
+			return -1;
+		list->v    = v;
+		list->size = list->size ? list->size * 2 : 1024;
+	}
+	list->v[list->count].task_id = task_id;
+	list->v[list->count].sec     = sec;
+	list->v[list->count].matched = 0;
+	list->count++;
+	return 0;
+}
+
+/******************************************
+ * firing_cmp()
+ * Orders by task, then by time.
+ *******************************************/
+static int firing_cmp(const void *a, const void *b)
+{
+	const struct firing *fa = a, *fb = b;
+
+	if(fa->task_id != fb->task_id)
+		return fa->task_id < fb->task_id ? -1 : 1;
+	return (fa->sec > fb->sec) - (fa->sec < fb->sec);
+}
+
+/******************************************
+ * format_time()
+ *******************************************/
+static const char *format_time(int64_t sec, char *buf, size_t len)
+{
+	time_t t = (time_t)sec;
+	struct tm tm;
+
+	localtime_r(&t, &tm);
+	strftime(buf, len, "%Y-%m-%d %H:%M:%S", &tm);
+	return buf;
+}
+
+/******************************************
+ * task_has_valve()
+ * return: 1 if the app opens a valve (and sleeps) when 'task' fires, 0 otherwise
+ *******************************************/
+static int task_has_valve(const struct periodic_task *task)
+{
+	static const unsigned int gpios[] = TASK_GPIOS;
+
+	return task->id >= 1 && task->id <= sizeof(gpios)/sizeof(gpios[0]) && gpios[task->id - 1] != 0;
+}
+
+/******************************************
+ * find_task()
+ * return: the task with 'id', NULL if it is not in the schedule
+ *******************************************/
+static const struct periodic_task *find_task(unsigned int id)
+{
+	unsigned int i;
+
+	for(i=0; i<task_count; i++)
+		if(tasks[i].id == id)
+			return &tasks[i];
+	return NULL;
+}
+
+/******************************************
+ * replay_task()
+ * Runs one task thread from 'start' and collects its firings between 'from' and 'to'
+ * (excluded).
+ * return: 0 on success, -1 if out of memory
+ *******************************************/
+static int replay_task(const struct periodic_task *task, int64_t start, int64_t from, int64_t to, struct firing_list *out)
+{
+	struct schedule_action action;
+	int64_t now = start;
+	unsigned int busy_sec = task_has_valve(task) ? task->duration : 0;
+
+	while(now < to) {
+		schedule_next_action(task, (time_t)now, &action);
+		if(action.fire) {
+			if(action.planned_sec >= from && firing_add(out, task->id, action.planned_sec))
+				return -1;
+			now += busy_sec;
+		}
+		// the wake-up time is absolute; a run past it wakes up right away
+		now = action.wake_sec > now ? action.wake_sec : now;
+	}
+	return 0;
+}
+
+/******************************************
+ * load_golden()
+ * Reads a trace written by this tool: task_id,planned_sec,...
+ * return: 0 on success, -1 on error
+ *******************************************/
+static int load_golden(const char *path, struct firing_list *out)
+{
+	char line[REPLAY_LINE_LEN];
+	unsigned int task_id;
+	long long sec;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if(fp == NULL) {
+		perror(path);
+		return -1;
+	}
+	while(fgets(line, sizeof(line), fp) != NULL) {
+		if(sscanf(line, "%u,%lld,", &task_id, &sec) != 2)
+			continue; // header, comments
+		if(firing_add(out, task_id, sec)) {
+			fclose(fp);
+			return -1;
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+/******************************************
+ * load_log()
+ * Reads the firings of a decoded log:
+ *     <sec>,-,<y:m:d:h:m:s>:, task #,<id>, fired planned ,<planned_sec>,
+ * return: 0 on success, -1 on error
+ *******************************************/
+static int load_log(const char *path, struct firing_list *out)
+{
+	char line[REPLAY_LINE_LEN];
+	const char *p;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if(fp == NULL) {
+		perror(path);
+		return -1;
+	}
+	while(fgets(line, sizeof(line), fp) != NULL) {
+		if(strstr(line, "fired planned") == NULL || (p = strstr(line, "task #,")) == NULL)
+			continue;
+		if(firing_add(out, (unsigned int)atoi(p + strlen("task #,")), strtoll(line, NULL, 10))) {
+			fclose(fp);
+			return -1;
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+/******************************************
+ * report()
+ *******************************************/
+static void report(const char *result, unsigned int task_id, int64_t planned, int64_t observed, int has_observed)
+{
+	char buf[32];
+
+	if(has_observed && planned)
+		printf("%s,%u,%lld,%lld,%lld,%s\n", result, task_id, (long long)planned, (long long)observed,
+			   (long long)(observed - planned), format_time(planned, buf, sizeof(buf)));
+	else if(has_observed)
+		printf("%s,%u,,%lld,,%s\n", result, task_id, (long long)observed, format_time(observed, buf, sizeof(buf)));
+	else
+		printf("%s,%u,%lld,,,%s\n", result, task_id, (long long)planned, format_time(planned, buf, sizeof(buf)));
+}
+
+/******************************************
+ * diff_firings()
+ * Pairs every planned firing with the first firing of the same task seen from late_sec
+ * before it up to one task interval after it, and prints what does not pair up.
+ * return: number of differences
+ *******************************************/
+static unsigned long diff_firings(struct firing_list *planned, struct firing_list *seen,
+								  int64_t from, int64_t to, int64_t late_sec, int all)
+{
+	const struct periodic_task *task;
+	struct firing *e, *o;
+	unsigned long missing = 0, extra = 0, late = 0, ok = 0;
+	int64_t window;
+	size_t i, j = 0;
+
+	qsort(planned->v, planned->count, sizeof(planned->v[0]), firing_cmp);
+	qsort(seen->v, seen->count, sizeof(seen->v[0]), firing_cmp);
+
+	for(i=0; i<planned->count; i++) {
+		e = &planned->v[i];
+		task = find_task(e->task_id);
+		window = task ? (int64_t)task->freq * 60 : late_sec + 1;
+
+		// seen firings before this one's window stay unmatched: extras
+		while(j < seen->count && (seen->v[j].task_id < e->task_id ||
+		      (seen->v[j].task_id == e->task_id && seen->v[j].sec < e->sec - late_sec)))
+			j++;
+		o = j < seen->count ? &seen->v[j] : NULL;
+		if(o == NULL || o->task_id != e->task_id || o->sec >= e->sec + window) {
+			report("missing", e->task_id, e->sec, 0, 0);
+			missing++;
+			continue;
+		}
+		e->matched = o->matched = 1;
+		j++;
+		if(o->sec - e->sec > late_sec) {
+			report("late", e->task_id, e->sec, o->sec, 1);
+			late++;
+		} else {
+			if(all)
+				report("ok", e->task_id, e->sec, o->sec, 1);
+			ok++;
+		}
+	}
+
+	for(j=0; j<seen->count; j++) {
+		o = &seen->v[j];
+		if(!o->matched && o->sec >= from && o->sec < to) {
+			report("extra", o->task_id, 0, o->sec, 1);
+			extra++;
+		}
+	}
+
+	fprintf(stderr, "%zu planned: %lu ok, %lu late, %lu missing; %lu extra\n",
+			planned->count, ok, late, missing, extra);
+	return missing + late + extra;
+}
+
+/******************************************
+ * main()
+ *******************************************/
+int main(int argc, char **argv)
+{
+	struct firing_list planned = {0}, seen = {0};
+	const struct storage_backend *backend;
+	const char *snapshot = NULL, *golden = NULL, *log_path = NULL;
+	int64_t from = -1, to = -1, warmup = REPLAY_WARMUP_SEC, late_sec = REPLAY_LATE_SEC;
+	unsigned int i;
+	int opt, all = 0;
+	time_t now;
+	struct tm tm;
+	char buf[32];
+
+	while((opt = getopt(argc, argv, "s:f:t:w:g:l:d:a")) != -1) {
+		switch(opt) {
+		case 's':
+			snapshot = optarg;
+			break;
+		case 'f':
+			from = strtoll(optarg, NULL, 10);
+			break;
+		case 't':
+			to = strtoll(optarg, NULL, 10);
+			break;
+		case 'w':
+			warmup = strtoll(optarg, NULL, 10);
+			break;
+		case 'g':
+			golden = optarg;
+			break;
+		case 'l':
+			log_path = optarg;
+			break;
+		case 'd':
+			late_sec = strtoll(optarg, NULL, 10);
+			break;
+		case 'a':
+			all = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s snapshot] [-f from_sec] [-t to_sec] [-w warmup_sec] [-g golden.csv | -l log_file.csv] [-d late_sec] [-a]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if(from < 0) {
+		now = time(NULL);
+		localtime_r(&now, &tm);
+		tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+		tm.tm_isdst = -1;
+		from = mktime(&tm);
+	}
+	if(to < 0)
+		to = from + 86400;
+
+	// the same schedule sources as the app
+	if(snapshot) {
+		if(schedule_snapshot_load(snapshot, tasks, REPLAY_TASKS_MAX, &task_count)) {
+			fprintf(stderr, "%s: no usable schedule snapshot\n", snapshot);
+			return 2;
+		}
+	} else {
+		backend = storage_backend_find(getenv(STORAGE_BACKEND_ENV));
+		if(backend == NULL || storage_load_schedule(backend, tasks, REPLAY_TASKS_MAX, &task_count)) {
+			fprintf(stderr, "could not load the schedule from %s storage\n", backend ? backend->name : "unknown");
+			return 2;
+		}
+		storage_close(backend);
+	}
+
+	for(i=0; i<task_count; i++)
+		if(replay_task(&tasks[i], from - warmup, from, to, &planned)) {
+			fprintf(stderr, "out of memory\n");
+			return 2;
+		}
+
+	if(golden == NULL && log_path == NULL) {
+		qsort(planned.v, planned.count, sizeof(planned.v[0]), firing_cmp);
+		printf("task_id,planned_sec,time,duration\n");
+		for(i=0; i<planned.count; i++)
+			printf("%u,%lld,%s,%u\n", planned.v[i].task_id, (long long)planned.v[i].sec,
+				   format_time(planned.v[i].sec, buf, sizeof(buf)), find_task(planned.v[i].task_id)->duration);
+		return 0;
+	}
+
+	if(golden ? load_golden(golden, &seen) : load_log(log_path, &seen))
+		return 2;
+	printf("result,task_id,planned_sec,observed_sec,delay_sec,time\n");
+	return diff_firings(&planned, &seen, from, to, late_sec, all) ? 1 : 0;
+}
@@ -0,0 +1,516 @@
+/******************************************
+ * verify_schedule
+ * Exhaustive check of schedule_next_action() (the time segment logic of the task
+ * threads) against a brute-force oracle.
+ *
+ * usage: verify_schedule [-j workers] [-q freq,freq,...] [-r sec,sec,...] [-d YYYY-MM-DD ...]
+ *                        [-m step_min | -x]
+ *
+ * For every day, frequency, start minute and end minute (0..1439 each, every step_min):
+ *  - every minute of the day as the current time: the result of schedule_next_action()
+ *    is compared with the oracle;
+ *  - for every run duration (seconds), a task thread replayed from midnight as
+ *    run_periodic_task() runs it: fire, busy for the duration, sleep to the wake-up it
+ *    got (at once if the run went past it), including durations of a whole interval and
+ *    more. Every action it takes is compared with the oracle, and after a late wake-up a
+ *    firing the run covered must be reported missed by schedule_next_action() at the
+ *    planned wake-up, as run_periodic_task() checks it.
+ * Defaults: frequencies 1,7,45,90 (dividing and not dividing the windows), durations
+ * 1,300,2700,5400 (short, equal to the 45 and 90 minute intervals, longer than the 45),
+ * start/end every 13 minutes (every residue of the frequencies comes up), one plain day
+ * and every DST switch day of the current year in the local time zone (TZ; run it with
+ * the controller's). That is about 1e9 calls, a few minutes on a four core laptop at
+ * some 1.5 million calls per second and core. -x checks every start and end minute, 3e9
+ * calls per frequency and day plus the replays: hours, for a large build machine.
+ * Processes rather than threads because localtime_r() and mktime() serialize on a lock
+ * inside the C library.
+ *
+ * The oracle, in local time as configured: the window of day X opens at start on X and
+ * closes at end on X (end on X+1 if end < start, start on X+1 if end == start: around the
+ * clock). It is cut into whole intervals of freq minutes from its start; the task fires
+ * at the start of every interval, a partial interval at the end of the window does not
+ * fire. The firings of the windows of the previous, the same and the next day are listed
+ * one by one and every current time t is checked against them:
+ *   missed_firing   the oracle fires at t, schedule_next_action() does not
+ *   extra_firing    schedule_next_action() fires at t, the oracle does not
+ *   wrong_planned   fires at t but planned_sec is not t
+ *   no_progress     the next wake-up is not after t
+ *   skipped_firing  the next wake-up is after the oracle's next firing
+ *   unreported_miss (replay) a firing passed during a run and the missed-run check of
+ *                   run_periodic_task() does not see it
+ * (wake-ups earlier than the next firing are allowed: the task just sleeps again; a
+ * firing covered by a run is lost, as on the controller, but has to be reported)
+ * The counts are printed per kind of window and DST/plain day with the first example of
+ * each kind of mismatch; the exit status is 1 if there is any mismatch.
+ *******************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "../scheduler.h"
+
+/******************************************
+ *                Defines
+ *******************************************/
+#define VERIFY_FREQS_MAX    32
+#define VERIFY_DURATIONS_MAX 16
+#define VERIFY_DAYS_MAX     16
+#define VERIFY_STEP_MIN     13  // default start/end step; -x is 1
+#define VERIFY_FIRINGS_MAX  (3 * 1500 + 16) // three days of firings at freq 1
+#define VERIFY_PROGRESS_SEC 30
+
+// mismatch kinds
+#define MISMATCH_MISSED_FIRING  0
+#define MISMATCH_EXTRA_FIRING   1
+#define MISMATCH_WRONG_PLANNED  2
+#define MISMATCH_NO_PROGRESS    3
+#define MISMATCH_SKIPPED_FIRING 4
+#define MISMATCH_UNREPORTED     5
+#define MISMATCH_KINDS          6
+
+// window kinds
+#define WINDOW_START_BEFORE_END 0
+#define WINDOW_START_AFTER_END  1 // crosses midnight
+#define WINDOW_START_IS_END     2 // around the clock
+#define WINDOW_KINDS            3
+
+/******************************************
+ *              Data Types
+ *******************************************/
+struct verify_example {
+	unsigned int start_min;
+	unsigned int end_min;
+	unsigned int freq;
+	unsigned int duration;     // 0: per-minute check, no replay
+	int64_t      current_sec;
+	int          fire;
+	int64_t      planned_sec;
+	int64_t      wake_sec;
+	int          oracle_fire;
+	int64_t      oracle_next_sec;
+};
+
+// shared by the worker processes (MAP_SHARED); atomics work across processes
+struct verify_shared {
+	atomic_uint           next_unit;
+	atomic_uint           units_done;
+	atomic_ulong          calls;
+	atomic_ulong          mismatches[MISMATCH_KINDS][WINDOW_KINDS][2];
+	atomic_flag           example_taken[MISMATCH_KINDS];
+	struct verify_example example[MISMATCH_KINDS];
+};
+
+/******************************************
+ *             Global Variables
+ *******************************************/
+static const char *mismatch_names[MISMATCH_KINDS] = {
+	"missed_firing", "extra_firing", "wrong_planned", "no_progress", "skipped_firing", "unreported_miss"
+};
+static const char *window_names[WINDOW_KINDS] = {"start<end", "start>end", "start==end"};
+
+static unsigned int freqs[VERIFY_FREQS_MAX] = {1, 7, 45, 90};
+static unsigned int freq_count = 4;
+static unsigned int durations[VERIFY_DURATIONS_MAX] = {1, 300, 2700, 5400};
+static unsigned int duration_count = 4;
+static time_t       days[VERIFY_DAYS_MAX]; // local midnights
+static int          day_is_dst_switch[VERIFY_DAYS_MAX];
+static unsigned int day_count;
+static unsigned int step_min = VERIFY_STEP_MIN;
+
+static struct verify_shared *shared;
+
+/******************************************
+ * local_time()
+ * return: seconds since epoch of hh:mm on the local calendar day of 'midnight' plus
+ *         'day_offset' days, as mktime() resolves it (DST decided by the date)
+ *******************************************/
+static time_t local_time(time_t midnight, int day_offset, unsigned int minute)
+{
+	struct tm tm;
+
+	localtime_r(&midnight, &tm);
+	tm.tm_mday += day_offset;
+	tm.tm_hour  = minute / 60;
+	tm.tm_min   = minute % 60;
+	tm.tm_sec   = 0;
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
+
+/******************************************
+ * oracle_firings()
+ * Lists the firings of the windows opening on the day before, on and after 'midnight'.
+ * return: number of firings in 'out', in ascending order
+ *******************************************/
+static unsigned int oracle_firings(time_t midnight, unsigned int start_min, unsigned int end_min,
+								   unsigned int freq, int64_t *out)
+{
+	int64_t open, close, t;
+	unsigned int n = 0;
+	int d;
+
+	for(d=-1; d<=1; d++) {
+		open = local_time(midnight, d, start_min);
+		if(end_min > start_min)
+			close = local_time(midnight, d, end_min);
+		else if(end_min < start_min)
+			close = local_time(midnight, d + 1, end_min);
+		else
+			close = local_time(midnight, d + 1, start_min);
+		for(t=open; t + (int64_t)freq * 60 <= close && n < VERIFY_FIRINGS_MAX; t += (int64_t)freq * 60)
+			out[n++] = t;
+	}
+	return n;
+}
+
+/******************************************
+ * record_mismatch()
+ *******************************************/
+static void record_mismatch(unsigned int kind, unsigned int window, int dst, const struct periodic_task *task,
+							unsigned int duration, int64_t now, const struct schedule_action *action,
+							int oracle_fire, int64_t oracle_next)
+{
+	struct verify_example *ex = &shared->example[kind];
+
+	atomic_fetch_add_explicit(&shared->mismatches[kind][window][dst], 1, memory_order_relaxed);
+	if(atomic_flag_test_and_set(&shared->example_taken[kind]))
+		return;
+	ex->start_min       = task->start_hour * 60 + task->start_min;
+	ex->end_min         = task->end_hour * 60 + task->end_min;
+	ex->freq            = task->freq;
+	ex->duration        = duration;
+	ex->current_sec     = now;
+	ex->fire            = action->fire;
+	ex->planned_sec     = action->planned_sec;
+	ex->wake_sec        = action->wake_sec;
+	ex->oracle_fire     = oracle_fire;
+	ex->oracle_next_sec = oracle_next;
+}
+
+/******************************************
+ * check_action()
+ * Compares what schedule_next_action() returned at 'now' with the oracle.
+ * params: - unsigned int* f: index of the first firing not before the previous 'now';
+ *           'now' never goes back between the calls on one list of firings
+ *******************************************/
+static void check_action(const struct periodic_task *task, unsigned int duration, int64_t now,
+						 const struct schedule_action *action, const int64_t *firings, unsigned int count,
+						 unsigned int *f, unsigned int window, int dst)
+{
+	int64_t oracle_next;
+	int oracle_fire;
+
+	while(*f < count && firings[*f] < now)
+		(*f)++;
+	oracle_fire = *f < count && firings[*f] == now;
+	// next firing after 'now'; none within the three days: anything later is fine
+	oracle_next = *f + oracle_fire < count ? firings[*f + oracle_fire] : INT64_MAX;
+
+	if(oracle_fire && !action->fire)
+		record_mismatch(MISMATCH_MISSED_FIRING, window, dst, task, duration, now, action, oracle_fire, oracle_next);
+	else if(!oracle_fire && action->fire)
+		record_mismatch(MISMATCH_EXTRA_FIRING, window, dst, task, duration, now, action, oracle_fire, oracle_next);
+	if(action->fire && action->planned_sec != now)
+		record_mismatch(MISMATCH_WRONG_PLANNED, window, dst, task, duration, now, action, oracle_fire, oracle_next);
+	if(action->wake_sec <= now)
+		record_mismatch(MISMATCH_NO_PROGRESS, window, dst, task, duration, now, action, oracle_fire, oracle_next);
+	else if(action->wake_sec > oracle_next)
+		record_mismatch(MISMATCH_SKIPPED_FIRING, window, dst, task, duration, now, action, oracle_fire, oracle_next);
+}
+
+/******************************************
+ * verify_replay()
+ * Replays a task thread over one day, as run_periodic_task() runs it, with runs of
+ * 'duration' seconds.
+ * return: number of schedule_next_action() calls
+ *******************************************/
+static unsigned long verify_replay(const struct periodic_task *task, unsigned int duration, time_t midnight,
+								   time_t next_midnight, const int64_t *firings, unsigned int count,
+								   unsigned int window, int dst)
+{
+	struct schedule_action action, missed;
+	int64_t now = midnight, planned_wake = 0;
+	unsigned long calls = 0;
+	unsigned int f = 0, g;
+
+	while(now < next_midnight) {
+		// woke up after the planned wake-up: a firing passed meanwhile must be reported
+		if(planned_wake && now > planned_wake) {
+			for(g=f; g<count && firings[g] < planned_wake; g++)
+				;
+			if(g < count && firings[g] < now) {
+				schedule_next_action(task, (time_t)planned_wake, &missed);
+				calls++;
+				if(!missed.fire)
+					record_mismatch(MISMATCH_UNREPORTED, window, dst, task, duration, now, &missed, 1, firings[g]);
+			}
+		}
+		schedule_next_action(task, (time_t)now, &action);
+		calls++;
+		check_action(task, duration, now, &action, firings, count, &f, window, dst);
+		if(action.wake_sec <= now)
+			break;
+		planned_wake = action.wake_sec;
+		if(action.fire)
+			now += duration;
+		now = action.wake_sec > now ? action.wake_sec : now;
+	}
+	return calls;
+}
+
+/******************************************
+ * verify_unit()
+ * Checks every end minute and current time of one (day, frequency, start minute), and
+ * replays the task thread for every run duration.
+ *******************************************/
+static void verify_unit(unsigned int day, unsigned int freq, unsigned int start_min)
+{
+	static int64_t firings[VERIFY_FIRINGS_MAX];
+	struct periodic_task task = {0};
+	struct schedule_action action;
+	time_t midnight = days[day];
+	time_t next_midnight = local_time(midnight, 1, 0);
+	unsigned long calls = 0;
+	unsigned int end_min, count, f, d, window;
+	int64_t now;
+	int dst = day_is_dst_switch[day];
+
+	task.id         = 1;
+	task.start_hour = start_min / 60;
+	task.start_min  = start_min % 60;
+	task.freq       = freq;
+
+	for(end_min=0; end_min<1440; end_min+=step_min) {
+		task.end_hour = end_min / 60;
+		task.end_min  = end_min % 60;
+		window = end_min > start_min ? WINDOW_START_BEFORE_END :
+				 end_min < start_min ? WINDOW_START_AFTER_END : WINDOW_START_IS_END;
+		count = oracle_firings(midnight, start_min, end_min, freq, firings);
+
+		f = 0;
+		task.duration = 0;
+		for(now=midnight; now<next_midnight; now+=60) {
+			schedule_next_action(&task, (time_t)now, &action);
+			calls++;
+			check_action(&task, 0, now, &action, firings, count, &f, window, dst);
+		}
+
+		for(d=0; d<duration_count; d++) {
+			task.duration = durations[d];
+			calls += verify_replay(&task, durations[d], midnight, next_midnight, firings, count, window, dst);
+		}
+	}
+	atomic_fetch_add_explicit(&shared->calls, calls, memory_order_relaxed);
+}
+
+/******************************************
+ * worker()
+ * Takes units off the shared counter until there are none left.
+ *******************************************/
+static void worker(unsigned int units)
+{
+	unsigned int unit, starts = (1440 + step_min - 1) / step_min;
+
+	while((unit = atomic_fetch_add(&shared->next_unit, 1)) < units) {
+		verify_unit(unit / (freq_count * starts), freqs[(unit / starts) % freq_count], (unit % starts) * step_min);
+		atomic_fetch_add(&shared->units_done, 1);
+	}
+}
+
+/******************************************
+ * find_days()
+ * Picks the 15th of January of the current year as the plain day and adds every day of
+ * the year on which the UTC offset changes.
+ *******************************************/
+static void find_days(void)
+{
+	time_t now = time(NULL), day, next;
+	struct tm tm, tm_next;
+
+	localtime_r(&now, &tm);
+	tm.tm_mon   = 0;
+	tm.tm_mday  = 15;
+	tm.tm_hour  = tm.tm_min = tm.tm_sec = 0;
+	tm.tm_isdst = -1;
+	days[day_count++] = mktime(&tm);
+
+	tm.tm_mday = 1;
+	for(day=mktime(&tm); day_count < VERIFY_DAYS_MAX; day=next) {
+		next = local_time(day, 1, 0);
+		localtime_r(&day, &tm);
+		localtime_r(&next, &tm_next);
+		if(tm_next.tm_year != tm.tm_year)
+			break;
+		if(tm_next.tm_gmtoff != tm.tm_gmtoff) {
+			day_is_dst_switch[day_count] = 1;
+			days[day_count++] = day;
+		}
+	}
+}
+
+/******************************************
+ * parse_day()
+ * return: local midnight of a YYYY-MM-DD date, -1 if malformed
+ *******************************************/
+static time_t parse_day(const char *s)
+{
+	struct tm tm;
+
+	memset(&tm, 0, sizeof(tm));
+	if(sscanf(s, "%d-%d-%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday) != 3)
+		return -1;
+	tm.tm_year -= 1900;
+	tm.tm_mon  -= 1;
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
+
+/******************************************
+ * report()
+ * return: total number of mismatches
+ *******************************************/
+static unsigned long report(double seconds, unsigned int workers)
+{
+	struct verify_example *ex;
+	unsigned long total = 0, n;
+	unsigned int k, w, dst;
+	unsigned long calls = atomic_load(&shared->calls);
+
+	printf("%lu calls in %.1f sec with %u workers (%.0f calls/sec)\n", calls, seconds, workers, calls / seconds);
+	printf("mismatch,window,day,count\n");
+	for(k=0; k<MISMATCH_KINDS; k++)
+		for(w=0; w<WINDOW_KINDS; w++)
+			for(dst=0; dst<2; dst++) {
+				n = atomic_load(&shared->mismatches[k][w][dst]);
+				if(n)
+					printf("%s,%s,%s,%lu\n", mismatch_names[k], window_names[w], dst ? "dst_switch" : "plain", n);
+				total += n;
+			}
+
+	for(k=0; k<MISMATCH_KINDS; k++) {
+		if(!atomic_flag_test_and_set(&shared->example_taken[k]))
+			continue;
+		ex = &shared->example[k];
+		printf("first %s: start %02u:%02u end %02u:%02u freq %u duration %u at %lld: fire %d planned %lld wake %lld; oracle fire %d next %lld\n",
+			   mismatch_names[k], ex->start_min / 60, ex->start_min % 60, ex->end_min / 60, ex->end_min % 60,
+			   ex->freq, ex->duration, (long long)ex->current_sec, ex->fire, (long long)ex->planned_sec, (long long)ex->wake_sec,
+			   ex->oracle_fire, ex->oracle_next_sec == INT64_MAX ? -1LL : (long long)ex->oracle_next_sec);
+	}
+	printf("%s\n", total ? "MISMATCHES FOUND" : "no mismatches");
+	return total;
+}
+
+/******************************************
+ * main()
+ *******************************************/
+int main(int argc, char **argv)
+{
+	struct timespec t0, t1;
+	unsigned int workers = (unsigned int)sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int units, done, i, running = 0, switches = 0;
+	char *tok, *save;
+	time_t last_progress;
+	pid_t pid;
+	int opt, status;
+
+	// with TZ unset the C library looks at /etc/localtime on every call, 10x slower
+	if(getenv("TZ") == NULL)
+		setenv("TZ", ":/etc/localtime", 1);
+	tzset();
+
+	while((opt = getopt(argc, argv, "j:q:r:d:m:x")) != -1) {
+		switch(opt) {
+		case 'j':
+			workers = (unsigned int)atoi(optarg);
+			break;
+		case 'q':
+			freq_count = 0;
+			for(tok=strtok_r(optarg, ",", &save); tok && freq_count < VERIFY_FREQS_MAX; tok=strtok_r(NULL, ",", &save))
+				if(atoi(tok) > 0)
+					freqs[freq_count++] = (unsigned int)atoi(tok);
+			break;
+		case 'r':
+			duration_count = 0;
+			for(tok=strtok_r(optarg, ",", &save); tok && duration_count < VERIFY_DURATIONS_MAX; tok=strtok_r(NULL, ",", &save))
+				if(atoi(tok) > 0)
+					durations[duration_count++] = (unsigned int)atoi(tok);
+			break;
+		case 'd':
+			if(day_count < VERIFY_DAYS_MAX && (days[day_count] = parse_day(optarg)) != -1) {
+				day_is_dst_switch[day_count] = local_time(days[day_count], 1, 0) - days[day_count] != 86400;
+				day_count++;
+			}
+			break;
+		case 'm':
+			step_min = (unsigned int)atoi(optarg);
+			break;
+		case 'x':
+			step_min = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-j workers] [-q freq,freq,...] [-r sec,sec,...] [-d YYYY-MM-DD ...] [-m step_min | -x]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(workers == 0)
+		workers = 1;
+	if(step_min == 0)
+		step_min = 1;
+	if(freq_count == 0) {
+		fprintf(stderr, "no frequency to check\n");
+		return 2;
+	}
+	if(day_count == 0)
+		find_days();
+
+	shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(shared == MAP_FAILED) {
+		perror("mmap");
+		return 2;
+	}
+	units = day_count * freq_count * ((1440 + step_min - 1) / step_min);
+	for(i=0; i<day_count; i++)
+		switches += day_is_dst_switch[i];
+
+	printf("%u days (%u DST switches), %u frequencies, %u run durations, start/end every %u min: %u units\n",
+		   day_count, switches, freq_count, duration_count, step_min, units);
+	fflush(stdout);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for(i=0; i<workers; i++) {
+		pid = fork();
+		if(pid == 0) {
+			worker(units);
+			_exit(0);
+		}
+		if(pid > 0)
+			running++;
+	}
+	if(running == 0) {
+		perror("fork");
+		return 2;
+	}
+
+	last_progress = time(NULL);
+	while(running) {
+		pid = waitpid(-1, &status, WNOHANG);
+		if(pid > 0) {
+			running--;
+			continue;
+		}
+		sleep(1);
+		if(time(NULL) - last_progress >= VERIFY_PROGRESS_SEC) {
+			last_progress = time(NULL);
+			done = atomic_load(&shared->units_done);
+			fprintf(stderr, "%u/%u units\n", done, units);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	return report((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9, workers) ? 1 : 0;
+}
@@ -0,0 +1,56 @@
+/******************************************
+ * water_report
+ * Prints the daily water ledger (water_ledger.bin, see water_ledger.h) as CSV:
+ *   date,kind,id,runs,open_sec,volume_l
+ * kind is "task" or "gpio"; the last day is the current one, still counting.
+ *
+ * usage: water_report [water_ledger.bin] > water.csv
+ *******************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "../crc32.h"
+#include "../water_ledger.h"
+
+/******************************************
+ * main()
+ *******************************************/
+int main(int argc, char **argv)
+{
+	const char *path = argc > 1 ? argv[1] : WATER_LEDGER_FILE;
+	struct water_ledger_header hdr;
+	struct water_ledger_record rec;
+	char date[16];
+	time_t day_sec;
+	struct tm tm;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if(fp == NULL) {
+		perror(path);
+		return 1;
+	}
+	if(fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != WATER_LEDGER_MAGIC ||
+	   hdr.version != WATER_LEDGER_VERSION || hdr.record_size != sizeof(rec)) {
+		fprintf(stderr, "%s: not a water ledger\n", path);
+		fclose(fp);
+		return 1;
+	}
+
+	printf("date,kind,id,runs,open_sec,volume_l\n");
+	while(fread(&rec, sizeof(rec), 1, fp) == 1) {
+		if(rec.crc != crc32(0, &rec, offsetof(struct water_ledger_record, crc))) {
+			fprintf(stderr, "%s: damaged record, stopping\n", path);
+			break;
+		}
+		day_sec = (time_t)rec.day * 86400;
+		gmtime_r(&day_sec, &tm);
+		strftime(date, sizeof(date), "%Y-%m-%d", &tm);
+		printf("%s,%s,%u,%u,%u,%.3f\n", date, rec.kind == WATER_KIND_TASK ? "task" : "gpio",
+			   rec.id, rec.runs, rec.open_sec, rec.volume_ml / 1000.0);
+	}
+	fclose(fp);
+	return 0;
+}
@@ -1,175 +1,370 @@
-#include <mysql.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <time.h>
 #include <pthread.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <semaphore.h>
+#ifdef BCM2835_TRACE
+#include <fcntl.h>
+#endif
 #include "bcm2835.h"
-#include "vertical_garden_rpi_app.h"
+#include "flight_recorder.h"
+#include "history_writer.h"
+#include "jitter_hist.h"
+#include "log_archive.h"
+#include "logger.h"
+#include "metrics.h"
+#include "periodic_task.h"
+#include "probes.h"
+#include "schedule_snapshot.h"
+#include "scheduler.h"
+#include "storage_backend.h"
+#include "water_ledger.h"
 
 /******************************************
  *                Defines
  *******************************************/
-#define PERIODIC_TASKS_NO   6
-#define TASK_ID_POS	    0
-#define TASK_ACTIVE_POS     1
-#define TASK_START_TIME_POS 2
-#define TASK_END_TIME_POS   3
-#define TASK_FREQ_POS	    4
-#define TASK_DURATION_POS   5
-
-#define LOG_FILE "log_file.csv"
+#define DB_RETRY_SEC 60
+#define HAL_TRACE_FILE "bcm2835_trace.csv"  // written on SIGUSR2 with -DBCM2835_TRACE
 
 /******************************************
- *             Global Variables
+ *              Data Types
  *******************************************/
-struct periodic_task {
-	unsigned int id;
-	unsigned int start_hour;
-	unsigned int start_min;
-	unsigned int end_hour;
-	unsigned int end_min;
-	unsigned int freq;
-	unsigned int duration;
+// where a task thread spends its time outside the sleeps; the totals go to the metrics
+// right away and to the log with every wake-up summary
+struct task_usage {
+	struct timespec mark;   // CLOCK_MONOTONIC at the start of the current phase
+	uint64_t        busy_us;
+	uint64_t        cpu_us;
+	uint64_t        logged_busy_us; // totals at the last summary
+	uint64_t        logged_cpu_us;
 };
 
+/******************************************
+ *             Global Variables
+ *******************************************/
+// periodic_tasks[i] points into periodic_task_slots[i] while slot i holds an enabled task;
+// both arrays are protected by schedule_mutex since the schedule can be replaced at runtime.
+// A task keeps its slot (and so its thread) for as long as its id stays in the schedule.
+struct periodic_task  periodic_task_slots[PERIODIC_TASKS_NO];
 struct periodic_task *periodic_tasks[PERIODIC_TASKS_NO];
 
-pthread_mutex_t logfile_mutex;
+// task threads are detached; a thread clears its started flag when it exits, so
+// periodic_task_started[] and periodic_tasks_running are protected by schedule_mutex too
+pthread_t     thread_id_periodic_tasks[PERIODIC_TASKS_NO];
+unsigned char periodic_task_started[PERIODIC_TASKS_NO];
+unsigned int  periodic_tasks_running;
 
-const unsigned int task_gpios[6] = {4, 0, 0, 0, 0, 0};
+pthread_mutex_t schedule_mutex;
+pthread_cond_t  periodic_tasks_exited;
 
-const struct time_segment {
-	time_t        segment_start;
-	time_t        segment_end;
-	unsigned char active;
-};
+const struct storage_backend *storage;
+
+// valve GPIO and flow of every task, set in periodic_task.h
+const unsigned int task_gpios[PERIODIC_TASKS_NO] = TASK_GPIOS;
+const unsigned int task_flow_ml_per_min[PERIODIC_TASKS_NO] = TASK_FLOWS;
+
+// set once bcm2835_init() succeeded; the GPIOs must not be touched otherwise
+unsigned char hal_ready;
+
+// posted by the SIGTERM handler, waited for by stop_waiter()
+sem_t stop_request;
 
 /******************************************
  *            Function Prototypes
  *******************************************/
-static void print_safe(unsigned int task_id, pthread_mutex_t* mutex, char* msg, int argn, ...);
+static void *run_periodic_task(void *arg);
 
+#ifdef BCM2835_TRACE
 /******************************************
- * update_periodic_tasks_from_database()
+ * dump_hal_trace()
+ * SIGUSR2 handler: writes the register access counts and the last accesses to
+ * HAL_TRACE_FILE
+ * NOTE: async-signal-safe, bcm2835_trace_dump() only uses write()
  *******************************************/
-static void update_periodic_tasks_from_database(void)
+static void dump_hal_trace(int sig)
 {
-	MYSQL *conn;
-	MYSQL_RES *res;
-	MYSQL_ROW *row;
-	int i;
+	int fd;
+
+	(void)sig;
+	fd = open(HAL_TRACE_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd >= 0) {
+		bcm2835_trace_dump(fd);
+		close(fd);
+	}
+}
+#endif
 
-	//printf("MySQL Database connection initiated\n");
-	print_safe(0, &logfile_mutex, "MySQL Database connection initiated\n", 0);
+/******************************************
+ * request_stop()
+ * SIGTERM handler: wakes stop_waiter(), which does the actual shutdown.
+ * NOTE: async-signal-safe, sem_post() only
+ *******************************************/
+static void request_stop(int sig)
+{
+	(void)sig;
+	sem_post(&stop_request);
+}
 
-	conn = mysql_init(NULL);
+/******************************************
+ * stop_controller()
+ * params: - int status: exit status
+ * Orderly shutdown: the queued runs are written to the storage or the spool, then
+ * exit() runs the log archive and logger stop handlers (the log ring is flushed)
+ * and the flight recorder dump. Does not return.
+ * NOTE: only the first caller shuts down, a second one waits for the exit()
+ *******************************************/
+static void stop_controller(int status)
+{
+	static pthread_mutex_t stop_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-	if(!mysql_real_connect(conn, db_server, db_user, db_password, db_database, 0, NULL, 0)) {
-		fprintf(stderr, "%s\n", mysql_error(conn));
-		print_safe(0, &logfile_mutex, "MySQL DB Connect Error: %s\n", 1, mysql_error(conn));
-		exit(1);
-	}
+	pthread_mutex_lock(&stop_mutex);
+	history_writer_stop();
+	exit(status);
+}
 
-	// SELECT * FROM irrigation_table
-	if(mysql_query(conn, "SELECT * FROM irrigation_table")) {
-		fprintf(stderr, "%s\n", mysql_error(conn));
-		print_safe(0, &logfile_mutex, "MySQL DB Query Error: %s\n", 1, mysql_error(conn));
-		exit(3);
-	}
+/******************************************
+ * stop_waiter()
+ * Thread waiting for SIGTERM (systemctl stop) to stop the controller.
+ *******************************************/
+static void *stop_waiter(void *arg)
+{
+	(void)arg;
+	flight_recorder_thread_init();
+	while(sem_wait(&stop_request) && errno == EINTR)
+		;
+	LOG_INFO(0, "SIGTERM received, stopping\n");
+	stop_controller(0);
+	return NULL;
+}
 
-	res = mysql_use_result(conn);
+/******************************************
+ * record_i2c_error()
+ * bcm2835 I2C error hook: the failed transfer goes to the flight recorder.
+ *******************************************/
+static void record_i2c_error(uint8_t reason, uint32_t len)
+{
+	(void)len;
+	flight_record(FLIGHT_HAL_ERROR, 0, -1, reason);
+}
 
-	// reset periodic tasks
-	for(i=0; i<PERIODIC_TASKS_NO; i++)
-		periodic_tasks[i] = NULL;
+/******************************************
+ * apply_periodic_tasks()
+ * params: - const struct periodic_task* tasks: new schedule
+ * 		   - unsigned int count: number of elements in 'tasks'
+ * NOTE: slots are matched by task id, whatever order the storage returns the tasks in;
+ *       running task threads pick up their new parameters on their next wake-up and
+ *       a thread whose slot is emptied terminates on its next wake-up
+ *******************************************/
+static void apply_periodic_tasks(const struct periodic_task *tasks, unsigned int count)
+{
+	unsigned char placed[PERIODIC_TASKS_NO] = {0};
+	unsigned int i, j, pass;
+
+	if(count > PERIODIC_TASKS_NO)
+		count = PERIODIC_TASKS_NO;
 
-	// update periodic tasks with database parameters
-	i=0;
-	// mysql_fetch_row() returns the next database row in the form of an array of strings
-	while((row = mysql_fetch_row(res)) != NULL) {
-		// watch out not to exceed the limit
-		if(i >= PERIODIC_TASKS_NO) {
-			break;
+	pthread_mutex_lock(&schedule_mutex);
+	// tasks still in the schedule stay in their slot
+	for(i=0; i<PERIODIC_TASKS_NO; i++) {
+		if(periodic_tasks[i] == NULL)
+			continue;
+		for(j=0; j<count && (placed[j] || tasks[j].id != periodic_tasks[i]->id); j++)
+			;
+		if(j < count) {
+			periodic_task_slots[i] = tasks[j];
+			placed[j] = 1;
+		} else {
+			periodic_tasks[i] = NULL;
 		}
-		// process only the enabled tasks
-		if(atoi(row[TASK_ACTIVE_POS])) {
-			periodic_tasks[i] = (struct periodic_task*)malloc(sizeof(struct periodic_task));
-			if(periodic_tasks[i] != NULL) {
-				periodic_tasks[i]->id         = (unsigned int)atoi(row[TASK_ID_POS]);
-				periodic_tasks[i]->freq       = (unsigned int)atoi(row[TASK_FREQ_POS]);
-				periodic_tasks[i]->duration   = (unsigned int)atoi(row[TASK_DURATION_POS]);
-				// start time read from database in the "hh:mm:ss" format
-				periodic_tasks[i]->start_hour = (unsigned int)atoi(strtok(row[TASK_START_TIME_POS], ":"));
-				periodic_tasks[i]->start_min  = (unsigned int)atoi(strtok(NULL, ":"));
-				// end time read from database in the "hh:mm:ss" format
-				periodic_tasks[i]->end_hour   = (unsigned int)atoi(strtok(row[TASK_END_TIME_POS], ":"));
-				periodic_tasks[i]->end_min    = (unsigned int)atoi(strtok(NULL, ":"));
+	}
+	// new tasks go to free slots, those without a thread first; a thread which has not
+	// noticed yet that its slot was emptied takes over the task in it
+	for(pass=0; pass<2; pass++) {
+		for(j=0, i=0; j<count; j++) {
+			if(placed[j])
+				continue;
+			while(i < PERIODIC_TASKS_NO && (periodic_tasks[i] != NULL || (pass == 0 && periodic_task_started[i])))
 				i++;
-			} else {
-				fprintf(stderr, "ERROR: periodic task malloc failed; row id #%d, task id #%d\n", i, row[TASK_ID_POS]);
-				print_safe(0, &logfile_mutex, "MySQL ERROR: periodic task malloc failed; row id #%d, task id #%d\n", 2, i, row[TASK_ID_POS]);
-			}
+			if(i == PERIODIC_TASKS_NO)
+				break;
+			periodic_task_slots[i] = tasks[j];
+			periodic_tasks[i] = &periodic_task_slots[i];
+			placed[j] = 1;
 		}
 	}
+	pthread_mutex_unlock(&schedule_mutex);
+	metrics_gauge_set(METRIC_TASKS_SCHEDULED, count);
+}
 
-	mysql_free_result(res);
-	mysql_close(conn);
-	print_safe(0, &logfile_mutex, "MySQL Database connection done\n", 0);
+/******************************************
+ * start_periodic_tasks()
+ * Starts a thread for every occupied slot which has no thread yet.
+ *******************************************/
+static void start_periodic_tasks(void)
+{
+	uintptr_t i;
+
+	pthread_mutex_lock(&schedule_mutex);
+	for(i=0; i<PERIODIC_TASKS_NO; i++) {
+		if(periodic_tasks[i] != NULL && !periodic_task_started[i]) {
+			if(pthread_create(&thread_id_periodic_tasks[i],
+							  NULL,
+							  &run_periodic_task,
+							  (void*)i)) {
+				fprintf(stderr, "Error creating thread periodic task #%d\n", (int)i);
+				exit(3);
+			}
+			pthread_detach(thread_id_periodic_tasks[i]);
+			periodic_task_started[i] = 1;
+			periodic_tasks_running++;
+		}
+	}
+	pthread_mutex_unlock(&schedule_mutex);
 }
 
 /******************************************
- * print_safe()
- * params: - unsigned int task_id: id of the taks calling this function;
- * 								 primarily used for identifiying the thread in case of failure
- * 		   - pthread_mutex_t* mutex: pointer to the mutex used to protect the logfile
- * 		   - char* msg: pointer to the string to be written to logfile
- * 		   - int argn: number of arguments given in the elipses ('...') argument
- * 		   - ... : variable number of arguments (the number of arguments passed should match 'argn' parameter)
+ * reconcile_periodic_tasks()
+ * Loads the schedule from the storage backend, retrying until it succeeds, then persists
+ * it as the new schedule snapshot and applies it to the running task threads.
  *******************************************/
-static void print_safe(unsigned int task_id, pthread_mutex_t* mutex, char* msg, int argn, ...)
+static void *reconcile_periodic_tasks(void *arg)
 {
-	time_t timestamp_sec;
-	struct tm *timestamp;
-	FILE* fp;
-
-	// begin of mutex-protected area
-	pthread_mutex_lock(mutex);
-	// open log file
-	fp = fopen(LOG_FILE, "a+");
-	if(fp == NULL) {
-		printf("ERROR: task #%d: could not open log file\n", task_id);
-		exit(1);
+	struct periodic_task tasks[PERIODIC_TASKS_NO];
+	struct log_aggregate retries = {0};
+	unsigned int failures = 0;
+	unsigned int count;
+
+	(void)arg;
+	flight_recorder_thread_init();
+	while(storage_load_schedule(storage, tasks, PERIODIC_TASKS_NO, &count)) {
+		// the first failure is news; the retries after it only get a periodic summary
+		if(failures++ == 0)
+			LOG_WARN(0, "%s storage unreachable, retrying every ,%d, sec\n", storage->name, DB_RETRY_SEC);
+		else if(log_aggregate_add(&retries, failures, time(NULL), LOG_SUMMARY_SEC)) {
+			LOG_WARN(0, "%s storage still unreachable after ,%u, attempts\n", storage->name, failures);
+			log_aggregate_reset(&retries);
+		}
+		sleep(DB_RETRY_SEC);
 	}
-	// get current timestamp
-	timestamp_sec = time(NULL);            // seconds since epoch
-	timestamp = localtime(&timestamp_sec); // nicely broken down time
-	
-	va_list args;
-	va_start(args, argn);
-	// print timestamp
-	fprintf(fp, "%u,-,%d:%d:%d:%d:%d:%d:, ", timestamp_sec,
-					         timestamp->tm_year + 1900,
-						 timestamp->tm_mon + 1,
-						 timestamp->tm_mday,
-						 timestamp->tm_hour,
-						 timestamp->tm_min,
-						 timestamp->tm_sec);
-	// print the actual message together with the variable number of arguments
-	vfprintf(fp, msg, args);
-	va_end(args);
-	
-	// close log file
-	fclose(fp);
-	// end of mutex-protected area
-	pthread_mutex_unlock(mutex);
+	if(failures)
+		LOG_INFO(0, "%s storage reachable again after ,%u, attempts\n", storage->name, failures + 1);
+
+	if(schedule_snapshot_save(SCHEDULE_SNAPSHOT_FILE, tasks, count))
+		LOG_ERROR(0, "ERROR: could not save schedule snapshot %s\n", SCHEDULE_SNAPSHOT_FILE);
+
+	apply_periodic_tasks(tasks, count);
+	start_periodic_tasks();
+	LOG_INFO(0, "schedule reconciled with %s storage: ,%u, tasks\n", storage->name, count);
+	return NULL;
+}
+
+/******************************************
+ * task_phase()
+ * params: - struct task_usage* usage: the calling task thread's usage
+ * 		   - unsigned int task_id: id of the task
+ * 		   - enum metrics_counter id: counter of the phase that ends now
+ * Adds the wall time since the last phase ended to 'id' and starts the next phase.
+ *******************************************/
+static void task_phase(struct task_usage *usage, unsigned int task_id, enum metrics_counter id)
+{
+	struct timespec now;
+	uint64_t us;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	us = (now.tv_sec - usage->mark.tv_sec) * 1000000 + (now.tv_nsec - usage->mark.tv_nsec) / 1000;
+	usage->mark = now;
+	usage->busy_us += us;
+	metrics_inc(id, task_id, us);
 }
 
 /******************************************
  * execute_task()
+ * params: - const struct periodic_task* task: task to be executed
+ * 		   - time_t planned_sec: interval start this execution was scheduled for
+ * 		   - struct task_usage* usage: the calling task thread's usage
+ * Opens the task's valve for task->duration seconds and queues the run for the history.
  *******************************************/
-static void execute_task(const struct periodic_task* task)
+static void execute_task(const struct periodic_task* task, time_t planned_sec, struct task_usage* usage)
 {
+	struct run_history_event event;
+	unsigned int pin = 0;
+	unsigned int flow = 0;
+
+	if(task->id >= 1 && task->id <= sizeof(task_gpios)/sizeof(task_gpios[0])) {
+		pin  = task_gpios[task->id - 1];
+		flow = task_flow_ml_per_min[task->id - 1];
+	}
+
+	VG_PROBE2(execute_entry, task->id, pin);
+
+	event.task_id     = task->id;
+	event.planned_sec = planned_sec;
+	event.start_sec   = time(NULL);
+	event.open_sec    = 0;
+
+	if(pin == 0) {
+		event.result = RUN_RESULT_NO_VALVE;
+	} else if(!hal_ready) {
+		event.result = RUN_RESULT_HAL_ERROR;
+		flight_record(FLIGHT_HAL_ERROR, task->id, pin, 0);
+	} else {
+		bcm2835_gpio_fsel(pin, BCM2835_GPIO_FSEL_OUTP);
+		bcm2835_gpio_write(pin, HIGH);
+		flight_record(FLIGHT_VALVE_OPEN, task->id, pin, 0);
+		metrics_inc(METRIC_GPIO_WRITES, 0, 1);
+		LOG_INFO(task->id, "task #,%d, valve open on gpio ,%d,\n", task->id, pin);
+		// the valve open time is not actuation work
+		task_phase(usage, task->id, METRIC_TASK_ACTUATE_US);
+		sleep(task->duration);
+		clock_gettime(CLOCK_MONOTONIC, &usage->mark);
+		bcm2835_gpio_write(pin, LOW);
+		metrics_inc(METRIC_GPIO_WRITES, 0, 1);
+		event.open_sec = (unsigned int)(time(NULL) - event.start_sec);
+		flight_record(FLIGHT_VALVE_CLOSE, task->id, pin, event.open_sec);
+		water_ledger_record(task->id, pin, event.open_sec, flow);
+		event.result   = RUN_RESULT_OK;
+		LOG_INFO(task->id, "task #,%d, valve closed after ,%d, sec\n", task->id, event.open_sec);
+	}
+
+	if(event.result != RUN_RESULT_OK)
+		metrics_inc(METRIC_TASK_FAILED, task->id, 1);
+	VG_PROBE3(execute_exit, task->id, event.result, event.open_sec);
+
+	if(history_writer_push(&event))
+		LOG_WARN(task->id, "task #,%d, history queue full, run not recorded\n", task->id);
+	task_phase(usage, task->id, METRIC_TASK_ACTUATE_US);
+}
 
+/******************************************
+ * log_sleep_summary()
+ * Logs and restarts the summary of a task's wake-ups and of its time outside the
+ * sleeps, if there were any wake-ups.
+ *******************************************/
+static void log_sleep_summary(const struct periodic_task* task, struct log_aggregate* sleeps, struct task_usage* usage)
+{
+	struct jitter_snapshot late;
+
+	if(sleeps->count == 0)
+		return;
+	// the wake-up lateness since the previous summary (the metrics keep their own totals)
+	if(jitter_snapshot(task->id, &late))
+		memset(&late, 0, sizeof(late));
+	LOG_INFO(task->id, "task #,%d, ,%u, wake-ups in ,%ld, sec, sleep min ,%lld, max ,%lld, avg ,%lld, sec, busy ,%llu, us, cpu ,%llu, us, "
+			 "late p50 ,%u, p99 ,%u, max ,%u, us\n",
+			 task->id, sleeps->count, (long)(time(NULL) - sleeps->start_sec),
+			 (long long)sleeps->min, (long long)sleeps->max, (long long)(sleeps->sum / sleeps->count),
+			 (unsigned long long)(usage->busy_us - usage->logged_busy_us),
+			 (unsigned long long)(usage->cpu_us - usage->logged_cpu_us),
+			 late.p50_us, late.p99_us, late.max_us);
+	log_aggregate_reset(sleeps);
+	usage->logged_busy_us = usage->busy_us;
+	usage->logged_cpu_us  = usage->cpu_us;
 }
 
 /******************************************
@@ -177,149 +372,105 @@ static void execute_task(const struct periodic_task* task)
  *******************************************/
 static void *run_periodic_task(void *arg)
 {
-	struct periodic_task task = *(struct periodic_task *)arg;
+	uintptr_t slot = (uintptr_t)arg;
+	struct periodic_task task = {0};
+	struct periodic_task previous;
+	struct log_aggregate sleeps = {0};
+	struct task_usage usage = {0};
+	struct timespec now, cpu_start, cpu_end;
+	uint64_t busy_start, cpu_us;
 
 	time_t current_sec;
-	time_t start_sec;
-	time_t end_sec;
-	time_t interval_start;
-	time_t interval_end;
-	time_t sleep_sec = 60;
+	time_t sleep_sec;
+	time_t planned_wake_sec = 0;
 
-	struct tm *time_broken_down;
-
-	struct time_segment time_segments[3];
-
-	unsigned int intervals;
-	unsigned int i, s;
+	struct schedule_action action;
+	struct schedule_action missed;
 
+	flight_recorder_thread_init();
 	// run thread in infinite loop
 	while(1) {
-
-		// get current time in seconds since epoch (01.01.1970, 00:00:00)
-		current_sec = time(NULL);
-		// get current time broken down
-		time_broken_down = localtime(&current_sec);
-
-		// get task start time in sec
-		time_broken_down->tm_hour = task.start_hour; // overwrite current time's hour with the start hour 
-		time_broken_down->tm_min = task.start_min;   // overwrite current time's minute with the start minute
-		time_broken_down->tm_sec = 0;                // NOTE: start and end time do not supprt seconds resolution
-		start_sec = mktime(time_broken_down);        // transform in seconds since epoch
-
-		// set task end time in sec
-		time_broken_down->tm_hour = task.end_hour; // overwrite current time's hour with the end hour
-		time_broken_down->tm_min = task.end_min;   // overwrite current time's minute with the end minute
-		time_broken_down->tm_sec = 0;              // NOTE: start and end time do not supprt seconds resolution
-		end_sec = mktime(time_broken_down);        // transform in seconds since epoch
-
-		// Algorithm rationale:
-		//                         00:00:00                   23:59:59
-		// ||<------- DAY n-1 ------->||<--------- DAY n ------->||<------- DAY n+1 ------->|| }
-		// ||                         ||                         ||                         || }
-		// ||    start      end       ||    start      end       ||     start     end       || } case 1: start < end
-                // ||______|_________|________||______|_________|________||______|_________|________|| }
-		// ||      ^^^^^^^^^^^        ||      ^^^^^^^^^^^        ||      ^^^^^^^^^^^        || }
-		// ||      | active  |        ||      | active  |        ||      | active  |        || }
-                // ||      |         |        ||      |         |        ||      |         |        ||
-		// ||      |         |        ||      |         |        ||      |         |        || }
-		// ||     end      start      ||     end      start      ||     end      start      || }
-	        // ||______|_________|________||______|_________|________||______|_________|________|| } case 2: start > end
-		// ^^^^^^^^^         ^^^^^^^^^^^^^^^^^^         ^^^^^^^^^^^^^^^^^^         ^^^^^^^^^^^ }
-                //   active          |      active    |         |      active    |             active  }
-                //                   |                |         |                |                     }
-		//                   ^^^^^^^^^^^^^^^^^^         |                |
-		//                       SEGMENT_0    ^^^^^^^^^^^                |
-		//                                    SEGMENT_1  ^^^^^^^^^^^^^^^^^
-                //                                                 SEGMENT_2
-
-		// calculate time segments as per the above diagram
-		// case 1
-		if(start_sec < end_sec){
-			// time segment_0
-			time_segments[0].segment_start = end_sec - 86400;
-			time_segments[0].segment_end   = start_sec;
-			time_segments[0].active        = 0;
-			// time segment_1
-			time_segments[1].segment_start = start_sec;
-			time_segments[1].segment_end   = end_sec;
-			time_segments[1].active        = 1;
-			// time segment_2
-			time_segments[2].segment_start = end_sec;
-			time_segments[2].segment_end   = start_sec + 86400;
-			time_segments[2].active        = 0;
-		// case 2
-		} else if(start_sec > end_sec){
-			// time segment_0
-			time_segments[0].segment_start = start_sec - 86400;
-			time_segments[0].segment_end   = end_sec;
-			time_segments[0].active        = 1;
-			// time segment_1
-			time_segments[1].segment_start = end_sec;
-			time_segments[1].segment_end   = start_sec;
-			time_segments[1].active        = 0;
-			// time segment_2
-			time_segments[2].segment_start = start_sec;
-			time_segments[2].segment_end   = end_sec + 86400;
-			time_segments[2].active        = 1;
-		// case 3
-		} else {
-			// active period is around the clock
+		// account the non-sleep part of the loop: schedule, actuate, log
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+		clock_gettime(CLOCK_MONOTONIC, &usage.mark);
+		busy_start = usage.busy_us;
+
+		// take a private copy of the task parameters; the schedule may have been
+		// replaced while this thread was asleep
+		pthread_mutex_lock(&schedule_mutex);
+		if(periodic_tasks[slot] == NULL) {
+			// the slot can get a new thread from here on
+			periodic_task_started[slot] = 0;
+			periodic_tasks_running--;
+			pthread_cond_signal(&periodic_tasks_exited);
+			pthread_mutex_unlock(&schedule_mutex);
+			log_sleep_summary(&task, &sleeps, &usage);
+			LOG_INFO(task.id, "task #,%d, removed from schedule, thread exiting\n", task.id);
+			return NULL;
+		}
+		previous = task;
+		task = *periodic_tasks[slot];
+		pthread_mutex_unlock(&schedule_mutex);
+
+		// the slot was handed to another task: the old task's wake-up plan means nothing to it
+		if(previous.id && previous.id != task.id) {
+			log_sleep_summary(&previous, &sleeps, &usage);
+			LOG_INFO(task.id, "task #,%d, takes over the thread of task #,%d,\n", task.id, previous.id);
+			planned_wake_sec = 0;
 		}
 
-		// set the default sleep time for the current thread
-		sleep_sec = 60;
-
-		// iterate through all the time segments and determine in which one the current time fits in
-		for(s=0; s<3; s++){
-			// active segment
-			if( (current_sec >= time_segments[s].segment_start) &&
-				(current_sec <= time_segments[s].segment_end)   &&
-				(time_segments[s].active == 1)) {
-				// calculate the wake-up intervals across the active segment
-				intervals = (unsigned int)(time_segments[s].segment_end -
-						                   time_segments[s].segment_start) /
-						                   (task.freq * 60);
-				// determine in which of these intervals the current time is
-				for(i=0; i<intervals; i++){
-					interval_start = ( i    * task.freq * 60) + time_segments[s].segment_start;
-					interval_end   = ((i+1) * task.freq * 60) + time_segments[s].segment_start;
-					// found a valid interval inside the active time segment
-					if(current_sec >= interval_start &&
-					   current_sec <  interval_end) {
-						// determine now if the current time perfectly matches the start of the interval
-						// or if the thread need to be put to sleep until the start of the next interval
-						if(current_sec == interval_start) {
-							// execute task
-							execute_task(&task);
-							// put thread to sleep until: (next interval start) - (the duration of the task)
-							sleep_sec = interval_end - task.duration;
-						} else {
-							// put thread to sleep until next interval start
-							sleep_sec = interval_end - current_sec;
-						}
-						// break the for loop;
-						break;
-					}
-				}
-			// inactive segment
-			} else if ( (current_sec > time_segments[s].segment_start) &&
-					    (current_sec < time_segments[s].segment_end)   &&
-					    (time_segments[s].active == 0) ) {
-
-				switch(s){
-				case 0: sleep_sec = time_segments[1].segment_start - current_sec; break;
-				case 1: sleep_sec = time_segments[2].segment_start - current_sec; break;
-				case 2: sleep_sec = (time_segments[1].segment_start + 86400) - current_sec; break;
-				default: // we're in trouble if program flow choses this case
-					break;
-				}
+		// get current time in seconds since epoch (01.01.1970, 00:00:00)
+		clock_gettime(CLOCK_REALTIME, &now);
+		current_sec = now.tv_sec;
+		VG_PROBE3(task_wake, task.id, (long)current_sec, (long)planned_wake_sec);
+		// how late this wake-up is against the planned one, whether it fires, misses
+		// a run or just sleeps on
+		if(planned_wake_sec)
+			jitter_record(task.id, (int64_t)(current_sec - planned_wake_sec) * 1000000 + now.tv_nsec / 1000);
+		// woke up past the planned time: was a run due back then?
+		if(planned_wake_sec && current_sec > planned_wake_sec) {
+			schedule_next_action(&task, planned_wake_sec, &missed);
+			if(missed.fire) {
+				metrics_inc(METRIC_TASK_MISSED, task.id, 1);
+				flight_record(FLIGHT_MISSED, task.id, (int32_t)missed.planned_sec, 0);
+				LOG_WARN(task.id, "task #,%d, missed the run planned at ,%ld, woke up ,%ld, sec late\n",
+						 task.id, (long)missed.planned_sec, (long)(current_sec - planned_wake_sec));
 			}
 		}
-		// put thread to sleep until the next scheduled wake-up
-		print_safe(task.id, &logfile_mutex, "task #,%d, going to sleep for ,%d, sec (,%d, min)\n", 3, task.id, sleep_sec, sleep_sec/60);
+		// work out whether the task is due now and when to wake up next
+		schedule_next_action(&task, current_sec, &action);
+		flight_record(FLIGHT_WAKEUP, task.id, planned_wake_sec ? (int32_t)(current_sec - planned_wake_sec) : 0, action.fire);
+		planned_wake_sec = action.wake_sec;
+		task_phase(&usage, task.id, METRIC_TASK_SCHEDULE_US);
+		if(action.fire) {
+			VG_PROBE2(task_fire, task.id, (long)action.planned_sec);
+			metrics_inc(METRIC_TASK_FIRINGS, task.id, 1);
+			// one line per firing, valve or not: tools/schedule_replay -l diffs these
+			LOG_INFO(task.id, "task #,%d, fired planned ,%ld,\n", task.id, (long)action.planned_sec);
+			// execute task
+			execute_task(&task, action.planned_sec, &usage);
+		}
+
+		// the wake-up time is absolute; the execution above may have taken a while
+		sleep_sec = action.wake_sec - time(NULL);
+		if(sleep_sec < 0)
+			sleep_sec = 0;
+
+		// put thread to sleep until the next scheduled wake-up; the per wake-up lines are
+		// debug only, the log gets a summary every LOG_SUMMARY_SEC
+		metrics_observe(METRIC_SLEEP_SEC, sleep_sec);
+		if(log_aggregate_add(&sleeps, sleep_sec, time(NULL), LOG_SUMMARY_SEC))
+			log_sleep_summary(&task, &sleeps, &usage);
+		LOG_DEBUG(task.id, "task #,%d, going to sleep for ,%ld, sec (,%ld, min)\n", task.id, (long)sleep_sec, (long)sleep_sec/60);
+		task_phase(&usage, task.id, METRIC_TASK_LOG_US);
+
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+		cpu_us = (cpu_end.tv_sec - cpu_start.tv_sec) * 1000000 + (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1000;
+		usage.cpu_us += cpu_us;
+		metrics_inc(METRIC_TASK_CPU_US, task.id, cpu_us);
+		metrics_observe(METRIC_TASK_BUSY_US, usage.busy_us - busy_start);
 		sleep(sleep_sec);
-		print_safe(task.id, &logfile_mutex, "task #,%d, woke up\n", 1, task.id);
+		LOG_DEBUG(task.id, "task #,%d, woke up\n", task.id);
 	 }
 }
 
@@ -328,41 +479,108 @@ static void *run_periodic_task(void *arg)
  *******************************************/
 int main() {
 
-	pthread_t thead_id_access_db;
-	pthread_t thread_id_periodic_tasks[PERIODIC_TASKS_NO];
-	unsigned int i;
+	pthread_t thread_id_reconcile;
+	pthread_t thread_id_stop;
+	struct sigaction sa;
+	struct periodic_task tasks[PERIODIC_TASKS_NO];
+	unsigned int count;
+	unsigned char reconciling = 0;
+
+	pthread_mutex_init(&schedule_mutex, NULL);
+	pthread_cond_init(&periodic_tasks_exited, NULL);
 
-	pthread_mutex_init(&logfile_mutex, NULL);
+	// keep the last events for the post mortem when the controller dies
+	if(flight_recorder_install())
+		fprintf(stderr, "WARNING: flight recorder not installed\n");
+
+	// start the log writer; every message below is queued for it
+	logger_set_segment_hook(log_archive_segment_closed);
+	if(logger_start(LOG_FILE, LOG_SEGMENT_COUNT, LOG_SEGMENT_BYTES)) {
+		printf("ERROR: could not open log file %s\n", LOG_FILE);
+		exit(1);
+	}
 
-	print_safe(0, &logfile_mutex, "Application started\n", 0);
+	LOG_INFO(0, "Application started\n");
+	// closed log segments are compressed in the background; logging works without it
+	if(log_archive_start(LOG_FILE, LOG_SEGMENT_COUNT, LOG_SEGMENT_BYTES))
+		LOG_WARN(0, "WARNING: log archiving not started\n");
 	// initialize bcm2835 library
-	print_safe(0, &logfile_mutex, "bcm2835_init result: %d\n", 1, bcm2835_init());
+	hal_ready = (unsigned char)bcm2835_init();
+	LOG_INFO(0, "bcm2835_init result: %d\n", hal_ready);
+	if(!hal_ready)
+		flight_record(FLIGHT_HAL_ERROR, 0, 0, 0);
+	bcm2835_i2c_set_error_hook(record_i2c_error);
+#ifdef BCM2835_TRACE
+	signal(SIGUSR2, dump_hal_trace);
+#endif
+
+	// today's valve totals; a restart during the day carries on from the ledger
+	if(water_ledger_open(WATER_LEDGER_FILE))
+		LOG_WARN(0, "WARNING: could not open water ledger %s\n", WATER_LEDGER_FILE);
+
+	// Prometheus text endpoint; the controller runs without it
+	if(metrics_start(METRICS_SOCKET, METRICS_HTTP_PORT))
+		LOG_WARN(0, "WARNING: metrics endpoint not started\n");
+
+	// select the schedule/history storage backend
+	storage = storage_backend_find(getenv(STORAGE_BACKEND_ENV));
+	if(storage == NULL) {
+		fprintf(stderr, "Unknown storage backend '%s'\n", getenv(STORAGE_BACKEND_ENV));
+		LOG_ERROR(0, "ERROR: unknown storage backend %s\n", getenv(STORAGE_BACKEND_ENV));
+		exit(1);
+	}
+	LOG_INFO(0, "storage backend: %s\n", storage->name);
 
-	// update periodic tasks parameters from database
-	update_periodic_tasks_from_database();
+	// run history is written back in batches by its own thread
+	if(history_writer_start(storage)) {
+		fprintf(stderr, "Error creating history writer thread\n");
+		exit(3);
+	}
 
-	// run each periodic task in it's own pthread
-	for(i=0; i<PERIODIC_TASKS_NO; i++) {
-		if(periodic_tasks[i] != NULL) {
-			if(pthread_create(&thread_id_periodic_tasks[i],
-							  NULL,
-							  &run_periodic_task,
-							  (void*)periodic_tasks[i])) {
-				fprintf(stderr, "Error creating thread periodic task #%d\n", i);
-				exit(3);
-			}
+	// SIGTERM stops the controller without losing the queued runs or log messages
+	sem_init(&stop_request, 0, 0);
+	if(pthread_create(&thread_id_stop, NULL, &stop_waiter, NULL)) {
+		fprintf(stderr, "Error creating stop thread\n");
+		exit(3);
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = request_stop;
+	sa.sa_flags   = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGTERM, &sa, NULL);
+
+	// start scheduling right away from the last good schedule, if there is one,
+	// and reconcile with the storage backend in the background
+	if(schedule_snapshot_load(SCHEDULE_SNAPSHOT_FILE, tasks, PERIODIC_TASKS_NO, &count) == 0) {
+		LOG_INFO(0, "schedule snapshot loaded: ,%u, tasks\n", count);
+		apply_periodic_tasks(tasks, count);
+		// run each periodic task in it's own pthread
+		start_periodic_tasks();
+		if(pthread_create(&thread_id_reconcile, NULL, &reconcile_periodic_tasks, NULL)) {
+			fprintf(stderr, "Error creating storage reconcile thread\n");
+			exit(3);
 		}
+		reconciling = 1;
+	} else {
+		// no usable snapshot: nothing to schedule until the storage answers
+		LOG_INFO(0, "no usable schedule snapshot, waiting for %s storage\n", storage->name);
+		reconcile_periodic_tasks(NULL);
 	}
 
-	// wait for all started pthreads
-	for(i=0; i<PERIODIC_TASKS_NO; i++) {
-		if(periodic_tasks[i] != NULL) {
-			if(pthread_join(thread_id_periodic_tasks[i], NULL)) {
-				fprintf(stderr, "Error joining thread #%d\n", i);
-				exit(2);
-			}
-		}
+	// once reconciled no more task threads get started
+	if(reconciling && pthread_join(thread_id_reconcile, NULL)) {
+		fprintf(stderr, "Error joining storage reconcile thread\n");
+		exit(2);
 	}
+
+	// wait until all task threads have exited
+	pthread_mutex_lock(&schedule_mutex);
+	while(periodic_tasks_running > 0)
+		pthread_cond_wait(&periodic_tasks_exited, &schedule_mutex);
+	pthread_mutex_unlock(&schedule_mutex);
+
+	// last attempt to write the queued runs; whatever the storage does not take is
+	// committed to the spool
+	stop_controller(0);
  return 0;
 }
-
@@ -0,0 +1,267 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "crc32.h"
+#include "water_ledger.h"
+
+/******************************************
+ *              Data Types
+ *******************************************/
+struct water_counters {
+	atomic_uint runs;
+	atomic_uint open_sec;
+	atomic_uint volume_ml;
+};
+
+/******************************************
+ *            Global Variables
+ *******************************************/
+// today's totals: updated lock-free, taken over with atomic_exchange() at midnight so no
+// run is lost (one finishing right at midnight may count for either day)
+static struct water_counters water_tasks[WATER_TASKS];
+static struct water_counters water_pins[WATER_PINS];
+static atomic_int            water_day;
+static atomic_uint           water_dirty; // runs recorded since the last sync
+
+// the ledger file; water_mutex serializes the rollover and the writes
+static pthread_mutex_t water_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int   water_fd = -1;
+static off_t water_today_off; // where the records of the current day start
+
+/******************************************
+ * water_ledger_day()
+ * return: local calendar day of 'sec', in days since 1970-01-01
+ *******************************************/
+int32_t water_ledger_day(int64_t sec)
+{
+	time_t t = (time_t)sec;
+	struct tm tm;
+
+	localtime_r(&t, &tm);
+	return (int32_t)((sec + tm.tm_gmtoff) / 86400);
+}
+
+/******************************************
+ * water_fill()
+ * Turns one set of counters into a ledger record, if it has anything to record.
+ * return: 1 if 'rec' was filled, 0 if the counters are all zero
+ *******************************************/
+static int water_fill(struct water_ledger_record *rec, int32_t day, uint8_t kind, uint8_t id,
+					  uint32_t runs, uint32_t open_sec, uint32_t volume_ml)
+{
+	if(runs == 0 && open_sec == 0)
+		return 0;
+	memset(rec, 0, sizeof(*rec));
+	rec->day       = day;
+	rec->kind      = kind;
+	rec->id        = id;
+	rec->runs      = (uint16_t)(runs < UINT16_MAX ? runs : UINT16_MAX);
+	rec->open_sec  = open_sec;
+	rec->volume_ml = volume_ml;
+	rec->crc       = crc32(0, rec, offsetof(struct water_ledger_record, crc));
+	return 1;
+}
+
+/******************************************
+ * water_write_locked()
+ * Writes the records of 'day' at water_today_off: the final totals if 'take' is set
+ * (the counters are cleared for the next day), else the running totals.
+ * return: number of records written, -1 on error
+ *******************************************/
+static int water_write_locked(int32_t day, int take)
+{
+	struct water_ledger_record recs[WATER_TASKS + WATER_PINS];
+	struct water_counters *c;
+	uint32_t runs, open_sec, volume_ml;
+	unsigned int i, n = 0;
+	ssize_t len;
+
+	for(i=0; i<WATER_TASKS + WATER_PINS; i++) {
+		c = i < WATER_TASKS ? &water_tasks[i] : &water_pins[i - WATER_TASKS];
+		if(take) {
+			runs      = atomic_exchange(&c->runs, 0);
+			open_sec  = atomic_exchange(&c->open_sec, 0);
+			volume_ml = atomic_exchange(&c->volume_ml, 0);
+		} else {
+			runs      = atomic_load_explicit(&c->runs, memory_order_relaxed);
+			open_sec  = atomic_load_explicit(&c->open_sec, memory_order_relaxed);
+			volume_ml = atomic_load_explicit(&c->volume_ml, memory_order_relaxed);
+		}
+		if(i < WATER_TASKS)
+			n += water_fill(&recs[n], day, WATER_KIND_TASK, i, runs, open_sec, volume_ml);
+		else
+			n += water_fill(&recs[n], day, WATER_KIND_PIN, i - WATER_TASKS, runs, open_sec, volume_ml);
+	}
+	if(water_fd < 0 || n == 0)
+		return n;
+
+	len = n * sizeof(recs[0]);
+	if(pwrite(water_fd, recs, len, water_today_off) != len)
+		return -1;
+	fdatasync(water_fd);
+	return n;
+}
+
+/******************************************
+ * water_rollover()
+ * Closes the day in the ledger if the calendar day changed since the last call.
+ *******************************************/
+static void water_rollover(void)
+{
+	int32_t today = water_ledger_day(time(NULL));
+	int32_t day;
+	int n;
+
+	if(atomic_load_explicit(&water_day, memory_order_relaxed) == today)
+		return;
+
+	pthread_mutex_lock(&water_mutex);
+	day = atomic_load_explicit(&water_day, memory_order_relaxed);
+	if(day != today) {
+		// the records of the old day become final; the next day starts behind them
+		n = water_write_locked(day, 1);
+		if(n > 0)
+			water_today_off += n * sizeof(struct water_ledger_record);
+		atomic_store_explicit(&water_day, today, memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&water_mutex);
+}
+
+/******************************************
+ * water_ledger_open()
+ * params: - const char* path: ledger file, created if missing
+ * return: 0 on success, -1 on error (the totals are still kept in memory)
+ * NOTE: if the last records in the file are from today, the totals carry on from them
+ *******************************************/
+int water_ledger_open(const char *path)
+{
+	struct water_ledger_header hdr;
+	struct water_ledger_record rec;
+	struct water_counters *c;
+	struct stat st;
+	int32_t today = water_ledger_day(time(NULL));
+	off_t off, today_off;
+
+	atomic_store(&water_day, today);
+	water_fd = open(path, O_RDWR | O_CREAT, 0644);
+	if(water_fd < 0)
+		return -1;
+	if(fstat(water_fd, &st))
+		goto fail;
+
+	if(st.st_size < (off_t)sizeof(hdr)) {
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.magic       = WATER_LEDGER_MAGIC;
+		hdr.version     = WATER_LEDGER_VERSION;
+		hdr.record_size = sizeof(rec);
+		if(pwrite(water_fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) || ftruncate(water_fd, sizeof(hdr)))
+			goto fail;
+		water_today_off = sizeof(hdr);
+		return 0;
+	}
+	if(pread(water_fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+	   hdr.magic != WATER_LEDGER_MAGIC || hdr.version != WATER_LEDGER_VERSION || hdr.record_size != sizeof(rec))
+		goto fail;
+
+	// walk the valid records; today's come last and are loaded back into the counters
+	today_off = -1;
+	for(off = sizeof(hdr); off + (off_t)sizeof(rec) <= st.st_size; off += sizeof(rec)) {
+		if(pread(water_fd, &rec, sizeof(rec), off) != (ssize_t)sizeof(rec) ||
+		   rec.crc != crc32(0, &rec, offsetof(struct water_ledger_record, crc)))
+			break;
+		if(rec.day != today)
+			continue;
+		if(today_off < 0)
+			today_off = off;
+		if(rec.kind == WATER_KIND_TASK && rec.id < WATER_TASKS)
+			c = &water_tasks[rec.id];
+		else if(rec.kind == WATER_KIND_PIN && rec.id < WATER_PINS)
+			c = &water_pins[rec.id];
+		else
+			continue;
+		atomic_store(&c->runs, rec.runs);
+		atomic_store(&c->open_sec, rec.open_sec);
+		atomic_store(&c->volume_ml, rec.volume_ml);
+	}
+	// a torn record (power cut while rewriting today) ends the valid part
+	water_today_off = today_off >= 0 ? today_off : off;
+	return 0;
+
+fail:
+	close(water_fd);
+	water_fd = -1;
+	return -1;
+}
+
+/******************************************
+ * water_ledger_record()
+ * params: - unsigned int task_id: task that ran
+ * 		   - unsigned int pin: GPIO of its valve
+ * 		   - unsigned int open_sec: how long the valve was open
+ * 		   - unsigned int flow_ml_per_min: flow of the valve, 0 if unknown
+ * Adds a finished run to today's totals.
+ * NOTE: atomic adds only, no lock and no file access: safe on the actuation path. The
+ *       file is brought up to date by water_ledger_sync(); a run finishing after
+ *       midnight but before the next sync or scrape counts for the day before.
+ *******************************************/
+void water_ledger_record(unsigned int task_id, unsigned int pin, unsigned int open_sec, unsigned int flow_ml_per_min)
+{
+	unsigned int volume_ml = (unsigned int)((uint64_t)open_sec * flow_ml_per_min / 60);
+
+	if(task_id < WATER_TASKS) {
+		atomic_fetch_add_explicit(&water_tasks[task_id].runs, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&water_tasks[task_id].open_sec, open_sec, memory_order_relaxed);
+		atomic_fetch_add_explicit(&water_tasks[task_id].volume_ml, volume_ml, memory_order_relaxed);
+	}
+	if(pin < WATER_PINS) {
+		atomic_fetch_add_explicit(&water_pins[pin].runs, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&water_pins[pin].open_sec, open_sec, memory_order_relaxed);
+		atomic_fetch_add_explicit(&water_pins[pin].volume_ml, volume_ml, memory_order_relaxed);
+	}
+	atomic_store_explicit(&water_dirty, 1, memory_order_release);
+}
+
+/******************************************
+ * water_ledger_sync()
+ * Closes the day in the ledger if it changed, and rewrites today's records if runs
+ * were recorded since the last call. Called by a background thread (the history
+ * writer, on each of its triggers), never by a task thread.
+ *******************************************/
+void water_ledger_sync(void)
+{
+	water_rollover();
+	if(!atomic_exchange_explicit(&water_dirty, 0, memory_order_acquire))
+		return;
+	pthread_mutex_lock(&water_mutex);
+	water_write_locked(atomic_load_explicit(&water_day, memory_order_relaxed), 0);
+	pthread_mutex_unlock(&water_mutex);
+}
+
+/******************************************
+ * water_ledger_today()
+ * params: - struct water_usage* tasks: WATER_TASKS elements, indexed by task id
+ * 		   - struct water_usage* pins: WATER_PINS elements, indexed by GPIO
+ * Reads today's totals; no file access unless the day just ended.
+ *******************************************/
+void water_ledger_today(struct water_usage *tasks, struct water_usage *pins)
+{
+	unsigned int i;
+
+	water_rollover();
+	for(i=0; i<WATER_TASKS; i++) {
+		tasks[i].runs      = atomic_load_explicit(&water_tasks[i].runs, memory_order_relaxed);
+		tasks[i].open_sec  = atomic_load_explicit(&water_tasks[i].open_sec, memory_order_relaxed);
+		tasks[i].volume_ml = atomic_load_explicit(&water_tasks[i].volume_ml, memory_order_relaxed);
+	}
+	for(i=0; i<WATER_PINS; i++) {
+		pins[i].runs      = atomic_load_explicit(&water_pins[i].runs, memory_order_relaxed);
+		pins[i].open_sec  = atomic_load_explicit(&water_pins[i].open_sec, memory_order_relaxed);
+		pins[i].volume_ml = atomic_load_explicit(&water_pins[i].volume_ml, memory_order_relaxed);
+	}
+}
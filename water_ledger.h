@@ -0,0 +1,58 @@
+#ifndef WATER_LEDGER_H
+#define WATER_LEDGER_H
+
+#include <stdint.h>
+
+/******************************************
+ *                Defines
+ *******************************************/
+#define WATER_LEDGER_FILE    "water_ledger.bin"
+#define WATER_LEDGER_MAGIC   0x4C574756u /* "VGWL" little endian */
+#define WATER_LEDGER_VERSION 1
+#define WATER_TASKS          16 // task ids 0..WATER_TASKS-1 are accumulated
+#define WATER_PINS           54 // BCM2835 GPIOs
+
+// water_ledger_record.kind
+#define WATER_KIND_TASK 0
+#define WATER_KIND_PIN  1
+
+/******************************************
+ *              Data Types
+ *******************************************/
+// On-disk layout: one header followed by fixed size records, one per task and per pin
+// that ran on a day, in host byte order. The records of the finished days are never
+// touched again; the records of the current day are at the end of the file and are
+// rewritten by water_ledger_sync() after runs, so a restart carries on with the day's totals.
+struct water_ledger_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+};
+
+struct water_ledger_record {
+	int32_t  day;        // local calendar day, days since 1970-01-01
+	uint8_t  kind;       // WATER_KIND_TASK or WATER_KIND_PIN
+	uint8_t  id;         // task id or GPIO
+	uint16_t runs;
+	uint32_t open_sec;
+	uint32_t volume_ml;  // estimated from the configured flow of the valve
+	uint32_t crc;        // crc32 over the fields above
+};
+
+// today's totals of one task or pin
+struct water_usage {
+	uint32_t runs;
+	uint32_t open_sec;
+	uint32_t volume_ml;
+};
+
+/******************************************
+ *            Function Prototypes
+ *******************************************/
+int     water_ledger_open(const char *path);
+void    water_ledger_record(unsigned int task_id, unsigned int pin, unsigned int open_sec, unsigned int flow_ml_per_min);
+void    water_ledger_sync(void);
+void    water_ledger_today(struct water_usage *tasks, struct water_usage *pins);
+int32_t water_ledger_day(int64_t sec);
+
+#endif /* WATER_LEDGER_H */